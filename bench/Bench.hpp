@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <Utilities/Time.hpp>
+
+namespace CrossFire
+{
+
+namespace bench
+{
+
+/**
+ * @brief Check if the benchmark was asked for a short run, as under ctest.
+ * @param argc The argument count from main.
+ * @param argv The arguments from main.
+ * @return True for a short run, false for a full one.
+ */
+inline auto quick(int argc, char **argv) -> bool
+{
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Fail the benchmark if a result is wrong.
+ * @param condition The check.
+ * @param message What went wrong.
+ */
+inline auto check(bool condition, const char *message) -> void
+{
+    if (condition)
+        return;
+
+    fprintf(stderr, "FAILED: %s\n", message);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Time a function, keeping the fastest of several runs.
+ * @tparam F The type of the function.
+ * @param runs The number of runs.
+ * @param f The function.
+ * @return The fastest run in nanoseconds.
+ */
+template <typename F> inline auto time_best(usize runs, F &&f) -> u64
+{
+    u64 best = ~0ULL;
+    for (usize i = 0; i < runs; i++) {
+        auto start = get_time_nanoseconds();
+        f();
+        auto elapsed = get_time_nanoseconds() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+    return best;
+}
+
+/**
+ * @brief Print a result as nanoseconds per item.
+ * @param name The name of the case.
+ * @param ns The time in nanoseconds.
+ * @param items The number of items processed.
+ */
+inline auto report(const char *name, u64 ns, usize items) -> void
+{
+    printf("%-32s %10.3f ns/item\n", name,
+           static_cast<f64>(ns) / static_cast<f64>(items));
+}
+
+}
+
+}
\ No newline at end of file
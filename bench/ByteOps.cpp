@@ -0,0 +1,174 @@
+#include <Utilities/ByteOps.hpp>
+#include <algorithm>
+#include <vector>
+#include "Bench.hpp"
+
+using namespace CrossFire;
+
+namespace
+{
+
+// Plain loops the kernels must agree with, and are timed against
+auto count_reference(const u8 *ptr, usize len, u8 value) -> usize
+{
+    usize count = 0;
+    for (usize i = 0; i < len; i++)
+        count += ptr[i] == value;
+    return count;
+}
+
+auto reverse_reference(u8 *ptr, usize len) -> void
+{
+    for (usize i = 0; i < len / 2; i++) {
+        u8 tmp = ptr[i];
+        ptr[i] = ptr[len - 1 - i];
+        ptr[len - 1 - i] = tmp;
+    }
+}
+
+auto swap_reference(u8 *ptr, usize count, usize size) -> void
+{
+    for (usize i = 0; i < count; i++)
+        reverse_reference(ptr + i * size, size);
+}
+
+auto find_reference(const u8 *ptr, usize len, u8 value) -> Option<usize>
+{
+    for (usize i = 0; i < len; i++) {
+        if (ptr[i] == value)
+            return i;
+    }
+    return std::nullopt;
+}
+
+template <typename T>
+auto check_swap(std::vector<u8> &data, usize len) -> void
+{
+    auto count = len / sizeof(T);
+    std::vector<u8> expected(data.begin(), data.begin() + len);
+    swap_reference(expected.data(), count, sizeof(T));
+    byte_swap(Slice<T>(reinterpret_cast<T *>(data.data()), count));
+    bench::check(std::equal(expected.begin(),
+                            expected.begin() + count * sizeof(T),
+                            data.begin()),
+                 "byte_swap disagrees with the reference");
+    swap_reference(data.data(), count, sizeof(T));
+}
+
+/**
+ * @brief Check every kernel against its reference at every length up to a
+ * few vectors, so that each head and tail path is taken.
+ */
+auto check_kernels(std::vector<u8> &data) -> void
+{
+    for (usize len = 0; len <= 300; len++) {
+        Slice<u8> bytes(data.data(), len);
+        bench::check(count_byte(bytes, 7) ==
+                         count_reference(data.data(), len, 7),
+                     "count_byte disagrees with the reference");
+        bench::check(find_byte(bytes, 200) ==
+                         find_reference(data.data(), len, 200),
+                     "find_byte disagrees with the reference");
+
+        std::vector<u8> expected(data.begin(), data.begin() + len);
+        reverse_reference(expected.data(), len);
+        reverse_bytes(bytes);
+        bench::check(equal_bytes(bytes, Slice<u8>(expected.data(), len)),
+                     "reverse_bytes disagrees with the reference");
+        reverse_reference(data.data(), len);
+
+        check_swap<u16>(data, len);
+        check_swap<u32>(data, len);
+        check_swap<u64>(data, len);
+    }
+
+    std::vector<u8> copy(data);
+    bench::check(equal_bytes(Slice<u8>(data.data(), data.size()),
+                             Slice<u8>(copy.data(), copy.size())),
+                 "equal_bytes missed equal slices");
+    copy.back() ^= 1;
+    bench::check(!equal_bytes(Slice<u8>(data.data(), data.size()),
+                              Slice<u8>(copy.data(), copy.size())),
+                 "equal_bytes missed a difference in the last byte");
+
+    fill_bytes(Slice<u8>(copy.data(), copy.size()), 9);
+    bench::check(count_reference(copy.data(), copy.size(), 9) == copy.size(),
+                 "fill_bytes left a byte unset");
+}
+
+}
+
+auto main(int argc, char **argv) -> int
+{
+    auto quick = bench::quick(argc, argv);
+    usize len = quick ? 64 * 1024 : 16 * 1024 * 1024;
+    usize runs = quick ? 2 : 10;
+
+    // Random bytes, so that searches and counts do real work
+    std::vector<u8> data(len);
+    u32 seed = 12345;
+    for (auto &byte : data) {
+        seed = seed * 1664525 + 1013904223;
+        byte = static_cast<u8>(seed >> 24);
+    }
+    check_kernels(data);
+
+    const char *levels[] = { "scalar", "SSE2", "AVX2" };
+    printf("byte kernels use %s\n",
+           levels[static_cast<int>(get_simd_level())]);
+
+    Slice<u8> bytes(data.data(), len);
+    usize counted = 0, counted_plain = 0;
+    auto count =
+        bench::time_best(runs, [&] { counted = count_byte(bytes, 7); });
+    auto count_plain = bench::time_best(
+        runs, [&] { counted_plain = count_reference(data.data(), len, 7); });
+    bench::check(counted == counted_plain, "count_byte disagrees when timed");
+
+    auto reverse = bench::time_best(runs, [&] { reverse_bytes(bytes); });
+    auto reverse_plain = bench::time_best(
+        runs, [&] { reverse_reference(data.data(), len); });
+
+    auto swap32 = bench::time_best(runs, [&] {
+        byte_swap(Slice<u32>(reinterpret_cast<u32 *>(data.data()), len / 4));
+    });
+    auto swap32_plain = bench::time_best(
+        runs, [&] { swap_reference(data.data(), len / 4, 4); });
+    auto swap64 = bench::time_best(runs, [&] {
+        byte_swap(Slice<u64>(reinterpret_cast<u64 *>(data.data()), len / 8));
+    });
+    auto swap64_plain = bench::time_best(
+        runs, [&] { swap_reference(data.data(), len / 8, 8); });
+
+    // Search for a byte that is not there, so the whole buffer is read
+    std::vector<u8> other(len, 1);
+    Slice<u8> ones(other.data(), len);
+    Option<usize> found = 0, found_plain = 0;
+    auto find = bench::time_best(runs, [&] { found = find_byte(ones, 0); });
+    auto find_plain = bench::time_best(
+        runs, [&] { found_plain = find_reference(other.data(), len, 0); });
+    bench::check(!found.has_value() && !found_plain.has_value(),
+                 "find_byte found a byte that is not there");
+
+    std::vector<u8> same(other);
+    bool matched = false;
+    auto equal = bench::time_best(runs, [&] {
+        matched = equal_bytes(ones, Slice<u8>(same.data(), len));
+    });
+    bench::check(matched, "equal_bytes missed equal buffers");
+    auto fill = bench::time_best(runs, [&] { fill_bytes(ones, 1); });
+
+    bench::report("count_byte", count, len);
+    bench::report("count_byte, plain loop", count_plain, len);
+    bench::report("reverse_bytes", reverse, len);
+    bench::report("reverse_bytes, plain loop", reverse_plain, len);
+    bench::report("byte_swap<u32>", swap32, len);
+    bench::report("byte_swap<u32>, plain loop", swap32_plain, len);
+    bench::report("byte_swap<u64>", swap64, len);
+    bench::report("byte_swap<u64>, plain loop", swap64_plain, len);
+    bench::report("find_byte", find, len);
+    bench::report("find_byte, plain loop", find_plain, len);
+    bench::report("equal_bytes", equal, len);
+    bench::report("fill_bytes", fill, len);
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,169 @@
+#include <Utilities/Threading/Epoch.hpp>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "Bench.hpp"
+
+using namespace CrossFire;
+
+namespace
+{
+
+constexpr u64 MAGIC = 0x5AFE5AFE5AFE5AFEULL;
+constexpr usize SLOTS = 8;
+
+std::atomic<i64> live{ 0 };
+
+// Poisoned when destroyed, so a reader that sees it freed notices
+struct Node {
+    u64 magic;
+    u64 value;
+
+    explicit Node(u64 value)
+        : magic(MAGIC)
+        , value(value)
+    {
+        live.fetch_add(1, std::memory_order_relaxed);
+    }
+    ~Node()
+    {
+        magic = 0;
+        live.fetch_sub(1, std::memory_order_relaxed);
+    }
+};
+
+auto make_node(u64 value) -> Node *
+{
+    return c_allocator.create<Node>(value).unwrap();
+}
+
+/**
+ * @brief Wait until no retired node is left, collecting on this thread,
+ * which takes in the records of threads that have exited.
+ */
+auto drain(EpochDomain &domain, i64 linked) -> bool
+{
+    for (usize i = 0; i < 100 && live.load() != linked; i++)
+        domain.synchronize();
+    return live.load() == linked;
+}
+
+/**
+ * @brief A node retired while a reader is pinned or holds a hazard pointer
+ * to it must outlive the reader.
+ */
+auto check_grace(EpochDomain &domain) -> void
+{
+    std::atomic<Node *> slot{ make_node(1) };
+    std::atomic<u32> step{ 0 };
+
+    std::thread reader([&] {
+        EpochGuard guard(domain);
+        auto node = slot.load(std::memory_order_acquire);
+        step.store(1);
+        while (step.load() != 2)
+            std::this_thread::yield();
+        bench::check(node->magic == MAGIC, "a pinned reader's node was freed");
+    });
+    while (step.load() != 1)
+        std::this_thread::yield();
+
+    auto old = slot.exchange(make_node(2));
+    (void)domain.retire(old, c_allocator).unwrap();
+    for (usize i = 0; i < 8; i++)
+        domain.collect();
+    bench::check(live.load() == 2, "a node was freed while a reader was "
+                                   "pinned");
+    step.store(2);
+    reader.join();
+    bench::check(drain(domain, 1), "a node was not freed after its grace "
+                                   "period");
+
+    // A hazard pointer holds a node past any number of grace periods
+    {
+        HazardPointer hazard;
+        auto held = hazard.protect(slot);
+        old = slot.exchange(make_node(3));
+        (void)domain.retire(old, c_allocator).unwrap();
+        for (usize i = 0; i < 4; i++)
+            domain.synchronize();
+        bench::check(live.load() == 2 && held->magic == MAGIC,
+                     "a node held by a hazard pointer was freed");
+        hazard.reset();
+    }
+    bench::check(drain(domain, 1), "a node was not freed after its hazard "
+                                   "pointer let go");
+
+    (void)domain.retire(slot.load(), c_allocator).unwrap();
+    bench::check(drain(domain, 0), "the last node was not freed");
+}
+
+}
+
+auto main(int argc, char **argv) -> int
+{
+    auto quick = bench::quick(argc, argv);
+    usize swaps = quick ? 20000 : 1000000;
+    auto &domain = EpochDomain::get();
+
+    check_grace(domain);
+
+    std::atomic<Node *> slots[SLOTS];
+    for (usize i = 0; i < SLOTS; i++)
+        slots[i].store(make_node(i));
+
+    // Writers swap in new nodes and retire the old ones, then exit with
+    // some still pending, which later collections must take over. Readers
+    // check every node they see is intact, pinned or through a hazard
+    // pointer held across yields.
+    std::atomic<bool> done{ false };
+    std::atomic<bool> intact{ true };
+    std::vector<std::thread> threads;
+    auto start = get_time_nanoseconds();
+    for (usize w = 0; w < 2; w++) {
+        threads.emplace_back([&, w] {
+            for (usize i = 0; i < swaps; i++) {
+                auto &slot = slots[(i * 7 + w) % SLOTS];
+                auto old = slot.exchange(make_node(i));
+                (void)domain.retire(old, c_allocator).unwrap();
+            }
+        });
+    }
+    for (usize r = 0; r < 2; r++) {
+        threads.emplace_back([&, r] {
+            HazardPointer hazard;
+            for (usize i = 0; !done.load(std::memory_order_relaxed); i++) {
+                auto &slot = slots[(i + r) % SLOTS];
+                if (r == 0) {
+                    EpochGuard guard(domain);
+                    auto node = slot.load(std::memory_order_acquire);
+                    if (node->magic != MAGIC)
+                        intact.store(false);
+                } else {
+                    auto node = hazard.protect(slot);
+                    std::this_thread::yield();
+                    if (node->magic != MAGIC)
+                        intact.store(false);
+                    hazard.reset();
+                }
+            }
+        });
+    }
+    threads[0].join();
+    threads[1].join();
+    auto elapsed = get_time_nanoseconds() - start;
+    done.store(true);
+    threads[2].join();
+    threads[3].join();
+
+    bench::check(intact.load(), "a reader saw a freed node");
+    bench::check(drain(domain, SLOTS),
+                 "nodes retired by exited threads were never freed");
+
+    for (auto &slot : slots)
+        (void)domain.retire(slot.load(), c_allocator).unwrap();
+    bench::check(drain(domain, 0), "the last nodes were not freed");
+
+    bench::report("retire and swap", elapsed, swaps * 2);
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
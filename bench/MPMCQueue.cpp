@@ -0,0 +1,158 @@
+#include <Utilities/Threading/MPMCQueue.hpp>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Bench.hpp"
+
+using namespace CrossFire;
+
+namespace
+{
+
+// Producer in the top bits, sequence number in the rest
+constexpr u32 PRODUCER_SHIFT = 24;
+constexpr u32 SEQUENCE_MASK = (1 << PRODUCER_SHIFT) - 1;
+constexpr usize BATCH = 16;
+
+/**
+ * @brief Push every item through a queue with the given number of
+ * producers and consumers, checking that each arrives exactly once and in
+ * the order its producer pushed it.
+ * @return The time taken in nanoseconds.
+ */
+template <typename Push, typename Pop>
+auto run(usize threads, usize items, Push &&push, Pop &&pop) -> u64
+{
+    auto per_producer = items / threads;
+    std::vector<std::atomic<u8> > seen(per_producer * threads);
+    for (auto &count : seen)
+        count.store(0, std::memory_order_relaxed);
+    std::atomic<usize> remaining{ per_producer * threads };
+    std::atomic<bool> ordered{ true };
+
+    std::vector<std::thread> workers;
+    auto start = get_time_nanoseconds();
+    for (usize p = 0; p < threads; p++) {
+        workers.emplace_back([&, p] {
+            auto base = static_cast<u32>(p) << PRODUCER_SHIFT;
+            for (usize i = 0; i < per_producer;) {
+                auto pushed = push(base, i, per_producer);
+                if (pushed == 0)
+                    std::this_thread::yield();
+                i += pushed;
+            }
+        });
+    }
+    for (usize c = 0; c < threads; c++) {
+        workers.emplace_back([&] {
+            std::vector<i64> last(threads, -1);
+            u32 out[BATCH];
+            while (remaining.load(std::memory_order_relaxed) > 0) {
+                auto popped = pop(out);
+                if (popped == 0) {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                for (usize i = 0; i < popped; i++) {
+                    auto producer = out[i] >> PRODUCER_SHIFT;
+                    auto sequence = out[i] & SEQUENCE_MASK;
+                    if (static_cast<i64>(sequence) <= last[producer])
+                        ordered.store(false, std::memory_order_relaxed);
+                    last[producer] = sequence;
+                    seen[producer * per_producer + sequence].fetch_add(
+                        1, std::memory_order_relaxed);
+                }
+                remaining.fetch_sub(popped, std::memory_order_relaxed);
+            }
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+    auto elapsed = get_time_nanoseconds() - start;
+
+    for (auto &count : seen)
+        bench::check(count.load(std::memory_order_relaxed) == 1,
+                     "an item was lost or delivered twice");
+    bench::check(ordered.load(std::memory_order_relaxed),
+                 "a producer's items arrived out of order");
+    return elapsed;
+}
+
+}
+
+auto main(int argc, char **argv) -> int
+{
+    auto quick = bench::quick(argc, argv);
+    usize items = quick ? 100000 : 4000000;
+    usize runs = quick ? 1 : 5;
+    usize max_threads = std::thread::hardware_concurrency();
+    if (max_threads < 4)
+        max_threads = 4;
+
+    for (usize threads = 1; threads <= max_threads; threads *= 2) {
+        auto best = [&](auto &&push, auto &&pop) {
+            return bench::time_best(
+                runs, [&] { run(threads, items, push, pop); });
+        };
+
+        MPMCQueue<u32> queue(c_allocator, 1024);
+        auto single = best(
+            [&](u32 base, usize i, usize) -> usize {
+                return queue.try_push(base | static_cast<u32>(i)) ? 1 : 0;
+            },
+            [&](u32 *out) -> usize {
+                auto value = queue.try_pop();
+                if (!value.has_value())
+                    return 0;
+                out[0] = *value;
+                return 1;
+            });
+
+        auto batched = best(
+            [&](u32 base, usize i, usize end) -> usize {
+                u32 values[BATCH];
+                usize count = 0;
+                for (; count < BATCH && i + count < end; count++)
+                    values[count] = base | static_cast<u32>(i + count);
+                return queue.try_push_batch(Slice<u32>(values, count));
+            },
+            [&](u32 *out) -> usize {
+                return queue.try_pop_batch(Slice<u32>(out, BATCH));
+            });
+
+        // What the queue replaces: a deque behind a mutex
+        std::mutex mutex;
+        std::deque<u32> locked;
+        auto baseline = best(
+            [&](u32 base, usize i, usize) -> usize {
+                std::lock_guard<std::mutex> guard(mutex);
+                if (locked.size() >= 1024)
+                    return 0;
+                locked.push_back(base | static_cast<u32>(i));
+                return 1;
+            },
+            [&](u32 *out) -> usize {
+                std::lock_guard<std::mutex> guard(mutex);
+                if (locked.empty())
+                    return 0;
+                out[0] = locked.front();
+                locked.pop_front();
+                return 1;
+            });
+
+        char name[64];
+        snprintf(name, sizeof(name), "%zu+%zu threads, MPMCQueue", threads,
+                 threads);
+        bench::report(name, single, items);
+        snprintf(name, sizeof(name), "%zu+%zu threads, batches of %zu",
+                 threads, threads, BATCH);
+        bench::report(name, batched, items);
+        snprintf(name, sizeof(name), "%zu+%zu threads, mutex and deque",
+                 threads, threads);
+        bench::report(name, baseline, items);
+    }
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
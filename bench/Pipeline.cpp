@@ -0,0 +1,119 @@
+#include <Utilities/Threading/Pipeline.hpp>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "Bench.hpp"
+
+using namespace CrossFire;
+
+namespace
+{
+
+constexpr usize CAPACITY = 16;
+constexpr usize SLOW_CAPACITY = 4;
+constexpr usize SLOW_PARALLELISM = 2;
+
+/**
+ * @brief Raise a high-water mark to a new value if it is higher.
+ */
+auto raise(std::atomic<usize> &peak, usize value) -> void
+{
+    auto current = peak.load(std::memory_order_relaxed);
+    while (value > current &&
+           !peak.compare_exchange_weak(current, value,
+                                       std::memory_order_relaxed))
+        ;
+}
+
+}
+
+auto main(int argc, char **argv) -> int
+{
+    auto quick = bench::quick(argc, argv);
+    usize count = quick ? CAPACITY * 8 : CAPACITY * 256;
+    ThreadPool pool(4);
+
+    // A fast stage feeds a slow one that lets items overtake each other,
+    // and an ordered stage puts them back in the order they were pushed
+    std::vector<u64> output;
+    output.reserve(count);
+    std::atomic<usize> slow_active{ 0 };
+    std::atomic<usize> slow_peak{ 0 };
+    std::atomic<usize> ordered_active{ 0 };
+    std::atomic<usize> ordered_peak{ 0 };
+
+    Pipeline<u64> pipeline(c_allocator, pool, CAPACITY);
+    PipelineStageConfig fast;
+    fast.name = "fast";
+    fast.parallelism = 4;
+    (void)pipeline.add_stage([](u64 &item) { item *= 3; }, fast).unwrap();
+
+    PipelineStageConfig slow;
+    slow.name = "slow";
+    slow.parallelism = SLOW_PARALLELISM;
+    slow.capacity = SLOW_CAPACITY;
+    (void)pipeline
+        .add_stage(
+            [&](u64 &item) {
+                raise(slow_peak, slow_active.fetch_add(1) + 1);
+                auto delay = item / 3 % 4 == 0 ? 400 : 50;
+                std::this_thread::sleep_for(std::chrono::microseconds(delay));
+                slow_active.fetch_sub(1);
+            },
+            slow)
+        .unwrap();
+
+    PipelineStageConfig ordered;
+    ordered.name = "ordered";
+    ordered.ordered = true;
+    (void)pipeline
+        .add_stage(
+            [&](u64 &item) {
+                raise(ordered_peak, ordered_active.fetch_add(1) + 1);
+                output.push_back(item / 3);
+                ordered_active.fetch_sub(1);
+            },
+            ordered)
+        .unwrap();
+
+    // Push many times the capacity; push() must stall, not overfill
+    usize most_pending = 0;
+    auto start = get_time_nanoseconds();
+    for (u64 i = 0; i < count; i++) {
+        pipeline.push(i);
+        auto pending = pipeline.pending();
+        most_pending = pending > most_pending ? pending : most_pending;
+    }
+    pipeline.wait();
+    auto elapsed = get_time_nanoseconds() - start;
+
+    bench::check(most_pending <= CAPACITY,
+                 "the pipeline held more items than its capacity");
+    bench::check(pipeline.pending() == 0, "items were left in the pipeline");
+    bench::check(output.size() == count, "items were lost or duplicated");
+    for (usize i = 0; i < output.size(); i++)
+        bench::check(output[i] == i, "the ordered stage took items out of "
+                                     "order");
+
+    bench::check(slow_peak.load() <= SLOW_PARALLELISM,
+                 "the slow stage ran more items than its parallelism");
+    bench::check(ordered_peak.load() == 1,
+                 "the ordered stage ran items at once");
+
+    usize bounds[] = { CAPACITY, SLOW_CAPACITY, CAPACITY };
+    for (usize i = 0; i < pipeline.size(); i++) {
+        auto stats = pipeline.get_stats(i);
+        bench::check(stats.processed == count,
+                     "a stage did not process every item");
+        bench::check(stats.peak_depth <= bounds[i],
+                     "a stage queue grew past its capacity");
+        bench::check(stats.depth == 0 && stats.active == 0,
+                     "a stage is still busy after wait()");
+    }
+    bench::check(pipeline.get_stats(0).stalls > 0,
+                 "the stage before the slow one never stalled");
+
+    bench::report("Pipeline push to ordered output", elapsed, count);
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
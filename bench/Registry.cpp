@@ -0,0 +1,105 @@
+#include <Utilities/Registry.hpp>
+#include <vector>
+#include "Bench.hpp"
+
+using namespace CrossFire;
+
+namespace
+{
+
+struct Position {
+    f32 x, y, z;
+};
+
+struct Velocity {
+    f32 x, y, z;
+};
+
+struct Health {
+    f32 value;
+};
+
+// What an array-of-structs game object would hold; the loops below only
+// touch position and velocity
+struct GameObject {
+    Position position;
+    Velocity velocity;
+    Health health;
+    u8 other[36];
+    bool moving;
+};
+
+}
+
+auto main(int argc, char **argv) -> int
+{
+    auto quick = bench::quick(argc, argv);
+    usize count = quick ? 10000 : 1000000;
+    usize runs = quick ? 2 : 10;
+
+    Registry registry;
+    std::vector<GameObject> objects(count);
+    for (usize i = 0; i < count; i++) {
+        auto entity = registry.create().unwrap();
+        auto f = static_cast<f32>(i);
+        Position position{ f, f, f };
+        (void)registry.emplace(entity, position).unwrap();
+        (void)registry.emplace(entity, Health{ 100.0f }).unwrap();
+        objects[i].position = position;
+        objects[i].moving = i % 2 == 0;
+
+        // Every other entity moves
+        if (objects[i].moving) {
+            Velocity velocity{ 1.0f, 2.0f, 3.0f };
+            (void)registry.emplace(entity, velocity).unwrap();
+            objects[i].velocity = velocity;
+        }
+    }
+
+    auto ecs_move = bench::time_best(runs, [&] {
+        registry.view<Position, Velocity>().each(
+            [](Entity, Position &p, Velocity &v) {
+                p.x += v.x;
+                p.y += v.y;
+                p.z += v.z;
+            });
+    });
+    auto aos_move = bench::time_best(runs, [&] {
+        for (auto &object : objects) {
+            if (!object.moving)
+                continue;
+            object.position.x += object.velocity.x;
+            object.position.y += object.velocity.y;
+            object.position.z += object.velocity.z;
+        }
+    });
+
+    f64 ecs_sum = 0.0;
+    auto ecs_read = bench::time_best(runs, [&] {
+        ecs_sum = 0.0;
+        registry.view<Position>().each(
+            [&](Entity, Position &p) { ecs_sum += p.x + p.y + p.z; });
+    });
+    f64 aos_sum = 0.0;
+    auto aos_read = bench::time_best(runs, [&] {
+        aos_sum = 0.0;
+        for (auto &object : objects)
+            aos_sum += object.position.x + object.position.y +
+                       object.position.z;
+    });
+
+    // Both sides moved the same entities the same number of times
+    for (usize i = 0; i < count; i++) {
+        auto &p = registry.get<Position>(static_cast<Entity>(i));
+        bench::check(p.x == objects[i].position.x &&
+                         p.z == objects[i].position.z,
+                     "view and array disagree on a position");
+    }
+    bench::check(ecs_sum == aos_sum, "view and array disagree on the sum");
+
+    bench::report("view<Position, Velocity>", ecs_move, count);
+    bench::report("array of structs, moving", aos_move, count);
+    bench::report("view<Position>", ecs_read, count);
+    bench::report("array of structs, positions", aos_read, count);
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
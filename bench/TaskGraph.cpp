@@ -0,0 +1,99 @@
+#include <Utilities/Threading/TaskGraph.hpp>
+#include <atomic>
+#include <vector>
+#include "Bench.hpp"
+
+using namespace CrossFire;
+
+namespace
+{
+
+constexpr usize WIDTH = 16;
+
+// The two nodes of the layer before that a node waits on
+auto first_dependency(usize i) -> usize
+{
+    return i - WIDTH;
+}
+
+auto second_dependency(usize i) -> usize
+{
+    return i - i % WIDTH - WIDTH + (i + 1) % WIDTH;
+}
+
+}
+
+auto main(int argc, char **argv) -> int
+{
+    auto quick = bench::quick(argc, argv);
+    usize layers = quick ? 16 : 256;
+    usize runs = quick ? 2 : 20;
+    ThreadPool pool(4);
+
+    // Layers of nodes, each waiting on two nodes of the layer before. Every
+    // node stamps when it ran and checks its dependencies ran first.
+    auto n = layers * WIDTH;
+    std::atomic<u64> clock{ 0 };
+    std::vector<std::atomic<u64> > stamps(n);
+    std::vector<std::atomic<u32> > ran(n);
+    std::atomic<bool> ordered{ true };
+
+    TaskGraph graph(c_allocator);
+    for (usize i = 0; i < n; i++) {
+        auto added = graph.add([&, i] {
+            if (i >= WIDTH) {
+                auto first = first_dependency(i);
+                auto second = second_dependency(i);
+                auto now = clock.load(std::memory_order_acquire);
+                if (stamps[first].load(std::memory_order_acquire) > now ||
+                    stamps[second].load(std::memory_order_acquire) > now)
+                    ordered.store(false, std::memory_order_relaxed);
+            }
+            ran[i].fetch_add(1, std::memory_order_relaxed);
+            stamps[i].store(clock.fetch_add(1, std::memory_order_acq_rel) + 1,
+                            std::memory_order_release);
+        });
+        bench::check(added.unwrap() == i, "nodes are numbered in order");
+        if (i >= WIDTH) {
+            auto node = static_cast<TaskGraph::Node>(i);
+            (void)graph.depends_on(node, first_dependency(i)).unwrap();
+            (void)graph.depends_on(node, second_dependency(i)).unwrap();
+        }
+    }
+
+    // Clear the stamps, so a dependency that has not run yet looks late
+    auto elapsed = bench::time_best(runs, [&] {
+        for (auto &stamp : stamps)
+            stamp.store(~0ULL, std::memory_order_relaxed);
+        bench::check(graph.run(pool).is_ok(), "an acyclic graph failed");
+    });
+    for (auto &count : ran)
+        bench::check(count.load(std::memory_order_relaxed) == runs,
+                     "a node did not run exactly once per run");
+    bench::check(ordered.load(std::memory_order_relaxed),
+                 "a node ran before one of its dependencies");
+
+    // A cycle is an error, not a hang, and runs nothing
+    TaskGraph cyclic(c_allocator);
+    std::atomic<u32> cyclic_ran{ 0 };
+    auto count = [&] { cyclic_ran.fetch_add(1, std::memory_order_relaxed); };
+    auto a = cyclic.add(count).unwrap();
+    auto b = cyclic.add(count).unwrap();
+    auto c = cyclic.add(count).unwrap();
+    (void)cyclic.add(count).unwrap();
+    (void)cyclic.depends_on(b, a).unwrap();
+    (void)cyclic.depends_on(c, b).unwrap();
+    (void)cyclic.depends_on(a, c).unwrap();
+    auto res = cyclic.run(pool);
+    bench::check(res.is_err() && res.unwrap_err() == TaskGraphError::Cycle,
+                 "a cyclic graph did not report a cycle");
+    List<TaskGraph::Node> path(c_allocator);
+    auto critical = cyclic.critical_path(path);
+    bench::check(critical.is_err() &&
+                     critical.unwrap_err() == TaskGraphError::Cycle,
+                 "critical_path did not report a cycle");
+    bench::check(cyclic_ran.load() == 0, "a cyclic graph ran nodes");
+
+    bench::report("TaskGraph::run", elapsed, n);
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include <Utilities/Threading/TimerWheel.hpp>
+#include <vector>
+#include "Bench.hpp"
+
+using namespace CrossFire;
+
+namespace
+{
+
+constexpr u64 RESOLUTION = 1000;
+constexpr u64 NEVER = ~0ULL;
+
+struct Random {
+    u64 state;
+
+    auto next() -> u64
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+};
+
+/**
+ * @brief Fails every allocation once its budget runs out.
+ */
+struct BudgetAllocator final : Allocator {
+    usize budget = ~0ULL;
+
+    auto allocate(usize size, usize alignment)
+        -> Result<Slice<u8>, AllocationError> override
+    {
+        if (budget == 0)
+            return AllocationError::OutOfMemory;
+        budget--;
+        return c_allocator.allocate(size, alignment);
+    }
+    auto deallocate(Slice<u8> ptr) -> void override
+    {
+        c_allocator.deallocate(ptr);
+    }
+    auto reallocate(Slice<u8> ptr, usize size, usize alignment)
+        -> Result<Slice<u8>, AllocationError> override
+    {
+        if (budget == 0)
+            return AllocationError::ReallocFailed;
+        budget--;
+        return c_allocator.reallocate(ptr, size, alignment);
+    }
+};
+
+/**
+ * @brief A periodic timer as the wheel should treat it: due at its
+ * deadline, then re-armed past the tick it fired on.
+ */
+struct PeriodicReference {
+    u64 deadline;
+    u64 period;
+    u32 expected;
+    u32 fired;
+};
+
+/**
+ * @brief Schedule timers over every level of the wheel, and past it,
+ * cancel some, and check every one fires on the first advance that reaches
+ * its deadline.
+ * @return The time taken in nanoseconds.
+ */
+auto check_schedule(usize count, u32 max_shift) -> u64
+{
+    Random random{ 0x9E3779B97F4A7C15ULL };
+    TimerWheel wheel(c_allocator, RESOLUTION, 0);
+
+    std::vector<u64> deadlines(count);
+    std::vector<u64> fired_on(count, NEVER);
+    std::vector<TimerWheel::TimerId> ids(count);
+    std::vector<u64> targets;
+    usize advance = 0;
+
+    auto start = get_time_nanoseconds();
+    for (usize i = 0; i < count; i++) {
+        // Delays of every magnitude, a few parked past the top level
+        auto shift = random.next() % max_shift + 1;
+        u64 ticks = 1 + random.next() % (1ULL << shift);
+        if (i % 1000 == 1)
+            ticks = (1ULL << 33) + i;
+        deadlines[i] = ticks;
+        ids[i] = wheel
+                     .schedule_at(ticks * RESOLUTION - random.next() % 1000,
+                                  [&, i] { fired_on[i] = advance; })
+                     .unwrap();
+    }
+
+    std::vector<PeriodicReference> periodic;
+    for (u64 period : { 1ULL, 7ULL, 255ULL, 256ULL, 4099ULL, 70000ULL }) {
+        auto index = periodic.size();
+        periodic.push_back(PeriodicReference{ period, period, 0, 0 });
+        (void)wheel
+            .schedule_every(period * RESOLUTION,
+                            [&, index] { periodic[index].fired++; })
+            .unwrap();
+    }
+
+    // Cancel every tenth timer; they must not fire
+    for (usize i = 0; i < count; i += 10) {
+        bench::check(wheel.cancel(ids[i]), "a pending timer did not cancel");
+        bench::check(!wheel.cancel(ids[i]), "a timer cancelled twice");
+    }
+
+    // Advance by uneven steps, then in large jumps to the parked timers
+    u64 now = 0;
+    auto limit = 1ULL << max_shift;
+    while (now <= (1ULL << 33) + count) {
+        now += now < limit ? 1 + random.next() % 4096 : 1ULL << 30;
+        targets.push_back(now);
+        for (auto &timer : periodic) {
+            if (now >= timer.deadline) {
+                timer.expected++;
+                auto behind = now - timer.deadline;
+                timer.deadline += (behind / timer.period + 1) * timer.period;
+            }
+        }
+        (void)wheel.advance(nullptr, now * RESOLUTION).unwrap();
+        advance++;
+    }
+    auto elapsed = get_time_nanoseconds() - start;
+
+    for (usize i = 0; i < count; i++) {
+        if (i % 10 == 0) {
+            bench::check(fired_on[i] == NEVER, "a cancelled timer fired");
+            continue;
+        }
+
+        auto k = fired_on[i];
+        bench::check(k != NEVER, "a timer never fired");
+        bench::check(targets[k] >= deadlines[i], "a timer fired early");
+        bench::check(k == 0 || targets[k - 1] < deadlines[i],
+                     "a timer fired late");
+    }
+    for (auto &timer : periodic)
+        bench::check(timer.fired == timer.expected,
+                     "a periodic timer fired the wrong number of times");
+    bench::check(wheel.size() == periodic.size(),
+                 "fired timers are still pending");
+    return elapsed;
+}
+
+/**
+ * @brief Fail the due list part way through a tick and check the rest of
+ * the tick fires on the next advance, not a turn of the wheel later.
+ */
+auto check_retry() -> void
+{
+    for (usize budget = 0; budget < 4; budget++) {
+        BudgetAllocator allocator;
+        TimerWheel wheel(allocator, RESOLUTION, 0);
+        usize fired = 0, later = 0;
+        for (usize i = 0; i < 200; i++)
+            (void)wheel.schedule_at(5 * RESOLUTION, [&] { fired++; })
+                .unwrap();
+        (void)wheel.schedule_at(6 * RESOLUTION, [&] { later++; }).unwrap();
+
+        allocator.budget = budget;
+        auto res = wheel.advance(nullptr, 5 * RESOLUTION);
+        allocator.budget = ~0ULL;
+        bench::check(res.is_ok() == (fired == 200),
+                     "a failed advance reported success");
+
+        (void)wheel.advance(nullptr, 5 * RESOLUTION).unwrap();
+        bench::check(fired == 200 && later == 0,
+                     "timers left by a failed advance did not fire next");
+        (void)wheel.advance(nullptr, 6 * RESOLUTION).unwrap();
+        bench::check(later == 1 && wheel.size() == 0,
+                     "a later timer did not fire after a failed advance");
+    }
+}
+
+}
+
+auto main(int argc, char **argv) -> int
+{
+    auto quick = bench::quick(argc, argv);
+    usize count = quick ? 20000 : 200000;
+    u32 max_shift = quick ? 20 : 26;
+
+    check_retry();
+    auto elapsed = check_schedule(count, max_shift);
+
+    bench::report("schedule, cancel and fire", elapsed, count);
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -8,8 +8,35 @@
 #include "Utilities/Logger.hpp"
 #include "Utilities/Time.hpp"
 #include "Utilities/Threading/SpinLock.hpp"
+#include "Utilities/Threading/EventCount.hpp"
+#include "Utilities/Threading/ObjectPool.hpp"
+#include "Utilities/Threading/Task.hpp"
+#include "Utilities/Threading/WorkStealingDeque.hpp"
+#include "Utilities/Threading/Topology.hpp"
+#include "Utilities/Threading/ThreadContext.hpp"
 #include "Utilities/Threading/Thread.hpp"
+#include "Utilities/Threading/PoolStats.hpp"
+#include "Utilities/Threading/TaskGraph.hpp"
+#include "Utilities/Threading/Parallel.hpp"
+#include "Utilities/Threading/Fiber.hpp"
+#include "Utilities/Threading/RWLock.hpp"
+#include "Utilities/Threading/SeqLock.hpp"
+#include "Utilities/Threading/TimerWheel.hpp"
+#include "Utilities/Threading/Pipeline.hpp"
+#include "Utilities/Threading/MPMCQueue.hpp"
+#include "Utilities/Threading/SPSCRing.hpp"
+#include "Utilities/Threading/Epoch.hpp"
+#include "Utilities/Threading/ShardedCounter.hpp"
 #include "Utilities/Allocator.hpp"
 #include "Utilities/List.hpp"
 #include "Utilities/LinkedList.hpp"
 #include "Utilities/TailQueue.hpp"
+#include "Utilities/SparseSet.hpp"
+#include "Utilities/Registry.hpp"
+#include "Utilities/PackedArray.hpp"
+#include "Utilities/Grid3D.hpp"
+#include "Utilities/SegmentedList.hpp"
+#include "Utilities/ByteOps.hpp"
+#include "Utilities/Sort.hpp"
+#include "Utilities/PriorityQueue.hpp"
+#include "Utilities/SpatialHashGrid.hpp"
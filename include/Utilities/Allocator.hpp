@@ -1,8 +1,10 @@
 #pragma once
+#include <atomic>
 #include <map>
 #include <string>
 #include "Types.hpp"
 #include "Logger.hpp"
+#include "Threading/ShardedCounter.hpp"
 
 namespace CrossFire
 {
@@ -155,6 +157,14 @@ public:
     explicit LinearAllocator(usize size, Allocator &allocator = c_allocator);
     ~LinearAllocator() override;
 
+    /**
+     * @brief Free every allocation at once, keeping the memory.
+     */
+    inline auto reset() -> void
+    {
+        offset = 0;
+    }
+
     [[nodiscard]] auto allocate(usize size,
                                 usize alignment = alignof(std::max_align_t))
         -> Result<Slice<u8>, AllocationError> override;
@@ -193,20 +203,26 @@ public:
  * It is useful for detecting memory leaks.
  * It is not recommended to use this allocator in production.
  * This allocator wraps another allocator.
+ * The totals are sharded, so it is safe and cheap to use from many
+ * threads as long as the backing allocator is. Current and peak usage are
+ * exact, so they share one atomic counter.
  */
 class DebugAllocator final : public Allocator {
     Allocator &backing_allocator;
-    usize alloc_count = 0;
-    usize dealloc_count = 0;
-    usize alloc_size = 0;
-    usize dealloc_size = 0;
+    ShardedCounter alloc_count;
+    ShardedCounter dealloc_count;
+    ShardedCounter alloc_size;
+    ShardedCounter dealloc_size;
+    std::atomic<usize> current_usage;
+    std::atomic<usize> peak_usage;
 
-    usize current_usage = 0;
-    usize peak_usage = 0;
+    auto grow_usage(usize size) -> void;
 
 public:
     explicit DebugAllocator(Allocator &allocator = c_allocator)
         : backing_allocator(allocator)
+        , current_usage(0)
+        , peak_usage(0)
     {
     }
     ~DebugAllocator() override
@@ -214,17 +230,21 @@ public:
         if (detect_leaks()) {
             auto &err = Logger::get_stderr();
             err.err("Memory leak detected!");
-            err.err(("Allocated " + std::to_string(alloc_count) + " times.")
+            err.err(("Allocated " + std::to_string(get_alloc_count()) +
+                     " times.")
+                        .c_str());
+            err.err(("Deallocated " + std::to_string(get_dealloc_count()) +
+                     " times.")
+                        .c_str());
+            err.err(("Allocated " + std::to_string(get_alloc_size()) +
+                     " bytes.")
                         .c_str());
-            err.err(("Deallocated " + std::to_string(dealloc_count) + " times.")
+            err.err(("Deallocated " + std::to_string(get_dealloc_size()) +
+                     " bytes.")
                         .c_str());
-            err.err(
-                ("Allocated " + std::to_string(alloc_size) + " bytes.").c_str());
-            err.err(("Deallocated " + std::to_string(dealloc_size) + " bytes.")
+            err.err(("Current usage: " + std::to_string(get_current_usage()) +
+                     " bytes.")
                         .c_str());
-            err.err(
-                ("Current usage: " + std::to_string(current_usage) + " bytes.")
-                    .c_str());
         }
     };
 
@@ -238,33 +258,34 @@ public:
 
     inline auto get_alloc_count() const -> usize
     {
-        return alloc_count;
+        return alloc_count.load();
     }
     inline auto get_dealloc_count() const -> usize
     {
-        return dealloc_count;
+        return dealloc_count.load();
     }
     inline auto get_alloc_size() const -> usize
     {
-        return alloc_size;
+        return alloc_size.load();
     }
     inline auto get_dealloc_size() const -> usize
     {
-        return dealloc_size;
+        return dealloc_size.load();
     }
 
     auto detect_leaks() -> bool
     {
-        return alloc_count != dealloc_count || alloc_size != dealloc_size;
+        return get_alloc_count() != get_dealloc_count() ||
+               get_alloc_size() != get_dealloc_size();
     }
 
     auto get_current_usage() const -> usize
     {
-        return current_usage;
+        return current_usage.load(std::memory_order_relaxed);
     }
     auto get_peak_usage() const -> usize
     {
-        return peak_usage;
+        return peak_usage.load(std::memory_order_relaxed);
     }
 };
 
@@ -0,0 +1,159 @@
+#pragma once
+#include "Types.hpp"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace CrossFire
+{
+
+/**
+ * @brief The SimdLevel enum represents the vector instruction set that the
+ * byte kernels dispatch to on this machine.
+ */
+enum class SimdLevel {
+    Scalar = 0,
+    SSE2 = 1,
+    AVX2 = 2,
+};
+
+/**
+ * @brief Get the vector instruction set selected for the byte kernels.
+ * The selection is made once, on first use, from the running CPU.
+ * @return The SIMD level.
+ */
+auto get_simd_level() -> SimdLevel;
+
+namespace detail
+{
+
+auto count_byte_wide(const u8 *ptr, usize len, u8 value) -> usize;
+auto reverse_bytes_wide(u8 *ptr, usize len) -> void;
+auto byte_swap_wide(u8 *ptr, usize count, usize size) -> void;
+
+/**
+ * @brief Get the index of the lowest set bit.
+ * @param bits The bits, not all zero.
+ * @return The index.
+ */
+inline auto lowest_bit(u64 bits) -> u32
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return static_cast<u32>(index);
+#else
+    return static_cast<u32>(__builtin_ctzll(bits));
+#endif
+}
+
+/**
+ * @brief Get the index of the highest set bit.
+ * @param bits The bits, not all zero.
+ * @return The index.
+ */
+inline auto highest_bit(u64 bits) -> u32
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, bits);
+    return static_cast<u32>(index);
+#else
+    return static_cast<u32>(63 - __builtin_clzll(bits));
+#endif
+}
+
+}
+
+/**
+ * @brief Set every byte of a slice to a value.
+ * This forwards to memset, which the C library already vectorizes.
+ * @param bytes The bytes to fill.
+ * @param value The value.
+ */
+inline auto fill_bytes(Slice<u8> bytes, u8 value) -> void
+{
+    if (bytes.len > 0)
+        memset(bytes.ptr, value, bytes.len);
+}
+
+/**
+ * @brief Find the first occurrence of a byte.
+ * This forwards to memchr, which the C library already vectorizes.
+ * @param bytes The bytes to search.
+ * @param value The value to find.
+ * @return The index of the first match -- or None.
+ */
+inline auto find_byte(const Slice<u8> &bytes, u8 value) -> Option<usize>
+{
+    if (bytes.len == 0)
+        return std::nullopt;
+
+    auto found = static_cast<const u8 *>(memchr(bytes.ptr, value, bytes.len));
+    if (found == nullptr)
+        return std::nullopt;
+
+    return static_cast<usize>(found - bytes.ptr);
+}
+
+/**
+ * @brief Check if two slices hold the same bytes.
+ * This forwards to memcmp, which the C library already vectorizes.
+ * @param a The first slice.
+ * @param b The second slice.
+ * @return True if the lengths and contents match, false otherwise.
+ */
+inline auto equal_bytes(const Slice<u8> &a, const Slice<u8> &b) -> bool
+{
+    return a.len == b.len && (a.len == 0 || memcmp(a.ptr, b.ptr, a.len) == 0);
+}
+
+/**
+ * @brief Count the occurrences of a byte.
+ * @param bytes The bytes to search.
+ * @param value The value to count.
+ * @return The number of matches.
+ */
+inline auto count_byte(const Slice<u8> &bytes, u8 value) -> usize
+{
+    return detail::count_byte_wide(bytes.ptr, bytes.len, value);
+}
+
+/**
+ * @brief Reverse the order of the bytes in a slice, in place.
+ * Short slices, such as a single scalar being converted between
+ * endiannesses, are reversed inline without dispatching.
+ * @param bytes The bytes to reverse.
+ */
+inline auto reverse_bytes(Slice<u8> bytes) -> void
+{
+    if (bytes.len >= 32) {
+        detail::reverse_bytes_wide(bytes.ptr, bytes.len);
+        return;
+    }
+
+    u8 *lo = bytes.ptr;
+    u8 *hi = bytes.ptr + bytes.len;
+    while (hi - lo > 1) {
+        u8 tmp = *lo;
+        *lo++ = *--hi;
+        *hi = tmp;
+    }
+}
+
+/**
+ * @brief Swap the byte order of every element of a slice, in place.
+ * This converts an array between little and big endian.
+ * @tparam T The type of the elements, 2, 4 or 8 bytes wide.
+ * @param values The values to swap.
+ */
+template <typename T> inline auto byte_swap(Slice<T> values) -> void
+{
+    static_assert(sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8,
+                  "byte_swap needs 2, 4 or 8 byte elements");
+    detail::byte_swap_wide(reinterpret_cast<u8 *>(values.ptr), values.len,
+                           sizeof(T));
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,297 @@
+#pragma once
+#include "Types.hpp"
+#include "Allocator.hpp"
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+namespace CrossFire
+{
+
+namespace detail
+{
+
+// Bits of a 3D Morton code that belong to each axis
+constexpr u64 MORTON_X = 0x1249249249249249ULL;
+constexpr u64 MORTON_Y = MORTON_X << 1;
+constexpr u64 MORTON_Z = MORTON_X << 2;
+
+/**
+ * @brief Spread the low 21 bits of a value so there are two zero bits
+ * between each of them.
+ * @param v The value.
+ * @return The spread value.
+ */
+inline auto morton_split(u64 v) -> u64
+{
+#if defined(__BMI2__)
+    return _pdep_u64(v, MORTON_X);
+#else
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8) & 0x100f00f00f00f00fULL;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2) & MORTON_X;
+    return v;
+#endif
+}
+
+/**
+ * @brief Gather every third bit of a value, the inverse of morton_split.
+ * @param v The value.
+ * @return The compacted value.
+ */
+inline auto morton_compact(u64 v) -> u32
+{
+#if defined(__BMI2__)
+    return static_cast<u32>(_pext_u64(v, MORTON_X));
+#else
+    v &= MORTON_X;
+    v = (v ^ (v >> 2)) & 0x10c30c30c30c30c3ULL;
+    v = (v ^ (v >> 4)) & 0x100f00f00f00f00fULL;
+    v = (v ^ (v >> 8)) & 0x1f0000ff0000ffULL;
+    v = (v ^ (v >> 16)) & 0x1f00000000ffffULL;
+    v = (v ^ (v >> 32)) & 0x1fffff;
+    return static_cast<u32>(v);
+#endif
+}
+
+}
+
+/**
+ * @brief Encode a 3D coordinate as a Morton (Z-order) code.
+ * @param x The x coordinate, below 2^21.
+ * @param y The y coordinate, below 2^21.
+ * @param z The z coordinate, below 2^21.
+ * @return The Morton code.
+ */
+inline auto morton_encode(u32 x, u32 y, u32 z) -> u64
+{
+    return detail::morton_split(x) | (detail::morton_split(y) << 1) |
+           (detail::morton_split(z) << 2);
+}
+
+/**
+ * @brief Decode a Morton (Z-order) code to a 3D coordinate.
+ * @param code The Morton code.
+ * @param x The x coordinate.
+ * @param y The y coordinate.
+ * @param z The z coordinate.
+ */
+inline auto morton_decode(u64 code, u32 &x, u32 &y, u32 &z) -> void
+{
+    x = detail::morton_compact(code);
+    y = detail::morton_compact(code >> 1);
+    z = detail::morton_compact(code >> 2);
+}
+
+/**
+ * @brief A cubic 3D grid whose cells are stored in Morton (Z-order), so
+ * cells that are close in space are close in memory on every axis.
+ * The side length must be a power of two.
+ * Cells are not constructed or destroyed, so T should be trivial.
+ * @tparam T The type of the cells.
+ */
+template <typename T> class Grid3D {
+    Allocator &allocator;
+    Slice<T> cells;
+    u32 side;
+
+    /**
+     * @brief Step one axis of a Morton code by +1 or -1 without decoding it.
+     * @param code The Morton code.
+     * @param axis The mask of the axis.
+     * @param dir The direction, +1 or -1.
+     * @return The stepped code.
+     */
+    static inline auto step(u64 code, u64 axis, i32 dir) -> u64
+    {
+        u64 field = dir > 0 ? ((code | ~axis) + 1) & axis :
+                              ((code & axis) - 1) & axis;
+        return field | (code & ~axis);
+    }
+
+public:
+    /**
+     * @brief Creates a new grid.
+     * @param allocator The allocator to use.
+     * @param side The side length, a power of two.
+     */
+    Grid3D(Allocator &allocator, u32 side)
+        : allocator(allocator)
+        , side(side)
+    {
+        cf_assert(side > 0 && (side & (side - 1)) == 0,
+                  "Grid3D side must be a power of two");
+        cf_assert(side <= (1u << 21), "Grid3D side too large");
+
+        cells = allocator.alloc<T>(static_cast<usize>(side) * side * side)
+                    .unwrap();
+    }
+
+    ~Grid3D()
+    {
+        allocator.dealloc(cells);
+    }
+
+    Grid3D(const Grid3D &other) = delete;
+    Grid3D &operator=(const Grid3D &other) = delete;
+
+    /**
+     * @brief Get the side length.
+     * @return The side length.
+     */
+    inline auto get_side() const -> u32
+    {
+        return side;
+    }
+
+    /**
+     * @brief Get the cells in storage (Morton) order.
+     * @return The cells.
+     */
+    inline auto raw() -> Slice<T>
+    {
+        return cells;
+    }
+
+    /**
+     * @brief Check if a coordinate is inside the grid.
+     * @param x The x coordinate.
+     * @param y The y coordinate.
+     * @param z The z coordinate.
+     * @return True if the coordinate is inside, false otherwise.
+     */
+    inline auto contains(i32 x, i32 y, i32 z) const -> bool
+    {
+        return static_cast<u32>(x) < side && static_cast<u32>(y) < side &&
+               static_cast<u32>(z) < side;
+    }
+
+    /**
+     * @brief Get the storage index of a coordinate.
+     * @param x The x coordinate.
+     * @param y The y coordinate.
+     * @param z The z coordinate.
+     * @return The index into raw().
+     */
+    inline auto index_of(u32 x, u32 y, u32 z) const -> usize
+    {
+        cf_assert(x < side && y < side && z < side,
+                  "Grid3D coordinate out of range");
+        return static_cast<usize>(morton_encode(x, y, z));
+    }
+
+    /**
+     * @brief Get a cell.
+     * @param x The x coordinate.
+     * @param y The y coordinate.
+     * @param z The z coordinate.
+     * @return The cell.
+     */
+    inline auto get(u32 x, u32 y, u32 z) -> T &
+    {
+        return cells.ptr[index_of(x, y, z)];
+    }
+
+    /**
+     * @brief Set every cell to a value.
+     * @param value The value.
+     */
+    auto fill(const T &value) -> void
+    {
+        for (usize i = 0; i < cells.len; i++)
+            cells.ptr[i] = value;
+    }
+
+    /**
+     * @brief Call a function for every cell in storage order.
+     * This is the cache-friendly way to visit the whole grid.
+     * @tparam F The type of the function, taking (u32 x, u32 y, u32 z, T &).
+     * @param func The function.
+     */
+    template <typename F> auto for_each(F &&func) -> void
+    {
+        u32 x = 0, y = 0, z = 0;
+        for (usize i = 0; i < cells.len; i++) {
+            if ((i & 7) == 0)
+                morton_decode(i, x, y, z);
+
+            // Within an aligned block of 8 the low bits are x, y, z
+            func(x | (i & 1), y | ((i >> 1) & 1), z | ((i >> 2) & 1),
+                 cells.ptr[i]);
+        }
+    }
+
+    /**
+     * @brief Call a function for each of the (up to) six face neighbors of
+     * a cell that lie inside the grid.
+     * Neighbor indices are derived from the cell's Morton code directly.
+     * @tparam F The type of the function, taking (u32 x, u32 y, u32 z, T &).
+     * @param x The x coordinate.
+     * @param y The y coordinate.
+     * @param z The z coordinate.
+     * @param func The function.
+     */
+    template <typename F>
+    auto for_each_neighbor(u32 x, u32 y, u32 z, F &&func) -> void
+    {
+        auto code = static_cast<u64>(index_of(x, y, z));
+        auto last = side - 1;
+
+        if (x > 0)
+            func(x - 1, y, z, cells.ptr[step(code, detail::MORTON_X, -1)]);
+        if (x < last)
+            func(x + 1, y, z, cells.ptr[step(code, detail::MORTON_X, 1)]);
+        if (y > 0)
+            func(x, y - 1, z, cells.ptr[step(code, detail::MORTON_Y, -1)]);
+        if (y < last)
+            func(x, y + 1, z, cells.ptr[step(code, detail::MORTON_Y, 1)]);
+        if (z > 0)
+            func(x, y, z - 1, cells.ptr[step(code, detail::MORTON_Z, -1)]);
+        if (z < last)
+            func(x, y, z + 1, cells.ptr[step(code, detail::MORTON_Z, 1)]);
+    }
+
+    /**
+     * @brief Call a function for each cell of the 3x3x3 block around a
+     * cell (excluding the cell itself) that lies inside the grid.
+     * @tparam F The type of the function, taking (u32 x, u32 y, u32 z, T &).
+     * @param x The x coordinate.
+     * @param y The y coordinate.
+     * @param z The z coordinate.
+     * @param func The function.
+     */
+    template <typename F>
+    auto for_each_adjacent(u32 x, u32 y, u32 z, F &&func) -> void
+    {
+        auto center = static_cast<u64>(index_of(x, y, z));
+        auto inside = [this](u32 v, i32 d) {
+            return static_cast<u32>(static_cast<i32>(v) + d) < side;
+        };
+
+        for (i32 dz = -1; dz <= 1; dz++) {
+            if (!inside(z, dz))
+                continue;
+            auto cz = dz == 0 ? center : step(center, detail::MORTON_Z, dz);
+
+            for (i32 dy = -1; dy <= 1; dy++) {
+                if (!inside(y, dy))
+                    continue;
+                auto cy = dy == 0 ? cz : step(cz, detail::MORTON_Y, dy);
+
+                for (i32 dx = -1; dx <= 1; dx++) {
+                    if (!inside(x, dx) || (dx == 0 && dy == 0 && dz == 0))
+                        continue;
+                    auto cx = dx == 0 ? cy : step(cy, detail::MORTON_X, dx);
+
+                    func(x + dx, y + dy, z + dz, cells.ptr[cx]);
+                }
+            }
+        }
+    }
+};
+
+}
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <utility>
 
 #include "Types.hpp"
+#include "ByteOps.hpp"
 
 namespace CrossFire
 {
@@ -63,12 +64,7 @@ struct Reader {
     {
         Slice<u8> buffer = Slice<u8>((u8 *)&value, sizeof(T));
         usize read = raw_read(buffer);
-
-        for (usize i = 0; i < sizeof(T) / 2; i++) {
-            u8 tmp = buffer[i];
-            buffer[i] = buffer[buffer.len - i - 1];
-            buffer[buffer.len - i - 1] = tmp;
-        }
+        reverse_bytes(buffer);
 
         return read;
     }
@@ -126,12 +122,7 @@ struct Writer {
     {
         T temp = value;
         Slice<u8> buffer = Slice<u8>((u8 *)&temp, sizeof(T));
-
-        for (usize i = 0; i < sizeof(T) / 2; i++) {
-            u8 tmp = buffer[i];
-            buffer[i] = buffer[buffer.len - i - 1];
-            buffer[buffer.len - i - 1] = tmp;
-        }
+        reverse_bytes(buffer);
 
         return raw_write(buffer);
     }
@@ -36,7 +36,8 @@ public:
             auto new_capacity = capacity * 2;
 
             // Reallocate the list
-            auto new_data = allocator.realloc(data, new_capacity);
+            auto new_data =
+                allocator.realloc(Slice<T>(data.ptr, capacity), new_capacity);
             if (new_data.is_err())
                 return new_data.unwrap_err();
 
@@ -81,11 +82,15 @@ public:
     {
         if (new_capacity > capacity) {
             // Reallocate the list
-            auto new_data = allocator.reallocate(data, new_capacity);
+            auto new_data =
+                allocator.realloc(Slice<T>(data.ptr, capacity), new_capacity);
             if (new_data.is_err())
                 return new_data.unwrap_err();
 
+            auto curr_len = data.len;
             data = new_data.unwrap();
+            data.len = curr_len;
+
             capacity = new_capacity;
         }
 
@@ -100,7 +105,8 @@ public:
     {
         if (data.len < capacity) {
             // Reallocate the list
-            auto new_data = allocator.reallocate(data, data.len);
+            auto new_data =
+                allocator.realloc(Slice<T>(data.ptr, capacity), data.len);
             if (new_data.is_ok()) {
                 data = new_data.unwrap();
                 capacity = data.len;
@@ -112,6 +118,24 @@ public:
         return Ok();
     }
 
+    /**
+     * @brief Exchanges the contents with another list from the same
+     * allocator, without copying.
+     * @param other The other list.
+     */
+    inline auto swap(List<T> &other) -> void
+    {
+        cf_assert(&allocator == &other.allocator,
+                  "Swapped lists must share an allocator");
+
+        auto other_data = other.data;
+        auto other_capacity = other.capacity;
+        other.data = data;
+        other.capacity = capacity;
+        data = other_data;
+        capacity = other_capacity;
+    }
+
     /**
      * @brief Gets the element at the given index.
      * @param index The index of the element.
@@ -71,11 +71,12 @@ class Logger final {
                 tm *ltm = localtime(&now);
 
                 // Write time to buffer
-                char time_buffer[32];
+                char time_buffer[80];
                 // Format: MM-DD-YYYY|HH:MM:SS
-                (void)sprintf(time_buffer, timestamp_format, ltm->tm_mon + 1,
-                              ltm->tm_mday, ltm->tm_year + 1900, ltm->tm_hour,
-                              ltm->tm_min, ltm->tm_sec);
+                (void)snprintf(time_buffer, sizeof(time_buffer),
+                               timestamp_format, ltm->tm_mon + 1, ltm->tm_mday,
+                               ltm->tm_year + 1900, ltm->tm_hour, ltm->tm_min,
+                               ltm->tm_sec);
 
                 (void)writer.raw_write(Slice<u8>::from_string(time_buffer));
 
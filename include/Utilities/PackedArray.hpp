@@ -0,0 +1,603 @@
+#pragma once
+#include <type_traits>
+#include <utility>
+#include "Types.hpp"
+#include "Allocator.hpp"
+#include "List.hpp"
+
+namespace CrossFire
+{
+
+namespace detail
+{
+
+/**
+ * @brief Call a function with the bit width as a compile time constant.
+ * @tparam F The type of the function, taking std::integral_constant<u32, N>.
+ * @param bits The bit width, from 1 to 32.
+ * @param func The function.
+ */
+template <typename F, u32... Bs>
+inline auto dispatch_bits(u32 bits, F &&func,
+                          std::integer_sequence<u32, Bs...>) -> void
+{
+    (void)((bits == Bs + 1 ?
+                (func(std::integral_constant<u32, Bs + 1>{}), true) :
+                false) ||
+           ...);
+}
+
+template <typename F> inline auto dispatch_bits(u32 bits, F &&func) -> void
+{
+    dispatch_bits(bits, std::forward<F>(func),
+                  std::make_integer_sequence<u32, 32>{});
+}
+
+}
+
+/**
+ * @brief A fixed-length array of unsigned integers stored at a variable
+ * number of bits per entry.
+ * Entries are packed back to back into 64-bit words and may straddle a word
+ * boundary, so every group of 64 entries occupies exactly `bits` words.
+ * A width of 0 bits stores no words at all and every entry reads as 0.
+ */
+class PackedArray {
+    Allocator &allocator;
+    Slice<u64> words;
+    usize count;
+    u32 bits;
+
+    static inline auto word_count(usize count, u32 bits) -> usize
+    {
+        return (count * bits + 63) / 64;
+    }
+
+    static inline auto mask(u32 bits) -> u64
+    {
+        return bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+    }
+
+    /**
+     * @brief Stream every entry to a sink, reading each word once.
+     * @tparam Bits The bit width.
+     * @tparam F The type of the sink, taking (usize index, u32 value).
+     * @param sink The sink.
+     */
+    template <u32 Bits, typename F> auto decode(F &&sink) const -> void
+    {
+        constexpr u64 m = (1ULL << Bits) - 1;
+        const u64 *src = words.ptr;
+        u64 buffer = 0;
+        u32 avail = 0;
+
+        for (usize i = 0; i < count; i++) {
+            u64 value;
+            if (avail >= Bits) {
+                value = buffer & m;
+                buffer >>= Bits;
+                avail -= Bits;
+            } else {
+                u64 next = *src++;
+                value = (buffer | (next << avail)) & m;
+                buffer = next >> (Bits - avail);
+                avail += 64 - Bits;
+            }
+            sink(i, static_cast<u32>(value));
+        }
+    }
+
+    /**
+     * @brief Stream every entry from a source, writing each word once.
+     * @tparam Bits The bit width.
+     * @tparam F The type of the source, taking (usize index) -> u32.
+     * @param source The source.
+     */
+    template <u32 Bits, typename F> auto encode(F &&source) -> void
+    {
+        constexpr u64 m = (1ULL << Bits) - 1;
+        u64 *dst = words.ptr;
+        u64 buffer = 0;
+        u32 used = 0;
+
+        for (usize i = 0; i < count; i++) {
+            u64 value = static_cast<u64>(source(i)) & m;
+            buffer |= value << used;
+            used += Bits;
+            if (used >= 64) {
+                *dst++ = buffer;
+                used -= 64;
+                buffer = used > 0 ? value >> (Bits - used) : 0;
+            }
+        }
+
+        if (used > 0)
+            *dst = buffer;
+    }
+
+public:
+    static constexpr u32 MAX_BITS = 32;
+
+    /**
+     * @brief Creates a new packed array with every entry set to 0.
+     * @param allocator The allocator to use.
+     * @param count The number of entries.
+     * @param bits The number of bits per entry.
+     */
+    PackedArray(Allocator &allocator, usize count, u32 bits)
+        : allocator(allocator)
+        , count(count)
+        , bits(bits)
+    {
+        cf_assert(bits <= MAX_BITS, "PackedArray bit width out of range");
+        if (word_count(count, bits) > 0) {
+            words = allocator.alloc<u64>(word_count(count, bits)).unwrap();
+            memset(words.ptr, 0, words.len * sizeof(u64));
+        }
+    }
+
+    ~PackedArray()
+    {
+        if (words.ptr != nullptr)
+            allocator.dealloc(words);
+    }
+
+    PackedArray(const PackedArray &other) = delete;
+    PackedArray &operator=(const PackedArray &other) = delete;
+
+    /**
+     * @brief Get the number of entries.
+     * @return The number of entries.
+     */
+    inline auto size() const -> usize
+    {
+        return count;
+    }
+
+    /**
+     * @brief Get the number of bits per entry.
+     * @return The bit width.
+     */
+    inline auto get_bits() const -> u32
+    {
+        return bits;
+    }
+
+    /**
+     * @brief Get the backing words, e.g. for serialization.
+     * @return The packed words.
+     */
+    inline auto raw() -> Slice<u64>
+    {
+        return words;
+    }
+
+    /**
+     * @brief Get an entry.
+     * @param index The index of the entry.
+     * @return The value of the entry.
+     */
+    inline auto get(usize index) const -> u32
+    {
+        cf_assert(index < count, "PackedArray index out of range");
+        if (bits == 0)
+            return 0;
+
+        auto bit = index * bits;
+        auto word = bit / 64;
+        auto offset = static_cast<u32>(bit % 64);
+
+        u64 value = words.ptr[word] >> offset;
+        if (offset + bits > 64)
+            value |= words.ptr[word + 1] << (64 - offset);
+
+        return static_cast<u32>(value & mask(bits));
+    }
+
+    /**
+     * @brief Set an entry.
+     * @param index The index of the entry.
+     * @param value The value, which must fit in the bit width.
+     */
+    inline auto set(usize index, u32 value) -> void
+    {
+        cf_assert(index < count, "PackedArray index out of range");
+        cf_assert((value & ~mask(bits)) == 0, "PackedArray value too wide");
+        if (bits == 0)
+            return;
+
+        auto bit = index * bits;
+        auto word = bit / 64;
+        auto offset = static_cast<u32>(bit % 64);
+        auto m = mask(bits);
+
+        words.ptr[word] = (words.ptr[word] & ~(m << offset)) |
+                          (static_cast<u64>(value) << offset);
+
+        if (offset + bits > 64) {
+            auto spill = 64 - offset;
+            words.ptr[word + 1] = (words.ptr[word + 1] & ~(m >> spill)) |
+                                  (static_cast<u64>(value) >> spill);
+        }
+    }
+
+    /**
+     * @brief Set every entry to the same value.
+     * One 64-entry period of the pattern is built and then copied, so the
+     * cost is a plain word fill.
+     * @param value The value, which must fit in the bit width.
+     */
+    auto fill(u32 value) -> void
+    {
+        cf_assert((value & ~mask(bits)) == 0, "PackedArray value too wide");
+        if (bits == 0)
+            return;
+
+        // 64 entries of `bits` bits repeat every `bits` words
+        u64 pattern[MAX_BITS] = {};
+        for (usize i = 0; i < 64; i++) {
+            auto bit = i * bits;
+            pattern[bit / 64] |= static_cast<u64>(value) << (bit % 64);
+            if (bit % 64 + bits > 64)
+                pattern[bit / 64 + 1] |=
+                    static_cast<u64>(value) >> (64 - bit % 64);
+        }
+
+        for (usize i = 0, j = 0; i < words.len; i++) {
+            words.ptr[i] = pattern[j];
+            if (++j == bits)
+                j = 0;
+        }
+    }
+
+    /**
+     * @brief Unpack every entry into a flat array.
+     * @tparam U The type of the output elements.
+     * @param out The output, with at least size() elements.
+     */
+    template <typename U> auto unpack(Slice<U> out) const -> void
+    {
+        cf_assert(out.len >= count, "Unpack output too small");
+        U *dst = out.ptr;
+
+        if (bits == 0) {
+            for (usize i = 0; i < count; i++)
+                dst[i] = U(0);
+            return;
+        }
+
+        detail::dispatch_bits(bits, [&](auto width) {
+            decode<decltype(width)::value>(
+                [dst](usize i, u32 value) { dst[i] = static_cast<U>(value); });
+        });
+    }
+
+    /**
+     * @brief Unpack every entry through a lookup table into a flat array.
+     * @tparam U The type of the output elements.
+     * @param out The output, with at least size() elements.
+     * @param table The table, indexed by entry value.
+     */
+    template <typename U>
+    auto unpack_mapped(Slice<U> out, const U *table) const -> void
+    {
+        cf_assert(out.len >= count, "Unpack output too small");
+        U *dst = out.ptr;
+
+        if (bits == 0) {
+            for (usize i = 0; i < count; i++)
+                dst[i] = table[0];
+            return;
+        }
+
+        detail::dispatch_bits(bits, [&](auto width) {
+            decode<decltype(width)::value>(
+                [dst, table](usize i, u32 value) { dst[i] = table[value]; });
+        });
+    }
+
+    /**
+     * @brief Pack every entry from a flat array.
+     * @tparam U The type of the input elements.
+     * @param in The input, with at least size() elements that each fit in
+     * the bit width.
+     */
+    template <typename U> auto pack(Slice<U> in) -> void
+    {
+        cf_assert(in.len >= count, "Pack input too small");
+        if (bits == 0)
+            return;
+
+        const U *src = in.ptr;
+        detail::dispatch_bits(bits, [&](auto width) {
+            encode<decltype(width)::value>(
+                [src](usize i) { return static_cast<u32>(src[i]); });
+        });
+    }
+
+    /**
+     * @brief Change the number of bits per entry, keeping every value.
+     * @param new_bits The new bit width, wide enough for every value.
+     * @return Nothing -- or an error if allocation failed.
+     */
+    auto resize(u32 new_bits) -> ResultVoid<AllocationError>
+    {
+        cf_assert(new_bits <= MAX_BITS, "PackedArray bit width out of range");
+        if (new_bits == bits)
+            return Ok();
+
+        Slice<u64> new_words;
+        if (word_count(count, new_bits) > 0) {
+            auto res = allocator.alloc<u64>(word_count(count, new_bits));
+            if (res.is_err())
+                return res.unwrap_err();
+            new_words = res.unwrap();
+            memset(new_words.ptr, 0, new_words.len * sizeof(u64));
+        }
+
+        if (bits > 0 && new_bits > 0) {
+            // Stream the old entries straight into the new layout
+            u64 *dst = new_words.ptr;
+            u64 buffer = 0;
+            u32 used = 0;
+            auto write = [&](usize, u32 value) {
+                buffer |= static_cast<u64>(value) << used;
+                used += new_bits;
+                if (used >= 64) {
+                    *dst++ = buffer;
+                    used -= 64;
+                    buffer = used > 0 ? static_cast<u64>(value) >>
+                                            (new_bits - used) :
+                                        0;
+                }
+            };
+            detail::dispatch_bits(bits, [&](auto width) {
+                decode<decltype(width)::value>(write);
+            });
+            if (used > 0)
+                *dst = buffer;
+        }
+
+        if (words.ptr != nullptr)
+            allocator.dealloc(words);
+
+        words = new_words;
+        bits = new_bits;
+        return Ok();
+    }
+
+    /**
+     * @brief Change the number of bits per entry, setting every entry to 0.
+     * Cheaper than resize() when every entry is about to be overwritten.
+     * @param new_bits The new bit width.
+     * @return Nothing -- or an error if allocation failed, in which case
+     * the entries are unchanged.
+     */
+    auto reset_width(u32 new_bits) -> ResultVoid<AllocationError>
+    {
+        cf_assert(new_bits <= MAX_BITS, "PackedArray bit width out of range");
+        if (new_bits == bits) {
+            if (words.ptr != nullptr)
+                memset(words.ptr, 0, words.len * sizeof(u64));
+            return Ok();
+        }
+
+        Slice<u64> new_words;
+        if (word_count(count, new_bits) > 0) {
+            auto res = allocator.alloc<u64>(word_count(count, new_bits));
+            if (res.is_err())
+                return res.unwrap_err();
+            new_words = res.unwrap();
+            memset(new_words.ptr, 0, new_words.len * sizeof(u64));
+        }
+
+        if (words.ptr != nullptr)
+            allocator.dealloc(words);
+
+        words = new_words;
+        bits = new_bits;
+        return Ok();
+    }
+};
+
+/**
+ * @brief A fixed-length array of values stored as bit-packed indices into a
+ * palette of the distinct values in use.
+ * The bit width grows as the palette grows, so an array holding a single
+ * value uses no index storage at all. Palette lookups are linear, which is
+ * intended for small palettes such as the block types of a chunk section.
+ * @tparam T The type of the values.
+ */
+template <typename T> class PalettedArray {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Palette values must be trivially copyable");
+
+    Allocator &allocator;
+    List<T> palette;
+    PackedArray indices;
+
+    static inline auto bits_for(usize palette_size) -> u32
+    {
+        u32 bits = 0;
+        while ((1ULL << bits) < palette_size)
+            bits++;
+        return bits;
+    }
+
+    /**
+     * @brief Find a value in the palette, adding it if needed.
+     * @param value The value.
+     * @return The palette index -- or an error if allocation failed.
+     */
+    auto index_of(const T &value) -> Result<u32, AllocationError>
+    {
+        for (usize i = 0; i < palette.data.len; i++) {
+            if (palette.data.ptr[i] == value)
+                return static_cast<u32>(i);
+        }
+
+        auto res = palette.push(value);
+        if (res.is_err())
+            return res.unwrap_err();
+
+        auto needed = bits_for(palette.data.len);
+        if (needed > indices.get_bits()) {
+            auto grow = indices.resize(needed);
+            if (grow.is_err()) {
+                palette.pop();
+                return grow.unwrap_err();
+            }
+        }
+
+        return static_cast<u32>(palette.data.len - 1);
+    }
+
+public:
+    /**
+     * @brief Creates a new paletted array with every entry set to a value.
+     * @param allocator The allocator to use.
+     * @param count The number of entries.
+     * @param initial The initial value of every entry.
+     */
+    PalettedArray(Allocator &allocator, usize count, const T &initial)
+        : allocator(allocator)
+        , palette(allocator)
+        , indices(allocator, count, 0)
+    {
+        palette.push(initial).unwrap();
+    }
+
+    /**
+     * @brief Get the number of entries.
+     * @return The number of entries.
+     */
+    inline auto size() const -> usize
+    {
+        return indices.size();
+    }
+
+    /**
+     * @brief Get the palette.
+     * @return The distinct values, indexed by packed index.
+     */
+    inline auto get_palette() const -> Slice<T>
+    {
+        return palette.data;
+    }
+
+    /**
+     * @brief Get the packed indices.
+     * @return The packed index array.
+     */
+    inline auto get_indices() -> PackedArray &
+    {
+        return indices;
+    }
+
+    /**
+     * @brief Get a value.
+     * @param index The index of the entry.
+     * @return The value.
+     */
+    inline auto get(usize index) const -> T
+    {
+        return palette.data.ptr[indices.get(index)];
+    }
+
+    /**
+     * @brief Set a value.
+     * @param index The index of the entry.
+     * @param value The value.
+     * @return Nothing -- or an error if allocation failed.
+     */
+    auto set(usize index, const T &value) -> ResultVoid<AllocationError>
+    {
+        auto res = index_of(value);
+        if (res.is_err())
+            return res.unwrap_err();
+
+        indices.set(index, res.unwrap());
+        return Ok();
+    }
+
+    /**
+     * @brief Set every entry to a value.
+     * The palette is reset to that single value and the index storage is
+     * released.
+     * @param value The value.
+     */
+    auto fill(const T &value) -> void
+    {
+        palette.clear();
+        (void)palette.push(value);
+
+        // Shrinking to 0 bits only frees memory, so it cannot fail
+        (void)indices.resize(0);
+    }
+
+    /**
+     * @brief Unpack every value into a flat array.
+     * @param out The output, with at least size() elements.
+     */
+    auto unpack(Slice<T> out) const -> void
+    {
+        indices.unpack_mapped(out, palette.data.ptr);
+    }
+
+    /**
+     * @brief Replace every value from a flat array.
+     * The palette is rebuilt from the input, which also drops values that
+     * are no longer used.
+     * @param in The input, with at least size() elements.
+     * @return Nothing -- or an error if allocation failed.
+     */
+    auto pack(Slice<T> in) -> ResultVoid<AllocationError>
+    {
+        cf_assert(in.len >= size(), "Pack input too small");
+        if (size() == 0)
+            return Ok();
+
+        List<u32> mapped(allocator);
+        auto reserve = mapped.reserve(size());
+        if (reserve.is_err())
+            return reserve.unwrap_err();
+
+        // Built aside, so a failed allocation leaves the array as it was
+        List<T> fresh(allocator);
+        auto first = fresh.push(in.ptr[0]);
+        if (first.is_err())
+            return first.unwrap_err();
+
+        // Runs of equal values are common, so the last hit is checked first
+        u32 last = 0;
+        for (usize i = 0; i < size(); i++) {
+            if (!(in.ptr[i] == fresh.data.ptr[last])) {
+                last = 0;
+                while (last < fresh.data.len &&
+                       !(fresh.data.ptr[last] == in.ptr[i]))
+                    last++;
+
+                if (last == fresh.data.len) {
+                    auto res = fresh.push(in.ptr[i]);
+                    if (res.is_err())
+                        return res.unwrap_err();
+                }
+            }
+            mapped.data.ptr[i] = last;
+        }
+        mapped.data.len = size();
+
+        // The bit width is chosen once for the final palette. Every entry
+        // is about to be overwritten, so the old ones are not carried over;
+        // on failure they are untouched, and past it nothing can fail
+        auto res = indices.reset_width(bits_for(fresh.data.len));
+        if (res.is_err())
+            return res.unwrap_err();
+
+        palette.swap(fresh);
+        indices.pack(mapped.data);
+        return Ok();
+    }
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,436 @@
+#pragma once
+#include <functional>
+#include <limits>
+#include "Types.hpp"
+#include "Allocator.hpp"
+#include "List.hpp"
+
+namespace CrossFire
+{
+
+namespace detail
+{
+
+// A 4-ary heap is half as deep as a binary heap, and the four children of a
+// node share a cache line for small elements
+constexpr usize HEAP_ARITY = 4;
+
+inline auto heap_parent(usize index) -> usize
+{
+    return (index - 1) / HEAP_ARITY;
+}
+
+inline auto heap_first_child(usize index) -> usize
+{
+    return index * HEAP_ARITY + 1;
+}
+
+}
+
+/**
+ * @brief A priority queue backed by a 4-ary heap in a List.
+ * top() is an element that no other element compares before, so with the
+ * default std::less it is the smallest element.
+ * @tparam T The type of the elements.
+ * @tparam Compare The ordering, returning true if a comes before b.
+ */
+template <typename T, typename Compare = std::less<T> > class PriorityQueue {
+    List<T> heap;
+    Compare compare;
+
+    auto sift_up(usize index) -> void
+    {
+        T value = heap.data.ptr[index];
+        while (index > 0) {
+            auto parent = detail::heap_parent(index);
+            if (!compare(value, heap.data.ptr[parent]))
+                break;
+
+            heap.data.ptr[index] = heap.data.ptr[parent];
+            index = parent;
+        }
+        heap.data.ptr[index] = value;
+    }
+
+    auto sift_down(usize index) -> void
+    {
+        auto len = heap.data.len;
+        T value = heap.data.ptr[index];
+
+        for (;;) {
+            auto first = detail::heap_first_child(index);
+            if (first >= len)
+                break;
+
+            auto last = first + detail::HEAP_ARITY;
+            if (last > len)
+                last = len;
+
+            auto best = first;
+            for (auto child = first + 1; child < last; child++) {
+                if (compare(heap.data.ptr[child], heap.data.ptr[best]))
+                    best = child;
+            }
+
+            if (!compare(heap.data.ptr[best], value))
+                break;
+
+            heap.data.ptr[index] = heap.data.ptr[best];
+            index = best;
+        }
+        heap.data.ptr[index] = value;
+    }
+
+public:
+    /**
+     * @brief Creates a new priority queue.
+     * @param allocator The allocator to use.
+     * @param compare The ordering.
+     */
+    explicit PriorityQueue(Allocator &allocator, Compare compare = Compare())
+        : heap(allocator)
+        , compare(compare)
+    {
+    }
+
+    /**
+     * @brief Get the number of elements.
+     * @return The number of elements.
+     */
+    inline auto size() const -> usize
+    {
+        return heap.data.len;
+    }
+
+    /**
+     * @brief Check if the queue is empty.
+     * @return True if the queue is empty, false otherwise.
+     */
+    inline auto empty() const -> bool
+    {
+        return heap.data.len == 0;
+    }
+
+    /**
+     * @brief Adds an element to the queue.
+     * @param element The element to add.
+     * @return Nothing -- or an error if allocation failed.
+     */
+    inline auto push(const T &element) -> ResultVoid<AllocationError>
+    {
+        auto res = heap.push(element);
+        if (res.is_err())
+            return res.unwrap_err();
+
+        sift_up(heap.data.len - 1);
+        return Ok();
+    }
+
+    /**
+     * @brief Get the first element.
+     * @return The first element.
+     */
+    inline auto top() -> T &
+    {
+        cf_assert(!empty(), "PriorityQueue is empty");
+        return heap.data.ptr[0];
+    }
+
+    /**
+     * @brief Removes the first element.
+     */
+    inline auto pop() -> void
+    {
+        cf_assert(!empty(), "PriorityQueue is empty");
+        heap.data.ptr[0] = heap.back();
+        heap.pop();
+
+        if (heap.data.len > 1)
+            sift_down(0);
+    }
+
+    /**
+     * @brief Removes every element.
+     */
+    inline auto clear() -> void
+    {
+        heap.clear();
+    }
+
+    /**
+     * @brief Reserves room for the given number of elements.
+     * @param capacity The new capacity.
+     * @return Nothing -- or an error if allocation failed.
+     */
+    inline auto reserve(usize capacity) -> ResultVoid<AllocationError>
+    {
+        return heap.reserve(capacity);
+    }
+};
+
+/**
+ * @brief A priority queue whose elements can be reprioritized or removed
+ * through the handle returned when they were pushed.
+ * Handles of popped or removed elements are recycled.
+ * @tparam T The type of the elements.
+ * @tparam Compare The ordering, returning true if a comes before b.
+ */
+template <typename T, typename Compare = std::less<T> >
+class IndexedPriorityQueue {
+public:
+    using Handle = u32;
+
+private:
+    static constexpr u32 NOT_QUEUED = std::numeric_limits<u32>::max();
+
+    List<Handle> heap;
+    List<u32> positions;
+    List<T> values;
+    List<Handle> free_handles;
+    Compare compare;
+
+    inline auto before(Handle a, Handle b) -> bool
+    {
+        return compare(values.data.ptr[a], values.data.ptr[b]);
+    }
+
+    inline auto place(usize index, Handle handle) -> void
+    {
+        heap.data.ptr[index] = handle;
+        positions.data.ptr[handle] = static_cast<u32>(index);
+    }
+
+    auto sift_up(usize index) -> void
+    {
+        Handle handle = heap.data.ptr[index];
+        while (index > 0) {
+            auto parent = detail::heap_parent(index);
+            if (!before(handle, heap.data.ptr[parent]))
+                break;
+
+            place(index, heap.data.ptr[parent]);
+            index = parent;
+        }
+        place(index, handle);
+    }
+
+    auto sift_down(usize index) -> void
+    {
+        auto len = heap.data.len;
+        Handle handle = heap.data.ptr[index];
+
+        for (;;) {
+            auto first = detail::heap_first_child(index);
+            if (first >= len)
+                break;
+
+            auto last = first + detail::HEAP_ARITY;
+            if (last > len)
+                last = len;
+
+            auto best = first;
+            for (auto child = first + 1; child < last; child++) {
+                if (before(heap.data.ptr[child], heap.data.ptr[best]))
+                    best = child;
+            }
+
+            if (!before(heap.data.ptr[best], handle))
+                break;
+
+            place(index, heap.data.ptr[best]);
+            index = best;
+        }
+        place(index, handle);
+    }
+
+    auto remove_at(usize index) -> void
+    {
+        auto handle = heap.data.ptr[index];
+        auto last = heap.back();
+        heap.pop();
+
+        positions.data.ptr[handle] = NOT_QUEUED;
+        // If this fails the handle is simply not recycled
+        (void)free_handles.push(handle);
+
+        if (index < heap.data.len) {
+            place(index, last);
+            sift_up(index);
+            sift_down(positions.data.ptr[last]);
+        }
+    }
+
+public:
+    /**
+     * @brief Creates a new indexed priority queue.
+     * @param allocator The allocator to use.
+     * @param compare The ordering.
+     */
+    explicit IndexedPriorityQueue(Allocator &allocator,
+                                  Compare compare = Compare())
+        : heap(allocator)
+        , positions(allocator)
+        , values(allocator)
+        , free_handles(allocator)
+        , compare(compare)
+    {
+    }
+
+    /**
+     * @brief Get the number of elements.
+     * @return The number of elements.
+     */
+    inline auto size() const -> usize
+    {
+        return heap.data.len;
+    }
+
+    /**
+     * @brief Check if the queue is empty.
+     * @return True if the queue is empty, false otherwise.
+     */
+    inline auto empty() const -> bool
+    {
+        return heap.data.len == 0;
+    }
+
+    /**
+     * @brief Check if a handle refers to an element in the queue.
+     * @param handle The handle.
+     * @return True if the element is queued, false otherwise.
+     */
+    inline auto contains(Handle handle) const -> bool
+    {
+        return handle < positions.data.len &&
+               positions.data.ptr[handle] != NOT_QUEUED;
+    }
+
+    /**
+     * @brief Adds an element to the queue.
+     * @param element The element to add.
+     * @return The handle of the element -- or an error if allocation failed.
+     */
+    auto push(const T &element) -> Result<Handle, AllocationError>
+    {
+        Handle handle;
+        if (free_handles.data.len > 0) {
+            handle = free_handles.back();
+            free_handles.pop();
+            values.data.ptr[handle] = element;
+        } else {
+            handle = static_cast<Handle>(values.data.len);
+            auto res = values.push(element);
+            if (res.is_err())
+                return res.unwrap_err();
+
+            auto pos = positions.push(NOT_QUEUED);
+            if (pos.is_err()) {
+                values.pop();
+                return pos.unwrap_err();
+            }
+        }
+
+        auto res = heap.push(handle);
+        if (res.is_err()) {
+            (void)free_handles.push(handle);
+            return res.unwrap_err();
+        }
+
+        positions.data.ptr[handle] = static_cast<u32>(heap.data.len - 1);
+        sift_up(heap.data.len - 1);
+        return handle;
+    }
+
+    /**
+     * @brief Get the element of a handle.
+     * @param handle The handle, which must be queued.
+     * @return The element. Change it through update() only.
+     */
+    inline auto get(Handle handle) -> const T &
+    {
+        cf_assert(contains(handle), "Handle is not queued");
+        return values.data.ptr[handle];
+    }
+
+    /**
+     * @brief Get the handle of the first element.
+     * @return The handle.
+     */
+    inline auto top_handle() -> Handle
+    {
+        cf_assert(!empty(), "IndexedPriorityQueue is empty");
+        return heap.data.ptr[0];
+    }
+
+    /**
+     * @brief Get the first element.
+     * @return The first element.
+     */
+    inline auto top() -> const T &
+    {
+        return values.data.ptr[top_handle()];
+    }
+
+    /**
+     * @brief Removes the first element.
+     */
+    inline auto pop() -> void
+    {
+        cf_assert(!empty(), "IndexedPriorityQueue is empty");
+        remove_at(0);
+    }
+
+    /**
+     * @brief Change the element of a handle and restore the heap order.
+     * Moving the element either way is supported; decrease_key() is the
+     * common case for path finding.
+     * @param handle The handle, which must be queued.
+     * @param element The new element.
+     */
+    auto update(Handle handle, const T &element) -> void
+    {
+        cf_assert(contains(handle), "Handle is not queued");
+        values.data.ptr[handle] = element;
+
+        auto index = positions.data.ptr[handle];
+        sift_up(index);
+        sift_down(positions.data.ptr[handle]);
+    }
+
+    /**
+     * @brief Move an element towards the front of the queue.
+     * @param handle The handle, which must be queued.
+     * @param element The new element, which must not come after the old one.
+     */
+    inline auto decrease_key(Handle handle, const T &element) -> void
+    {
+        cf_assert(contains(handle), "Handle is not queued");
+        cf_assert(!compare(values.data.ptr[handle], element),
+                  "decrease_key would move the element back");
+        values.data.ptr[handle] = element;
+        sift_up(positions.data.ptr[handle]);
+    }
+
+    /**
+     * @brief Removes an element from the queue.
+     * @param handle The handle, which must be queued.
+     */
+    inline auto remove(Handle handle) -> void
+    {
+        cf_assert(contains(handle), "Handle is not queued");
+        remove_at(positions.data.ptr[handle]);
+    }
+
+    /**
+     * @brief Removes every element. All handles become invalid.
+     */
+    auto clear() -> void
+    {
+        heap.clear();
+        positions.clear();
+        values.clear();
+        free_handles.clear();
+    }
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,398 @@
+#pragma once
+#include <atomic>
+#include <tuple>
+#include "Types.hpp"
+#include "Allocator.hpp"
+#include "List.hpp"
+#include "SparseSet.hpp"
+
+namespace CrossFire
+{
+
+namespace detail
+{
+
+/**
+ * @brief Get the next free component type id.
+ * @return A new component type id.
+ */
+inline auto next_component_id() -> usize
+{
+    static std::atomic<usize> counter{ 0 };
+    return counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Get the component type id of a type.
+ * @tparam T The type of the component.
+ * @return The component type id, stable for the lifetime of the program.
+ */
+template <typename T> inline auto component_id() -> usize
+{
+    static const usize id = next_component_id();
+    return id;
+}
+
+}
+
+/**
+ * @brief A view over all entities that have every component in Ts.
+ * Iteration walks the smallest of the pools and probes the others, so the
+ * cost is proportional to the rarest component.
+ * @tparam Ts The types of the components.
+ */
+template <typename... Ts> class View {
+    std::tuple<ComponentPool<Ts> *...> pools;
+
+    inline auto smallest() const -> const SparseSet *
+    {
+        const SparseSet *result = nullptr;
+        std::apply(
+            [&result](auto *...pool) {
+                ((result = (result == nullptr || pool->size() < result->size())
+                               ? pool
+                               : result),
+                 ...);
+            },
+            pools);
+        return result;
+    }
+
+public:
+    /**
+     * @brief Construct a new View object.
+     * @param pools The pools to view, which may be nullptr if a component has
+     * never been assigned.
+     */
+    explicit View(ComponentPool<Ts> *...pools)
+        : pools(pools...)
+    {
+    }
+
+    /**
+     * @brief Check if the view can yield any entity.
+     * @return True if all pools exist, false otherwise.
+     */
+    inline auto valid() const -> bool
+    {
+        return ((std::get<ComponentPool<Ts> *>(pools) != nullptr) && ...);
+    }
+
+    /**
+     * @brief Get an upper bound on the number of entities in the view.
+     * @return The size of the smallest pool.
+     */
+    inline auto size_hint() const -> usize
+    {
+        return valid() ? smallest()->size() : 0;
+    }
+
+    /**
+     * @brief Call a function for each entity in the view.
+     * Entities are visited back to front, so removing the current entity's
+     * components from inside the function is safe.
+     * @tparam F The type of the function, taking (Entity, Ts &...).
+     * @param func The function.
+     */
+    template <typename F> auto each(F &&func) -> void
+    {
+        if (!valid())
+            return;
+
+        auto entities = smallest()->entities();
+        for (usize i = entities.len; i-- > 0;) {
+            auto entity = entities.ptr[i];
+            auto components = std::make_tuple(
+                std::get<ComponentPool<Ts> *>(pools)->try_get(entity)...);
+
+            if (((std::get<Ts *>(components) != nullptr) && ...))
+                func(entity, *std::get<Ts *>(components)...);
+        }
+    }
+};
+
+/**
+ * @brief A view over a single component, which iterates the packed arrays
+ * directly without any sparse lookups.
+ * @tparam T The type of the component.
+ */
+template <typename T> class View<T> {
+    ComponentPool<T> *pool;
+
+public:
+    /**
+     * @brief Construct a new View object.
+     * @param pool The pool to view, which may be nullptr.
+     */
+    explicit View(ComponentPool<T> *pool)
+        : pool(pool)
+    {
+    }
+
+    /**
+     * @brief Check if the view can yield any entity.
+     * @return True if the pool exists, false otherwise.
+     */
+    inline auto valid() const -> bool
+    {
+        return pool != nullptr;
+    }
+
+    /**
+     * @brief Get the number of entities in the view.
+     * @return The size of the pool.
+     */
+    inline auto size_hint() const -> usize
+    {
+        return valid() ? pool->size() : 0;
+    }
+
+    /**
+     * @brief Call a function for each entity in the view.
+     * Entities are visited back to front, so removing the current entity's
+     * component from inside the function is safe.
+     * @tparam F The type of the function, taking (Entity, T &).
+     * @param func The function.
+     */
+    template <typename F> auto each(F &&func) -> void
+    {
+        if (!valid())
+            return;
+
+        auto entities = pool->entities();
+        auto components = pool->raw();
+        for (usize i = entities.len; i-- > 0;)
+            func(entities.ptr[i], components.ptr[i]);
+    }
+};
+
+/**
+ * @brief The Registry class owns entities and their component pools.
+ * Each component type gets its own ComponentPool, created on first use from
+ * the registry's allocator, so pools can live in an arena.
+ * Entity ids of destroyed entities are recycled; a bitset of live ids
+ * keeps a stale id from being destroyed, and so recycled, twice.
+ */
+class Registry final {
+    struct PoolEntry {
+        SparseSet *pool;
+        void (*release)(Allocator &allocator, SparseSet *pool);
+    };
+
+    template <typename T>
+    static auto release_pool(Allocator &allocator, SparseSet *pool) -> void
+    {
+        allocator.destroy(static_cast<ComponentPool<T> *>(pool));
+    }
+
+    Allocator &allocator;
+    List<PoolEntry> pools;
+    List<Entity> free_ids;
+    List<u64> alive;
+    Entity next_id = 0;
+
+public:
+    /**
+     * @brief Creates a new registry.
+     * @param allocator The allocator to use for pools and bookkeeping.
+     */
+    explicit Registry(Allocator &allocator = c_allocator)
+        : allocator(allocator)
+        , pools(allocator)
+        , free_ids(allocator)
+        , alive(allocator)
+    {
+    }
+
+    ~Registry()
+    {
+        for (usize i = 0; i < pools.data.len; i++) {
+            auto &entry = pools.data.ptr[i];
+            if (entry.pool != nullptr)
+                entry.release(allocator, entry.pool);
+        }
+    }
+
+    Registry(const Registry &other) = delete;
+    Registry &operator=(const Registry &other) = delete;
+
+    /**
+     * @brief Create a new entity.
+     * @return The entity -- or an error if allocation failed.
+     */
+    inline auto create() -> Result<Entity, AllocationError>
+    {
+        Entity entity;
+        if (free_ids.data.len > 0) {
+            entity = free_ids.back();
+            free_ids.pop();
+        } else {
+            cf_assert(next_id != NullEntity, "Out of entity ids");
+            if (next_id / 64 >= alive.data.len) {
+                auto res = alive.push(0);
+                if (res.is_err())
+                    return res.unwrap_err();
+            }
+            entity = next_id++;
+        }
+
+        alive.data.ptr[entity / 64] |= 1ULL << (entity % 64);
+        return entity;
+    }
+
+    /**
+     * @brief Check if an entity was created and not yet destroyed.
+     * @param entity The entity.
+     * @return True if the entity is alive, false otherwise.
+     */
+    inline auto valid(Entity entity) const -> bool
+    {
+        return entity != NullEntity && entity / 64 < alive.data.len &&
+               (alive.data.ptr[entity / 64] >> (entity % 64) & 1) != 0;
+    }
+
+    /**
+     * @brief Destroy an entity and all of its components. Destroying an
+     * entity that is not alive is an error, and is ignored.
+     * @param entity The entity.
+     */
+    auto destroy(Entity entity) -> void
+    {
+        cf_assert(valid(entity), "Destroying an entity that is not alive");
+        if (!valid(entity))
+            return;
+
+        alive.data.ptr[entity / 64] &= ~(1ULL << (entity % 64));
+        for (usize i = 0; i < pools.data.len; i++) {
+            auto pool = pools.data.ptr[i].pool;
+            if (pool != nullptr && pool->contains(entity))
+                pool->remove(entity);
+        }
+
+        // If this fails the id is simply not recycled
+        (void)free_ids.push(entity);
+    }
+
+    /**
+     * @brief Get the pool for a component, creating it if needed.
+     * @tparam T The type of the component.
+     * @return The pool -- or an error if allocation failed.
+     */
+    template <typename T>
+    auto storage() -> Result<ComponentPool<T> *, AllocationError>
+    {
+        auto id = detail::component_id<T>();
+        while (pools.data.len <= id) {
+            auto res = pools.push(PoolEntry{ nullptr, nullptr });
+            if (res.is_err())
+                return res.unwrap_err();
+        }
+
+        auto &entry = pools.data.ptr[id];
+        if (entry.pool == nullptr) {
+            auto res = allocator.create<ComponentPool<T> >(allocator);
+            if (res.is_err())
+                return res.unwrap_err();
+
+            entry.pool = res.unwrap();
+            entry.release = &Registry::release_pool<T>;
+        }
+
+        return static_cast<ComponentPool<T> *>(entry.pool);
+    }
+
+    /**
+     * @brief Get the pool for a component if it exists.
+     * @tparam T The type of the component.
+     * @return The pool -- or nullptr if the component was never assigned.
+     */
+    template <typename T> inline auto try_storage() -> ComponentPool<T> *
+    {
+        auto id = detail::component_id<T>();
+        if (id >= pools.data.len)
+            return nullptr;
+
+        return static_cast<ComponentPool<T> *>(pools.data.ptr[id].pool);
+    }
+
+    /**
+     * @brief Assign a component to an entity.
+     * @tparam T The type of the component.
+     * @param entity The entity, which must be alive.
+     * @param component The component.
+     * @return A pointer to the stored component -- or an error if allocation
+     * failed.
+     */
+    template <typename T>
+    auto emplace(Entity entity, const T &component)
+        -> Result<T *, AllocationError>
+    {
+        cf_assert(valid(entity), "Assigning a component to a dead entity");
+        auto res = storage<T>();
+        if (res.is_err())
+            return res.unwrap_err();
+
+        return res.unwrap()->emplace(entity, component);
+    }
+
+    /**
+     * @brief Remove a component from an entity, if present.
+     * @tparam T The type of the component.
+     * @param entity The entity.
+     */
+    template <typename T> auto remove(Entity entity) -> void
+    {
+        auto pool = try_storage<T>();
+        if (pool != nullptr && pool->contains(entity))
+            pool->remove(entity);
+    }
+
+    /**
+     * @brief Check if an entity has a component.
+     * @tparam T The type of the component.
+     * @param entity The entity.
+     * @return True if the entity has the component, false otherwise.
+     */
+    template <typename T> inline auto has(Entity entity) -> bool
+    {
+        auto pool = try_storage<T>();
+        return pool != nullptr && pool->contains(entity);
+    }
+
+    /**
+     * @brief Get the component of an entity.
+     * @tparam T The type of the component.
+     * @param entity The entity, which must have the component.
+     * @return The component.
+     */
+    template <typename T> inline auto get(Entity entity) -> T &
+    {
+        auto pool = try_storage<T>();
+        cf_assert(pool != nullptr, "Component was never assigned");
+        return pool->get(entity);
+    }
+
+    /**
+     * @brief Get the component of an entity if it has one.
+     * @tparam T The type of the component.
+     * @param entity The entity.
+     * @return A pointer to the component -- or nullptr.
+     */
+    template <typename T> inline auto try_get(Entity entity) -> T *
+    {
+        auto pool = try_storage<T>();
+        return pool != nullptr ? pool->try_get(entity) : nullptr;
+    }
+
+    /**
+     * @brief Get a view over all entities that have every component in Ts.
+     * @tparam Ts The types of the components.
+     * @return The view.
+     */
+    template <typename... Ts> inline auto view() -> View<Ts...>
+    {
+        return View<Ts...>(try_storage<Ts>()...);
+    }
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,200 @@
+#pragma once
+#include <new>
+#include "Allocator.hpp"
+#include "List.hpp"
+
+namespace CrossFire
+{
+
+/**
+ * @brief A dynamic array that grows by adding fixed-size blocks.
+ * Elements are never moved once pushed, so pointers and references to them
+ * stay valid until they are popped or the list is cleared.
+ * Indexing is O(1) through a table of block pointers.
+ * @tparam T The type of the elements.
+ * @tparam BlockSize The number of elements per block, a power of two.
+ */
+template <typename T, usize BlockSize = 64> class SegmentedList {
+    static_assert(BlockSize > 0 && (BlockSize & (BlockSize - 1)) == 0,
+                  "BlockSize must be a power of two");
+
+    static constexpr usize BLOCK_MASK = BlockSize - 1;
+
+    Allocator &allocator;
+    List<T *> blocks;
+    usize len;
+
+    static constexpr auto block_shift() -> usize
+    {
+        usize shift = 0;
+        while ((static_cast<usize>(1) << shift) < BlockSize)
+            shift++;
+        return shift;
+    }
+
+public:
+    /**
+     * @brief Creates a new segmented list.
+     * No block is allocated until the first push.
+     * @param allocator The allocator to use.
+     */
+    explicit SegmentedList(Allocator &allocator)
+        : allocator(allocator)
+        , blocks(allocator)
+        , len(0)
+    {
+    }
+
+    ~SegmentedList()
+    {
+        clear();
+        for (usize i = 0; i < blocks.data.len; i++)
+            allocator.dealloc(Slice<T>(blocks.data.ptr[i], BlockSize));
+    }
+
+    SegmentedList(const SegmentedList &other) = delete;
+    SegmentedList &operator=(const SegmentedList &other) = delete;
+
+    /**
+     * @brief Get the number of elements.
+     * @return The number of elements.
+     */
+    inline auto size() const -> usize
+    {
+        return len;
+    }
+
+    /**
+     * @brief Get the number of elements that fit without allocating.
+     * @return The capacity.
+     */
+    inline auto capacity() const -> usize
+    {
+        return blocks.data.len * BlockSize;
+    }
+
+    /**
+     * @brief Adds an element to the list.
+     * @param element The element to add.
+     * @return A stable pointer to the new element -- or an error if
+     * allocation failed.
+     */
+    inline auto push(const T &element) -> Result<T *, AllocationError>
+    {
+        if (len == capacity()) {
+            auto res = reserve(len + 1);
+            if (res.is_err())
+                return res.unwrap_err();
+        }
+
+        T *slot = blocks.data.ptr[len >> block_shift()] + (len & BLOCK_MASK);
+        new (slot) T(element);
+        len++;
+
+        return slot;
+    }
+
+    /**
+     * @brief Removes the last element from the list.
+     * Its block is kept for reuse.
+     */
+    inline auto pop() -> void
+    {
+        cf_assert(len > 0, "SegmentedList is empty");
+        len--;
+        blocks.data.ptr[len >> block_shift()][len & BLOCK_MASK].~T();
+    }
+
+    /**
+     * @brief Removes every element from the list.
+     * The blocks are kept for reuse.
+     */
+    auto clear() -> void
+    {
+        while (len > 0)
+            pop();
+    }
+
+    /**
+     * @brief Allocates blocks until the given number of elements fit.
+     * @param new_capacity The new capacity.
+     * @return Nothing -- or an error if allocation failed.
+     */
+    auto reserve(usize new_capacity) -> ResultVoid<AllocationError>
+    {
+        while (capacity() < new_capacity) {
+            auto block = allocator.alloc<T>(BlockSize);
+            if (block.is_err())
+                return block.unwrap_err();
+
+            auto res = blocks.push(block.unwrap().ptr);
+            if (res.is_err()) {
+                allocator.dealloc(block.unwrap());
+                return res.unwrap_err();
+            }
+        }
+
+        return Ok();
+    }
+
+    /**
+     * @brief Gets the element at the given index.
+     * @param index The index of the element.
+     * @return The element.
+     */
+    inline auto operator[](usize index) -> T &
+    {
+        cf_assert(index < len, "SegmentedList index out of range");
+        return blocks.data.ptr[index >> block_shift()][index & BLOCK_MASK];
+    }
+
+    /**
+     * @brief Gets the last element of the list.
+     * @return The last element.
+     */
+    inline auto back() -> T &
+    {
+        return (*this)[len - 1];
+    }
+
+    /**
+     * @brief Get the number of blocks that hold elements.
+     * @return The number of used blocks.
+     */
+    inline auto block_count() const -> usize
+    {
+        return (len + BLOCK_MASK) >> block_shift();
+    }
+
+    /**
+     * @brief Get the elements of a block.
+     * Every block but the last used one is full.
+     * @param index The index of the block, below block_count().
+     * @return The elements of the block.
+     */
+    inline auto get_block(usize index) -> Slice<T>
+    {
+        cf_assert(index < block_count(), "SegmentedList block out of range");
+        auto start = index << block_shift();
+        auto count = len - start < BlockSize ? len - start : BlockSize;
+        return Slice<T>(blocks.data.ptr[index], count);
+    }
+
+    /**
+     * @brief Call a function for each element, one contiguous block at a
+     * time, which avoids the block lookup per element.
+     * @tparam F The type of the function, taking (T &).
+     * @param func The function.
+     */
+    template <typename F> auto for_each(F &&func) -> void
+    {
+        auto count = block_count();
+        for (usize b = 0; b < count; b++) {
+            auto block = get_block(b);
+            for (usize i = 0; i < block.len; i++)
+                func(block.ptr[i]);
+        }
+    }
+};
+
+}
\ No newline at end of file
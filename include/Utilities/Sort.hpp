@@ -0,0 +1,436 @@
+#pragma once
+#include <type_traits>
+#include <utility>
+#include "Types.hpp"
+#include "Allocator.hpp"
+#include "Threading/Thread.hpp"
+
+namespace CrossFire
+{
+
+namespace detail
+{
+
+/**
+ * @brief RadixTraits maps a key type to an unsigned integer whose order
+ * matches the order of the keys.
+ */
+template <typename T, typename = void> struct RadixTraits;
+
+template <typename T>
+struct RadixTraits<T, std::enable_if_t<std::is_unsigned<T>::value> > {
+    using Bits = T;
+
+    static inline auto encode(T value) -> Bits
+    {
+        return value;
+    }
+
+    static inline auto decode(Bits bits) -> T
+    {
+        return bits;
+    }
+};
+
+template <typename T>
+struct RadixTraits<T, std::enable_if_t<std::is_integral<T>::value &&
+                                       std::is_signed<T>::value> > {
+    using Bits = std::make_unsigned_t<T>;
+    static constexpr Bits SIGN = Bits(1) << (sizeof(T) * 8 - 1);
+
+    static inline auto encode(T value) -> Bits
+    {
+        return static_cast<Bits>(value) ^ SIGN;
+    }
+
+    static inline auto decode(Bits bits) -> T
+    {
+        return static_cast<T>(bits ^ SIGN);
+    }
+};
+
+template <typename T>
+struct RadixTraits<T, std::enable_if_t<std::is_floating_point<T>::value> > {
+    static_assert(sizeof(T) == 4 || sizeof(T) == 8,
+                  "Only 4 and 8 byte floating point keys can be radix sorted");
+
+    using Bits = std::conditional_t<sizeof(T) == 4, u32, u64>;
+    static constexpr Bits SIGN = Bits(1) << (sizeof(T) * 8 - 1);
+
+    // Negative floats sort in reverse, so all of their bits are flipped
+    static inline auto encode(T value) -> Bits
+    {
+        Bits bits;
+        memcpy(&bits, &value, sizeof(T));
+        return bits ^ ((bits & SIGN) ? ~Bits(0) : SIGN);
+    }
+
+    static inline auto decode(Bits bits) -> T
+    {
+        bits ^= (bits & SIGN) ? SIGN : ~Bits(0);
+        T value;
+        memcpy(&value, &bits, sizeof(T));
+        return value;
+    }
+};
+
+/**
+ * @brief A placeholder value type for key-only sorts.
+ */
+struct NoValue {
+};
+
+constexpr usize RADIX = 256;
+
+// Parallel sorts split the keys into at most this many chunks
+constexpr usize RADIX_MAX_CHUNKS = 64;
+// and never into chunks smaller than this
+constexpr usize RADIX_MIN_CHUNK = 16384;
+
+template <typename K> inline auto digit(K key, usize pass) -> usize
+{
+    return static_cast<usize>(key >> (pass * 8)) & (RADIX - 1);
+}
+
+/**
+ * @brief Scatter a range of keys (and values) by one digit.
+ * @param offsets The next output index for each digit, advanced in place.
+ */
+template <typename K, typename V, bool HasValues>
+inline auto scatter(const K *src_k, const V *src_v, K *dst_k, V *dst_v,
+                    usize begin, usize end, usize pass, usize *offsets)
+    -> void
+{
+    for (usize i = begin; i < end; i++) {
+        auto out = offsets[digit(src_k[i], pass)]++;
+        dst_k[out] = src_k[i];
+        if constexpr (HasValues)
+            dst_v[out] = src_v[i];
+    }
+}
+
+/**
+ * @brief Check if every key shares the same digit for a pass.
+ * @param counts The digit histogram of the pass.
+ * @param n The number of keys.
+ * @return True if the pass would not move anything.
+ */
+inline auto trivial_pass(const usize *counts, usize n) -> bool
+{
+    for (usize d = 0; d < RADIX; d++) {
+        if (counts[d] != 0)
+            return counts[d] == n;
+    }
+    return true;
+}
+
+/**
+ * @brief LSD radix sort on encoded keys, ping-ponging between two buffers.
+ * @param keys The encoded keys; on return they are sorted in keys[0].
+ * @param values The values and their scratch buffer; on return the sorted
+ * values are in values[0].
+ */
+template <typename K, typename V, bool HasValues>
+auto radix_passes(K *keys[2], V *values[2], usize n) -> void
+{
+    constexpr usize PASSES = sizeof(K);
+    usize counts[PASSES][RADIX] = {};
+
+    for (usize i = 0; i < n; i++) {
+        auto key = keys[0][i];
+        for (usize p = 0; p < PASSES; p++)
+            counts[p][digit(key, p)]++;
+    }
+
+    for (usize p = 0; p < PASSES; p++) {
+        if (trivial_pass(counts[p], n))
+            continue;
+
+        usize offsets[RADIX];
+        usize sum = 0;
+        for (usize d = 0; d < RADIX; d++) {
+            offsets[d] = sum;
+            sum += counts[p][d];
+        }
+
+        scatter<K, V, HasValues>(keys[0], values[0], keys[1], values[1], 0,
+                                 n, p, offsets);
+        std::swap(keys[0], keys[1]);
+        if constexpr (HasValues)
+            std::swap(values[0], values[1]);
+    }
+}
+
+/**
+ * @brief Radix sort on encoded keys, splitting every pass across a pool.
+ * Each pass histograms the chunks in parallel, computes per-chunk output
+ * offsets, then scatters the chunks in parallel; the result is stable.
+ * @return Nothing -- or an error if allocation failed.
+ */
+template <typename K, typename V, bool HasValues>
+auto parallel_radix_passes(K *keys[2], V *values[2], usize n,
+                           Allocator &allocator, ThreadPool &pool,
+                           usize chunks) -> ResultVoid<AllocationError>
+{
+    constexpr usize PASSES = sizeof(K);
+
+    auto res = allocator.alloc<usize>(chunks * RADIX * (PASSES + 1));
+    if (res.is_err())
+        return res.unwrap_err();
+
+    // Per-chunk histograms of every pass, then per-chunk offsets
+    auto table = res.unwrap();
+    usize *totals = table.ptr;
+    usize *offsets = table.ptr + chunks * RADIX * PASSES;
+    memset(table.ptr, 0, table.len * sizeof(usize));
+
+    // The waits run other tasks, so a worker of the pool may sort too
+    Array<TaskHandle, RADIX_MAX_CHUNKS> handles;
+    auto chunk_begin = [n, chunks](usize c) { return n * c / chunks; };
+    auto run = [&](auto &&task) {
+        for (usize c = 0; c < chunks; c++)
+            handles[c] = pool.submit([&task, c] { task(c); });
+        for (usize c = 0; c < chunks; c++)
+            pool.wait(handles[c]);
+    };
+
+    // The totals per pass do not change as keys move, so they are
+    // gathered once to find the passes that can be skipped
+    run([&](usize c) {
+        usize *hist = totals + c * RADIX * PASSES;
+        for (usize i = chunk_begin(c); i < chunk_begin(c + 1); i++) {
+            auto key = keys[0][i];
+            for (usize p = 0; p < PASSES; p++)
+                hist[p * RADIX + digit(key, p)]++;
+        }
+    });
+
+    for (usize p = 0; p < PASSES; p++) {
+        usize counts[RADIX] = {};
+        for (usize c = 0; c < chunks; c++) {
+            for (usize d = 0; d < RADIX; d++)
+                counts[d] += totals[(c * PASSES + p) * RADIX + d];
+        }
+        if (trivial_pass(counts, n))
+            continue;
+
+        run([&](usize c) {
+            usize *hist = offsets + c * RADIX;
+            memset(hist, 0, RADIX * sizeof(usize));
+            for (usize i = chunk_begin(c); i < chunk_begin(c + 1); i++)
+                hist[digit(keys[0][i], p)]++;
+        });
+
+        // Digit-major, chunk-minor order keeps the sort stable
+        usize sum = 0;
+        for (usize d = 0; d < RADIX; d++) {
+            for (usize c = 0; c < chunks; c++) {
+                auto count = offsets[c * RADIX + d];
+                offsets[c * RADIX + d] = sum;
+                sum += count;
+            }
+        }
+
+        run([&](usize c) {
+            scatter<K, V, HasValues>(keys[0], values[0], keys[1], values[1],
+                                     chunk_begin(c), chunk_begin(c + 1), p,
+                                     offsets + c * RADIX);
+        });
+
+        std::swap(keys[0], keys[1]);
+        if constexpr (HasValues)
+            std::swap(values[0], values[1]);
+    }
+
+    allocator.dealloc(table);
+    return Ok();
+}
+
+/**
+ * @brief Shared driver: encode the keys into scratch, sort, then write the
+ * keys and values back.
+ * @param pool The pool to split the passes over -- or nullptr.
+ * @return Nothing -- or an error if allocation failed.
+ */
+template <typename T, typename V, bool HasValues>
+auto radix_sort_impl(Slice<T> keys, V *values, Allocator &allocator,
+                     ThreadPool *pool) -> ResultVoid<AllocationError>
+{
+    using Traits = RadixTraits<T>;
+    using K = typename Traits::Bits;
+    static_assert(std::is_trivially_copyable<V>::value,
+                  "Sorted values must be trivially copyable");
+
+    usize n = keys.len;
+    if (n < 2)
+        return Ok();
+
+    auto key_res = allocator.alloc<K>(n * 2);
+    if (key_res.is_err())
+        return key_res.unwrap_err();
+    auto key_scratch = key_res.unwrap();
+
+    Slice<V> value_scratch;
+    if constexpr (HasValues) {
+        auto value_res = allocator.alloc<V>(n);
+        if (value_res.is_err()) {
+            allocator.dealloc(key_scratch);
+            return value_res.unwrap_err();
+        }
+        value_scratch = value_res.unwrap();
+    }
+
+    K *key_bufs[2] = { key_scratch.ptr, key_scratch.ptr + n };
+    V *value_bufs[2] = { values, value_scratch.ptr };
+
+    for (usize i = 0; i < n; i++)
+        key_bufs[0][i] = Traits::encode(keys.ptr[i]);
+
+    usize chunks = 0;
+    if (pool != nullptr) {
+        chunks = pool->size();
+        if (chunks > n / RADIX_MIN_CHUNK)
+            chunks = n / RADIX_MIN_CHUNK;
+        if (chunks > RADIX_MAX_CHUNKS)
+            chunks = RADIX_MAX_CHUNKS;
+    }
+
+    ResultVoid<AllocationError> result = Ok();
+    if (chunks > 1)
+        result = parallel_radix_passes<K, V, HasValues>(
+            key_bufs, value_bufs, n, allocator, *pool, chunks);
+    else
+        radix_passes<K, V, HasValues>(key_bufs, value_bufs, n);
+
+    if (result.is_ok()) {
+        for (usize i = 0; i < n; i++)
+            keys.ptr[i] = Traits::decode(key_bufs[0][i]);
+
+        if constexpr (HasValues) {
+            if (value_bufs[0] != values)
+                memcpy(values, value_bufs[0], n * sizeof(V));
+        }
+    }
+
+    if constexpr (HasValues)
+        allocator.dealloc(value_scratch);
+    allocator.dealloc(key_scratch);
+
+    return result;
+}
+
+}
+
+/**
+ * @brief Sort integer or floating point keys with an LSD radix sort.
+ * Passes whose digit is the same for every key are skipped, so keys with
+ * a small range sort in fewer passes.
+ * @tparam T The type of the keys.
+ * @param keys The keys to sort in place.
+ * @param allocator The allocator to take scratch memory from.
+ * @return Nothing -- or an error if allocation failed.
+ */
+template <typename T>
+inline auto radix_sort(Slice<T> keys, Allocator &allocator)
+    -> ResultVoid<AllocationError>
+{
+    return detail::radix_sort_impl<T, detail::NoValue, false>(
+        keys, nullptr, allocator, nullptr);
+}
+
+/**
+ * @brief Sort keys and move values along with them, stably.
+ * @tparam T The type of the keys.
+ * @tparam V The type of the values.
+ * @param keys The keys to sort in place.
+ * @param values The values, with as many elements as keys.
+ * @param allocator The allocator to take scratch memory from.
+ * @return Nothing -- or an error if allocation failed.
+ */
+template <typename T, typename V>
+inline auto radix_sort_pairs(Slice<T> keys, Slice<V> values,
+                             Allocator &allocator)
+    -> ResultVoid<AllocationError>
+{
+    cf_assert(values.len == keys.len, "Keys and values differ in length");
+    return detail::radix_sort_impl<T, V, true>(keys, values.ptr, allocator,
+                                               nullptr);
+}
+
+/**
+ * @brief Compute the stable sorted order of keys without moving them.
+ * This is the indirect sort for large records: sort a key extracted from
+ * each record, then visit the records through the indices.
+ * @tparam T The type of the keys.
+ * @param keys The keys, which are left untouched.
+ * @param indices The output, with as many elements as keys; on return
+ * keys[indices[i]] is the i-th smallest key.
+ * @param allocator The allocator to take scratch memory from.
+ * @return Nothing -- or an error if allocation failed.
+ */
+template <typename T>
+auto radix_sort_indices(Slice<T> keys, Slice<u32> indices,
+                        Allocator &allocator) -> ResultVoid<AllocationError>
+{
+    cf_assert(indices.len == keys.len, "Keys and indices differ in length");
+    if (keys.len < 2) {
+        if (keys.len == 1)
+            indices.ptr[0] = 0;
+        return Ok();
+    }
+
+    auto res = allocator.alloc<T>(keys.len);
+    if (res.is_err())
+        return res.unwrap_err();
+
+    auto copy = res.unwrap();
+    memcpy(copy.ptr, keys.ptr, keys.len * sizeof(T));
+    for (usize i = 0; i < indices.len; i++)
+        indices.ptr[i] = static_cast<u32>(i);
+
+    auto result = radix_sort_pairs(Slice<T>(copy.ptr, keys.len), indices,
+                                   allocator);
+    allocator.dealloc(copy);
+    return result;
+}
+
+/**
+ * @brief Sort keys with an LSD radix sort split across a thread pool.
+ * Inputs too small to split are sorted on the calling thread, which runs
+ * pool tasks while it waits, so it may be one of the pool's workers.
+ * @tparam T The type of the keys.
+ * @param keys The keys to sort in place.
+ * @param allocator The allocator to take scratch memory from.
+ * @param pool The pool to run the passes on.
+ * @return Nothing -- or an error if allocation failed.
+ */
+template <typename T>
+inline auto parallel_radix_sort(Slice<T> keys, Allocator &allocator,
+                                ThreadPool &pool)
+    -> ResultVoid<AllocationError>
+{
+    return detail::radix_sort_impl<T, detail::NoValue, false>(
+        keys, nullptr, allocator, &pool);
+}
+
+/**
+ * @brief Sort keys and values stably, split across a thread pool.
+ * @tparam T The type of the keys.
+ * @tparam V The type of the values.
+ * @param keys The keys to sort in place.
+ * @param values The values, with as many elements as keys.
+ * @param allocator The allocator to take scratch memory from.
+ * @param pool The pool to run the passes on.
+ * @return Nothing -- or an error if allocation failed.
+ */
+template <typename T, typename V>
+inline auto parallel_radix_sort_pairs(Slice<T> keys, Slice<V> values,
+                                      Allocator &allocator, ThreadPool &pool)
+    -> ResultVoid<AllocationError>
+{
+    cf_assert(values.len == keys.len, "Keys and values differ in length");
+    return detail::radix_sort_impl<T, V, true>(keys, values.ptr, allocator,
+                                               &pool);
+}
+
+}
\ No newline at end of file
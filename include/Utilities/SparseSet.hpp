@@ -0,0 +1,240 @@
+#pragma once
+#include <limits>
+#include <type_traits>
+#include "Types.hpp"
+#include "Allocator.hpp"
+#include "List.hpp"
+
+namespace CrossFire
+{
+
+/**
+ * @brief Entity is an identifier used to key component storage.
+ */
+using Entity = u32;
+
+/**
+ * @brief NullEntity is an entity id that never refers to a live entity.
+ */
+constexpr Entity NullEntity = std::numeric_limits<Entity>::max();
+
+/**
+ * @brief A sparse set of entities.
+ * The sparse array maps an entity to its position in the dense array,
+ * so lookups, insertions and removals are O(1) and iteration only touches
+ * the packed dense array.
+ */
+class SparseSet {
+protected:
+    List<u32> sparse;
+    List<Entity> dense;
+
+public:
+    /**
+     * @brief Creates a new sparse set.
+     * @param allocator The allocator to use.
+     */
+    explicit SparseSet(Allocator &allocator)
+        : sparse(allocator)
+        , dense(allocator)
+    {
+    }
+
+    virtual ~SparseSet() = default;
+
+    SparseSet(const SparseSet &other) = delete;
+    SparseSet &operator=(const SparseSet &other) = delete;
+
+    /**
+     * @brief Check if the set contains an entity.
+     * @param entity The entity.
+     * @return True if the entity is in the set, false otherwise.
+     */
+    inline auto contains(Entity entity) const -> bool
+    {
+        return entity < sparse.data.len &&
+               sparse.data.ptr[entity] != NullEntity;
+    }
+
+    /**
+     * @brief Get the position of an entity in the dense array.
+     * @param entity The entity, which must be in the set.
+     * @return The dense index of the entity.
+     */
+    inline auto index_of(Entity entity) const -> usize
+    {
+        cf_assert(contains(entity), "Entity is not in the sparse set");
+        return sparse.data.ptr[entity];
+    }
+
+    /**
+     * @brief Adds an entity to the set.
+     * @param entity The entity, which must not already be in the set.
+     * @return Nothing -- or an error if allocation failed.
+     */
+    inline auto insert(Entity entity) -> ResultVoid<AllocationError>
+    {
+        cf_assert(entity != NullEntity, "Cannot insert the null entity");
+        cf_assert(!contains(entity), "Entity is already in the sparse set");
+
+        if (entity >= sparse.data.len) {
+            // Grow the sparse array to cover the entity
+            if (entity >= sparse.capacity) {
+                auto new_capacity = sparse.capacity * 2;
+                if (new_capacity <= entity)
+                    new_capacity = static_cast<usize>(entity) + 1;
+
+                auto res = sparse.reserve(new_capacity);
+                if (res.is_err())
+                    return res.unwrap_err();
+            }
+
+            for (usize i = sparse.data.len; i <= entity; i++)
+                sparse.data.ptr[i] = NullEntity;
+            sparse.data.len = static_cast<usize>(entity) + 1;
+        }
+
+        auto res = dense.push(entity);
+        if (res.is_err())
+            return res.unwrap_err();
+
+        sparse.data.ptr[entity] = static_cast<u32>(dense.data.len - 1);
+        return Ok();
+    }
+
+    /**
+     * @brief Removes an entity from the set.
+     * The last entity in the dense array is moved into the freed slot.
+     * @param entity The entity, which must be in the set.
+     */
+    virtual auto remove(Entity entity) -> void
+    {
+        auto index = index_of(entity);
+        auto last = dense.data.ptr[dense.data.len - 1];
+
+        dense.data.ptr[index] = last;
+        sparse.data.ptr[last] = static_cast<u32>(index);
+        sparse.data.ptr[entity] = NullEntity;
+        dense.pop();
+    }
+
+    /**
+     * @brief Get the number of entities in the set.
+     * @return The number of entities.
+     */
+    inline auto size() const -> usize
+    {
+        return dense.data.len;
+    }
+
+    /**
+     * @brief Get the packed entities of the set.
+     * @return The dense array of entities.
+     */
+    inline auto entities() const -> Slice<Entity>
+    {
+        return dense.data;
+    }
+};
+
+/**
+ * @brief A component pool stores one component per entity in a dense array
+ * that is kept parallel to the dense entity array of its sparse set.
+ * Components are moved with memcpy on growth, so they must be trivially
+ * copyable.
+ * @tparam T The type of the component.
+ */
+template <typename T> class ComponentPool final : public SparseSet {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Components must be trivially copyable");
+
+    List<T> components;
+
+public:
+    /**
+     * @brief Creates a new component pool.
+     * @param allocator The allocator to use.
+     */
+    explicit ComponentPool(Allocator &allocator)
+        : SparseSet(allocator)
+        , components(allocator)
+    {
+    }
+
+    /**
+     * @brief Assigns a component to an entity.
+     * If the entity already has the component, it is overwritten.
+     * @param entity The entity.
+     * @param component The component.
+     * @return A pointer to the stored component -- or an error if allocation
+     * failed. The pointer is invalidated by the next insertion or removal.
+     */
+    inline auto emplace(Entity entity, const T &component)
+        -> Result<T *, AllocationError>
+    {
+        if (contains(entity)) {
+            auto ptr = components.data.ptr + index_of(entity);
+            *ptr = component;
+            return ptr;
+        }
+
+        auto res = components.push(component);
+        if (res.is_err())
+            return res.unwrap_err();
+
+        auto ins = insert(entity);
+        if (ins.is_err()) {
+            components.pop();
+            return ins.unwrap_err();
+        }
+
+        return components.data.ptr + components.data.len - 1;
+    }
+
+    /**
+     * @brief Removes the component of an entity.
+     * @param entity The entity, which must have the component.
+     */
+    auto remove(Entity entity) -> void override
+    {
+        auto index = index_of(entity);
+        components.data.ptr[index] = components.back();
+        components.pop();
+
+        SparseSet::remove(entity);
+    }
+
+    /**
+     * @brief Get the component of an entity.
+     * @param entity The entity, which must have the component.
+     * @return The component.
+     */
+    inline auto get(Entity entity) -> T &
+    {
+        return components.data.ptr[index_of(entity)];
+    }
+
+    /**
+     * @brief Get the component of an entity if it has one.
+     * @param entity The entity.
+     * @return A pointer to the component -- or nullptr.
+     */
+    inline auto try_get(Entity entity) -> T *
+    {
+        if (!contains(entity))
+            return nullptr;
+
+        return components.data.ptr + sparse.data.ptr[entity];
+    }
+
+    /**
+     * @brief Get the packed components, parallel to entities().
+     * @return The dense array of components.
+     */
+    inline auto raw() -> Slice<T>
+    {
+        return components.data;
+    }
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,651 @@
+#pragma once
+#include <cmath>
+#include <limits>
+#include "Types.hpp"
+#include "Allocator.hpp"
+#include "List.hpp"
+#include "SparseSet.hpp"
+#include "Sort.hpp"
+#include "Threading/Thread.hpp"
+
+namespace CrossFire
+{
+
+/**
+ * @brief A point in world space, as tracked by the SpatialHashGrid.
+ */
+struct SpatialPoint {
+    f32 x, y, z;
+};
+
+/**
+ * @brief A hash grid that buckets entities by the integer cell their
+ * position falls in, for proximity queries without an O(n^2) scan.
+ * Cells are found through an open-addressing table keyed by cell coordinate
+ * and hold their entity ids in a compact array. Each entity remembers its
+ * cell and slot, so moves and removals are O(1).
+ */
+class SpatialHashGrid final {
+    static constexpr u32 NONE = std::numeric_limits<u32>::max();
+
+    // Cell coordinates are clamped to +-2^30, so that positions too far out
+    // for an i32 share the edge cells and ranges of them cannot overflow
+    static constexpr f32 COORD_LIMIT = 1073741824.0f;
+
+    struct Cell {
+        i32 x, y, z;
+        u32 count;
+        u32 capacity;
+        Entity *ids;
+    };
+
+    struct Record {
+        SpatialPoint position;
+        u32 cell;
+        u32 slot;
+    };
+
+    Allocator &allocator;
+    f32 inv_cell_size;
+    List<Cell> cells;
+    List<u32> table;
+    List<Record> records;
+    Slice<Entity> slab;
+    u32 table_shift;
+    usize entity_count = 0;
+
+    static inline auto hash(i32 x, i32 y, i32 z) -> u32
+    {
+        u64 h = static_cast<u64>(static_cast<u32>(x)) * 0x9E3779B97F4A7C15ULL;
+        h ^= static_cast<u64>(static_cast<u32>(y)) * 0xC2B2AE3D27D4EB4FULL;
+        h ^= static_cast<u64>(static_cast<u32>(z)) * 0x165667B19E3779F9ULL;
+        return static_cast<u32>(h ^ (h >> 32));
+    }
+
+    /**
+     * @brief Get the bucket of a hash.
+     * Buckets are taken from the high bits, so that keys sorted by hash
+     * fill the table front to back.
+     */
+    inline auto bucket(u32 h) const -> usize
+    {
+        return h >> table_shift;
+    }
+
+    inline auto coord(f32 v) const -> i32
+    {
+        auto c = std::floor(v * inv_cell_size);
+        if (c >= COORD_LIMIT)
+            return static_cast<i32>(COORD_LIMIT);
+        // NaN fails this too and lands in the lowest cell
+        if (!(c > -COORD_LIMIT))
+            return -static_cast<i32>(COORD_LIMIT);
+        return static_cast<i32>(c);
+    }
+
+    /**
+     * @brief Find the cell at a coordinate.
+     * @return The cell index -- or NONE.
+     */
+    inline auto find_cell(i32 x, i32 y, i32 z) const -> u32
+    {
+        auto mask = table.data.len - 1;
+        for (auto i = bucket(hash(x, y, z));; i = (i + 1) & mask) {
+            auto index = table.data.ptr[i];
+            if (index == NONE)
+                return NONE;
+
+            auto &cell = cells.data.ptr[index];
+            if (cell.x == x && cell.y == y && cell.z == z)
+                return index;
+        }
+    }
+
+    /**
+     * @brief Grow the table to at least twice the given number of cells.
+     * @return Nothing -- or an error if allocation failed.
+     */
+    auto grow_table(usize cell_count) -> ResultVoid<AllocationError>
+    {
+        auto new_len = table.data.len;
+        auto new_shift = table_shift;
+        while (new_len < cell_count * 2) {
+            new_len *= 2;
+            new_shift--;
+        }
+
+        if (new_len == table.data.len)
+            return Ok();
+
+        auto res = table.reserve(new_len);
+        if (res.is_err())
+            return res.unwrap_err();
+
+        table.data.len = new_len;
+        table_shift = new_shift;
+        for (usize i = 0; i < new_len; i++)
+            table.data.ptr[i] = NONE;
+
+        auto mask = new_len - 1;
+        for (usize c = 0; c < cells.data.len; c++) {
+            auto &cell = cells.data.ptr[c];
+            auto i = bucket(hash(cell.x, cell.y, cell.z));
+            while (table.data.ptr[i] != NONE)
+                i = (i + 1) & mask;
+            table.data.ptr[i] = static_cast<u32>(c);
+        }
+
+        return Ok();
+    }
+
+    /**
+     * @brief Find the cell at a coordinate, creating it if needed.
+     * Empty cells are kept so their arrays can be reused; rebuild() and
+     * clear() drop them.
+     * @return The cell index -- or an error if allocation failed.
+     */
+    auto get_cell(i32 x, i32 y, i32 z) -> Result<u32, AllocationError>
+    {
+        auto found = find_cell(x, y, z);
+        if (found != NONE)
+            return found;
+
+        // Keep the load factor at or below one half
+        auto grown = grow_table(cells.data.len + 1);
+        if (grown.is_err())
+            return grown.unwrap_err();
+
+        auto res = cells.push(Cell{ x, y, z, 0, 0, nullptr });
+        if (res.is_err())
+            return res.unwrap_err();
+
+        auto index = static_cast<u32>(cells.data.len - 1);
+        auto mask = table.data.len - 1;
+        auto i = bucket(hash(x, y, z));
+        while (table.data.ptr[i] != NONE)
+            i = (i + 1) & mask;
+        table.data.ptr[i] = index;
+
+        return index;
+    }
+
+    inline auto in_slab(const Cell &cell) const -> bool
+    {
+        return cell.ids >= slab.ptr && cell.ids < slab.ptr + slab.len;
+    }
+
+    auto reserve_cell(u32 index, u32 capacity) -> ResultVoid<AllocationError>
+    {
+        auto &cell = cells.data.ptr[index];
+        if (capacity <= cell.capacity)
+            return Ok();
+
+        // A cell outgrowing its range of the slab moves to its own array
+        if (cell.ids != nullptr && in_slab(cell)) {
+            auto res = allocator.alloc<Entity>(capacity);
+            if (res.is_err())
+                return res.unwrap_err();
+
+            memcpy(res.unwrap().ptr, cell.ids, cell.count * sizeof(Entity));
+            cell.ids = res.unwrap().ptr;
+            cell.capacity = capacity;
+            return Ok();
+        }
+
+        auto res = cell.ids == nullptr ?
+                       allocator.alloc<Entity>(capacity) :
+                       allocator.realloc(Slice<Entity>(cell.ids, cell.capacity),
+                                         capacity);
+        if (res.is_err())
+            return res.unwrap_err();
+
+        cell.ids = res.unwrap().ptr;
+        cell.capacity = capacity;
+        return Ok();
+    }
+
+    auto add_to_cell(u32 index, Entity entity) -> ResultVoid<AllocationError>
+    {
+        auto &cell = cells.data.ptr[index];
+        if (cell.count == cell.capacity) {
+            auto res = reserve_cell(index,
+                                    cell.capacity == 0 ? 4 : cell.capacity * 2);
+            if (res.is_err())
+                return res.unwrap_err();
+        }
+
+        auto &record = records.data.ptr[entity];
+        record.cell = index;
+        record.slot = cell.count;
+        cell.ids[cell.count++] = entity;
+        return Ok();
+    }
+
+    auto remove_from_cell(Entity entity) -> void
+    {
+        auto &record = records.data.ptr[entity];
+        auto &cell = cells.data.ptr[record.cell];
+
+        auto moved = cell.ids[--cell.count];
+        cell.ids[record.slot] = moved;
+        records.data.ptr[moved].slot = record.slot;
+        record.cell = NONE;
+    }
+
+    auto ensure_record(Entity entity) -> ResultVoid<AllocationError>
+    {
+        if (entity < records.data.len)
+            return Ok();
+
+        if (entity >= records.capacity) {
+            auto new_capacity = records.capacity * 2;
+            if (new_capacity <= entity)
+                new_capacity = static_cast<usize>(entity) + 1;
+
+            auto res = records.reserve(new_capacity);
+            if (res.is_err())
+                return res.unwrap_err();
+        }
+
+        for (usize i = records.data.len; i <= entity; i++)
+            records.data.ptr[i] = Record{ { 0, 0, 0 }, NONE, 0 };
+        records.data.len = static_cast<usize>(entity) + 1;
+        return Ok();
+    }
+
+    auto release_cells() -> void
+    {
+        for (usize c = 0; c < cells.data.len; c++) {
+            auto &cell = cells.data.ptr[c];
+            if (cell.ids != nullptr && !in_slab(cell))
+                allocator.dealloc(Slice<Entity>(cell.ids, cell.capacity));
+        }
+        cells.clear();
+
+        if (slab.ptr != nullptr) {
+            allocator.dealloc(slab);
+            slab = Slice<Entity>();
+        }
+
+        for (usize i = 0; i < table.data.len; i++)
+            table.data.ptr[i] = NONE;
+    }
+
+    /**
+     * @brief Visit every non-empty cell overlapping a range of coordinates.
+     * Probes the table per coordinate, unless the range spans more
+     * coordinates than there are cells, in which case the cells are scanned.
+     */
+    template <typename F>
+    auto for_each_cell(i32 x0, i32 y0, i32 z0, i32 x1, i32 y1, i32 z1,
+                       F &&func) -> void
+    {
+        // Each factor is checked before multiplying, so the span of a
+        // huge range cannot wrap round to a small one
+        auto limit = static_cast<u64>(cells.data.len);
+        auto dx = static_cast<u64>(static_cast<i64>(x1) - x0 + 1);
+        auto dy = static_cast<u64>(static_cast<i64>(y1) - y0 + 1);
+        auto dz = static_cast<u64>(static_cast<i64>(z1) - z0 + 1);
+        auto scan = dx > limit || dy > limit || dz > limit ||
+                    dx * dy > limit || dx * dy * dz > limit;
+
+        if (scan) {
+            for (usize c = 0; c < cells.data.len; c++) {
+                auto &cell = cells.data.ptr[c];
+                if (cell.count > 0 && cell.x >= x0 && cell.x <= x1 &&
+                    cell.y >= y0 && cell.y <= y1 && cell.z >= z0 &&
+                    cell.z <= z1)
+                    func(cell);
+            }
+            return;
+        }
+
+        for (i32 z = z0; z <= z1; z++) {
+            for (i32 y = y0; y <= y1; y++) {
+                for (i32 x = x0; x <= x1; x++) {
+                    auto index = find_cell(x, y, z);
+                    if (index != NONE && cells.data.ptr[index].count > 0)
+                        func(cells.data.ptr[index]);
+                }
+            }
+        }
+    }
+
+public:
+    /**
+     * @brief Creates a new spatial hash grid.
+     * @param allocator The allocator to use.
+     * @param cell_size The edge length of a cell in world units, ideally
+     * about the typical query radius.
+     */
+    SpatialHashGrid(Allocator &allocator, f32 cell_size)
+        : allocator(allocator)
+        , inv_cell_size(1.0f / cell_size)
+        , cells(allocator)
+        , table(allocator)
+        , records(allocator)
+        , slab()
+    {
+        cf_assert(cell_size > 0, "Cell size must be positive");
+        // The table starts at the List's initial capacity, a power of two
+        table.data.len = table.capacity;
+        table_shift = 32;
+        for (usize len = table.data.len; len > 1; len >>= 1)
+            table_shift--;
+        for (usize i = 0; i < table.data.len; i++)
+            table.data.ptr[i] = NONE;
+    }
+
+    ~SpatialHashGrid()
+    {
+        release_cells();
+    }
+
+    SpatialHashGrid(const SpatialHashGrid &other) = delete;
+    SpatialHashGrid &operator=(const SpatialHashGrid &other) = delete;
+
+    /**
+     * @brief Get the number of entities in the grid.
+     * @return The number of entities.
+     */
+    inline auto size() const -> usize
+    {
+        return entity_count;
+    }
+
+    /**
+     * @brief Check if an entity is in the grid.
+     * @param entity The entity.
+     * @return True if the entity is in the grid, false otherwise.
+     */
+    inline auto contains(Entity entity) const -> bool
+    {
+        return entity < records.data.len &&
+               records.data.ptr[entity].cell != NONE;
+    }
+
+    /**
+     * @brief Get the position of an entity.
+     * @param entity The entity, which must be in the grid.
+     * @return The position.
+     */
+    inline auto get_position(Entity entity) const -> SpatialPoint
+    {
+        cf_assert(contains(entity), "Entity is not in the grid");
+        return records.data.ptr[entity].position;
+    }
+
+    /**
+     * @brief Adds an entity to the grid, or moves it if it is already in.
+     * @param entity The entity.
+     * @param position The position.
+     * @return Nothing -- or an error if allocation failed.
+     */
+    auto insert(Entity entity, SpatialPoint position)
+        -> ResultVoid<AllocationError>
+    {
+        if (contains(entity))
+            return move(entity, position);
+
+        auto rec = ensure_record(entity);
+        if (rec.is_err())
+            return rec.unwrap_err();
+
+        auto cell = get_cell(coord(position.x), coord(position.y),
+                             coord(position.z));
+        if (cell.is_err())
+            return cell.unwrap_err();
+
+        auto res = add_to_cell(cell.unwrap(), entity);
+        if (res.is_err())
+            return res.unwrap_err();
+
+        records.data.ptr[entity].position = position;
+        entity_count++;
+        return Ok();
+    }
+
+    /**
+     * @brief Update the position of an entity.
+     * Only crossing into another cell touches the cell arrays.
+     * @param entity The entity, which must be in the grid.
+     * @param position The new position.
+     * @return Nothing -- or an error if allocation failed, in which case the
+     * entity is no longer in the grid.
+     */
+    auto move(Entity entity, SpatialPoint position)
+        -> ResultVoid<AllocationError>
+    {
+        cf_assert(contains(entity), "Entity is not in the grid");
+        auto &record = records.data.ptr[entity];
+        record.position = position;
+
+        auto x = coord(position.x);
+        auto y = coord(position.y);
+        auto z = coord(position.z);
+        auto &old = cells.data.ptr[record.cell];
+        if (old.x == x && old.y == y && old.z == z)
+            return Ok();
+
+        remove_from_cell(entity);
+
+        auto cell = get_cell(x, y, z);
+        if (cell.is_err()) {
+            entity_count--;
+            return cell.unwrap_err();
+        }
+
+        auto res = add_to_cell(cell.unwrap(), entity);
+        if (res.is_err()) {
+            entity_count--;
+            return res.unwrap_err();
+        }
+
+        return Ok();
+    }
+
+    /**
+     * @brief Removes an entity from the grid.
+     * @param entity The entity, which must be in the grid.
+     */
+    auto remove(Entity entity) -> void
+    {
+        cf_assert(contains(entity), "Entity is not in the grid");
+        remove_from_cell(entity);
+        entity_count--;
+    }
+
+    /**
+     * @brief Removes every entity and releases the cell arrays.
+     */
+    auto clear() -> void
+    {
+        release_cells();
+        for (usize i = 0; i < records.data.len; i++)
+            records.data.ptr[i].cell = NONE;
+        entity_count = 0;
+    }
+
+    /**
+     * @brief Call a function for each entity inside an axis-aligned box.
+     * @tparam F The type of the function, taking (Entity).
+     * @param min The minimum corner.
+     * @param max The maximum corner.
+     * @param func The function.
+     */
+    template <typename F>
+    auto query_aabb(SpatialPoint min, SpatialPoint max, F &&func) -> void
+    {
+        for_each_cell(coord(min.x), coord(min.y), coord(min.z), coord(max.x),
+                      coord(max.y), coord(max.z), [&](const Cell &cell) {
+                          for (u32 i = 0; i < cell.count; i++) {
+                              auto p = records.data.ptr[cell.ids[i]].position;
+                              if (p.x >= min.x && p.x <= max.x &&
+                                  p.y >= min.y && p.y <= max.y &&
+                                  p.z >= min.z && p.z <= max.z)
+                                  func(cell.ids[i]);
+                          }
+                      });
+    }
+
+    /**
+     * @brief Call a function for each entity within a distance of a point.
+     * @tparam F The type of the function, taking (Entity).
+     * @param center The center.
+     * @param radius The radius.
+     * @param func The function.
+     */
+    template <typename F>
+    auto query_radius(SpatialPoint center, f32 radius, F &&func) -> void
+    {
+        auto r2 = radius * radius;
+        for_each_cell(coord(center.x - radius), coord(center.y - radius),
+                      coord(center.z - radius), coord(center.x + radius),
+                      coord(center.y + radius), coord(center.z + radius),
+                      [&](const Cell &cell) {
+                          for (u32 i = 0; i < cell.count; i++) {
+                              auto p = records.data.ptr[cell.ids[i]].position;
+                              auto dx = p.x - center.x;
+                              auto dy = p.y - center.y;
+                              auto dz = p.z - center.z;
+                              if (dx * dx + dy * dy + dz * dz <= r2)
+                                  func(cell.ids[i]);
+                          }
+                      });
+    }
+
+    /**
+     * @brief Replace the contents of the grid with a batch of entities.
+     * Cell keys are computed (in parallel when a pool is given) and the
+     * entities are radix sorted by key, so every cell is filled in one
+     * contiguous run instead of by scattered inserts.
+     * An entity listed more than once is inserted once.
+     * When a pool is given the calling thread runs pool tasks while it
+     * waits, so it may be one of the pool's workers.
+     * @param entities The entities.
+     * @param positions The positions, parallel to entities.
+     * @param pool The pool to compute keys and sort on -- or nullptr.
+     * @return Nothing -- or an error if allocation failed.
+     */
+    auto rebuild(Slice<Entity> entities, Slice<SpatialPoint> positions,
+                 ThreadPool *pool = nullptr) -> ResultVoid<AllocationError>
+    {
+        cf_assert(entities.len == positions.len,
+                  "Entities and positions differ in length");
+        clear();
+
+        auto n = entities.len;
+        if (n == 0)
+            return Ok();
+
+        auto key_res = allocator.alloc<u32>(n);
+        if (key_res.is_err())
+            return key_res.unwrap_err();
+        auto keys = key_res.unwrap();
+
+        auto order_res = allocator.alloc<u32>(n);
+        if (order_res.is_err()) {
+            allocator.dealloc(keys);
+            return order_res.unwrap_err();
+        }
+        auto order = order_res.unwrap();
+
+        auto compute = [&](usize begin, usize end) {
+            for (usize i = begin; i < end; i++) {
+                auto p = positions.ptr[i];
+                keys.ptr[i] = hash(coord(p.x), coord(p.y), coord(p.z));
+                order.ptr[i] = static_cast<u32>(i);
+            }
+        };
+
+        ResultVoid<AllocationError> result = Ok();
+        if (pool != nullptr && pool->size() > 1 &&
+            n >= detail::RADIX_MIN_CHUNK) {
+            auto chunks = pool->size();
+            if (chunks > detail::RADIX_MAX_CHUNKS)
+                chunks = detail::RADIX_MAX_CHUNKS;
+
+            Array<TaskHandle, detail::RADIX_MAX_CHUNKS> handles;
+            for (usize c = 0; c < chunks; c++) {
+                auto begin = n * c / chunks;
+                auto end = n * (c + 1) / chunks;
+                handles[c] = pool->submit(
+                    [&compute, begin, end] { compute(begin, end); });
+            }
+            for (usize c = 0; c < chunks; c++)
+                pool->wait(handles[c]);
+
+            result = parallel_radix_sort_pairs(keys, order, allocator, *pool);
+        } else {
+            compute(0, n);
+            result = radix_sort_pairs(keys, order, allocator);
+        }
+
+        // Size the table once for every distinct key
+        usize distinct = result.is_ok() ? 1 : 0;
+        for (usize i = 1; i < n && result.is_ok(); i++)
+            distinct += keys.ptr[i] != keys.ptr[i - 1];
+        if (result.is_ok())
+            result = grow_table(distinct);
+
+        if (result.is_ok()) {
+            auto slab_res = allocator.alloc<Entity>(n);
+            if (slab_res.is_ok())
+                slab = slab_res.unwrap();
+            else
+                result = slab_res.unwrap_err();
+        }
+        usize cursor = 0;
+
+        // Entities of one cell are now adjacent, so the last cell is cached
+        u32 last = NONE;
+        i32 lx = 0, ly = 0, lz = 0;
+        for (usize i = 0; i < n && result.is_ok(); i++) {
+            auto index = order.ptr[i];
+            auto entity = entities.ptr[index];
+            auto p = positions.ptr[index];
+            auto x = coord(p.x);
+            auto y = coord(p.y);
+            auto z = coord(p.z);
+
+            result = ensure_record(entity);
+            if (result.is_err() || contains(entity))
+                continue;
+
+            if (last == NONE || x != lx || y != ly || z != lz) {
+                auto found = get_cell(x, y, z);
+                if (found.is_err()) {
+                    result = found.unwrap_err();
+                    continue;
+                }
+                last = found.unwrap();
+                lx = x;
+                ly = y;
+                lz = z;
+
+                // Give a new cell the slab range of its run of equal keys
+                auto &cell = cells.data.ptr[last];
+                auto run = i + 1;
+                while (run < n && keys.ptr[run] == keys.ptr[i])
+                    run++;
+                if (cell.ids == nullptr && cursor + (run - i) <= slab.len) {
+                    cell.ids = slab.ptr + cursor;
+                    cell.capacity = static_cast<u32>(run - i);
+                    cursor += run - i;
+                }
+            }
+
+            result = add_to_cell(last, entity);
+            if (result.is_ok()) {
+                records.data.ptr[entity].position = p;
+                entity_count++;
+            }
+        }
+
+        allocator.dealloc(order);
+        allocator.dealloc(keys);
+        return result;
+    }
+};
+
+}
\ No newline at end of file
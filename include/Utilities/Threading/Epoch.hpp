@@ -0,0 +1,290 @@
+#pragma once
+#include <atomic>
+#include "../Types.hpp"
+#include "../Allocator.hpp"
+#include "../List.hpp"
+
+namespace CrossFire
+{
+
+namespace detail
+{
+
+/**
+ * @brief An object waiting for its grace period before being freed.
+ */
+struct Retired {
+    void *ptr;
+    usize size;
+    Allocator *allocator;
+    void (*destroy)(void *ptr, usize count);
+};
+
+/**
+ * @brief A thread's entry in the epoch domain. Records outlive their
+ * threads and are handed to new threads, along with whatever they still
+ * have retired.
+ */
+struct alignas(64) EpochRecord {
+    // (epoch << 1) | 1 while the thread is pinned, 0 otherwise
+    std::atomic<u64> state;
+    std::atomic<bool> in_use;
+    EpochRecord *next;
+    u32 nesting;
+    u32 since_collect;
+
+    // Objects retired in each of the last three epochs; ones a hazard
+    // pointer held when their grace period ended stay behind
+    u64 tags[3];
+    List<Retired> bags[3];
+
+    EpochRecord();
+};
+
+/**
+ * @brief A published hazard pointer.
+ */
+struct alignas(64) HazardSlot {
+    std::atomic<void *> ptr;
+    std::atomic<bool> in_use;
+    HazardSlot *next;
+};
+
+inline auto epoch_record() -> EpochRecord *&
+{
+    static thread_local EpochRecord *record = nullptr;
+    return record;
+}
+
+}
+
+/**
+ * @brief Epoch-based reclamation for lock-free structures: frees nodes
+ * only once no thread can still be reading them.
+ * A thread pins the current epoch with an EpochGuard before it reads
+ * shared nodes, and unpins when done. A node unlinked from a structure is
+ * retired rather than freed; once the global epoch has moved on twice,
+ * every thread that could have seen it has unpinned, and it is destroyed
+ * and handed back to its allocator. The epoch only moves while every
+ * pinned thread has caught up with it, so guards must be short.
+ * A reference that has to outlive a guard, such as a node a thread works
+ * on for a while, is held with a HazardPointer instead; retired nodes a
+ * hazard pointer holds are kept until it lets go.
+ * Each thread collects its own retired nodes in batches, so retiring is
+ * cheap on average and never waits for other threads.
+ */
+class EpochDomain final {
+    using Retired = detail::Retired;
+
+    std::atomic<u64> epoch;
+    std::atomic<detail::EpochRecord *> records;
+    std::atomic<detail::HazardSlot *> hazards;
+
+    EpochDomain();
+
+    // Collect after this many retirements on a thread
+    static constexpr u32 COLLECT_INTERVAL = 64;
+
+    auto claim() -> detail::EpochRecord *;
+    auto try_advance() -> bool;
+    auto held(List<void *> &ptrs) -> ResultVoid<AllocationError>;
+    auto reclaim(List<Retired> &bag, List<void *> &held_ptrs) -> void;
+    auto defer(const Retired &retired) -> ResultVoid<AllocationError>;
+
+    inline auto record() -> detail::EpochRecord &
+    {
+        auto &current = detail::epoch_record();
+        if (current == nullptr)
+            current = claim();
+        return *current;
+    }
+
+    friend class HazardPointer;
+
+public:
+    /**
+     * @brief Get the domain, creating it on first use.
+     * @return The domain.
+     */
+    static auto get() -> EpochDomain &;
+
+    EpochDomain(const EpochDomain &other) = delete;
+    EpochDomain &operator=(const EpochDomain &other) = delete;
+
+    /**
+     * @brief Pin the calling thread to the current epoch. Nests.
+     * Prefer EpochGuard.
+     */
+    inline auto enter() -> void
+    {
+        auto &rec = record();
+        if (rec.nesting++ > 0)
+            return;
+
+        // Recheck after publishing, so the epoch cannot have moved on
+        // before this thread became visible to try_advance()
+        auto e = epoch.load(std::memory_order_relaxed);
+        for (;;) {
+            rec.state.store((e << 1) | 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto now = epoch.load(std::memory_order_relaxed);
+            if (now == e)
+                return;
+            e = now;
+        }
+    }
+
+    /**
+     * @brief Unpin the calling thread.
+     */
+    inline auto exit() -> void
+    {
+        auto &rec = record();
+        cf_assert(rec.nesting > 0, "EpochDomain exit without enter");
+        if (--rec.nesting == 0)
+            rec.state.store(0, std::memory_order_release);
+    }
+
+    /**
+     * @brief Destroy an object and free it with its allocator once no
+     * thread can be reading it. Call after unlinking it, pinned or not.
+     * @param ptr The object, created with allocator.create().
+     * @param allocator The allocator it came from.
+     * @return Nothing -- or an error if allocation failed, in which case
+     * the object was not retired.
+     */
+    template <typename T>
+    auto retire(T *ptr, Allocator &allocator) -> ResultVoid<AllocationError>
+    {
+        return defer(Retired{ ptr, sizeof(T), &allocator, [](void *p, usize) {
+                                 static_cast<T *>(p)->~T();
+                             } });
+    }
+
+    /**
+     * @brief Destroy an array and free it with its allocator once no
+     * thread can be reading it.
+     * @param slice The array, from allocator.alloc().
+     * @param allocator The allocator it came from.
+     * @return Nothing -- or an error if allocation failed, in which case
+     * the array was not retired.
+     */
+    template <typename T>
+    auto retire(Slice<T> slice, Allocator &allocator)
+        -> ResultVoid<AllocationError>
+    {
+        return defer(Retired{ slice.ptr, sizeof(T) * slice.len, &allocator,
+                              [](void *p, usize size) {
+                                  auto items = static_cast<T *>(p);
+                                  for (usize i = 0; i < size / sizeof(T); i++)
+                                      items[i].~T();
+                              } });
+    }
+
+    /**
+     * @brief Try to move the epoch on and free the calling thread's retired
+     * objects whose grace period has passed.
+     */
+    auto collect() -> void;
+
+    /**
+     * @brief Wait until every object retired so far may be freed, and free
+     * the calling thread's. Must not be called while pinned.
+     */
+    auto synchronize() -> void;
+
+    /**
+     * @brief Get the number of objects the calling thread has retired and
+     * not yet freed.
+     * @return The number of objects.
+     */
+    auto pending() -> usize;
+
+    /**
+     * @brief Get the global epoch.
+     * @return The epoch.
+     */
+    inline auto get_epoch() const -> u64
+    {
+        return epoch.load(std::memory_order_acquire);
+    }
+};
+
+/**
+ * @brief A guard using RAII that pins the calling thread to the epoch.
+ */
+class EpochGuard {
+    EpochDomain &domain;
+
+public:
+    explicit EpochGuard(EpochDomain &domain = EpochDomain::get())
+        : domain(domain)
+    {
+        domain.enter();
+    }
+    ~EpochGuard()
+    {
+        domain.exit();
+    }
+
+    EpochGuard(const EpochGuard &other) = delete;
+    EpochGuard &operator=(const EpochGuard &other) = delete;
+};
+
+/**
+ * @brief A hazard pointer: keeps one retired object alive for as long as
+ * it points at it, without pinning the epoch.
+ * Slots are kept for reuse, so creating one only allocates the first time
+ * a slot is needed.
+ */
+class HazardPointer {
+    detail::HazardSlot *slot;
+
+public:
+    HazardPointer();
+    ~HazardPointer();
+
+    HazardPointer(const HazardPointer &other) = delete;
+    HazardPointer &operator=(const HazardPointer &other) = delete;
+
+    /**
+     * @brief Load a pointer and protect what it points to. Works inside or
+     * outside an EpochGuard.
+     * @param source The pointer to load.
+     * @return The protected pointer, possibly nullptr.
+     */
+    template <typename T> auto protect(const std::atomic<T *> &source) -> T *
+    {
+        auto ptr = source.load(std::memory_order_relaxed);
+        for (;;) {
+            slot->ptr.store(ptr, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            // Still linked after publishing, so not yet retired
+            auto now = source.load(std::memory_order_acquire);
+            if (now == ptr)
+                return ptr;
+            ptr = now;
+        }
+    }
+
+    /**
+     * @brief Protect a pointer already safe to read, e.g. one loaded inside
+     * an EpochGuard that is still held.
+     * @param ptr The pointer.
+     */
+    inline auto protect(void *ptr) -> void
+    {
+        slot->ptr.store(ptr, std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief Stop protecting the object.
+     */
+    inline auto reset() -> void
+    {
+        slot->ptr.store(nullptr, std::memory_order_release);
+    }
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,135 @@
+#pragma once
+#include <atomic>
+#include "../Types.hpp"
+#include "Futex.hpp"
+
+#if !defined(CF_FUTEX)
+#include <condition_variable>
+#include <mutex>
+#endif
+
+namespace CrossFire
+{
+
+/**
+ * @brief An event count: lets threads sleep until some condition they
+ * check themselves may have changed, without a lock around the condition.
+ * A waiter announces itself with prepare_wait(), checks the condition, and
+ * then either cancels or commits to sleeping; a notifier changes the
+ * condition first and then calls notify(). Any notify after
+ * prepare_wait() ends the wait, so no wakeup is lost. notify() only makes
+ * a syscall when a thread has announced itself, so notifying costs a
+ * fence and a load while every waiter is awake.
+ * Sleeps on a futex on Linux, and on a condition variable elsewhere.
+ */
+class EventCount {
+public:
+    using Key = u32;
+
+    EventCount()
+        : epoch(0)
+        , waiters(0)
+    {
+    }
+
+    EventCount(const EventCount &other) = delete;
+    EventCount &operator=(const EventCount &other) = delete;
+
+    /**
+     * @brief Announce that the caller is about to sleep. The caller must
+     * check its condition after this, then call cancel_wait() or
+     * commit_wait().
+     * @return The key to pass to commit_wait().
+     */
+    inline auto prepare_wait() -> Key
+    {
+        waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return epoch.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Withdraw a prepare_wait(), as the condition already holds.
+     */
+    inline auto cancel_wait() -> void
+    {
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Sleep until a notify after the matching prepare_wait().
+     * @param key The key from prepare_wait().
+     */
+    auto commit_wait(Key key) -> void
+    {
+#if defined(CF_FUTEX)
+        while (epoch.load(std::memory_order_acquire) == key)
+            detail::futex_wait(epoch, key);
+#else
+        std::unique_lock<std::mutex> lock(mutex);
+        while (epoch.load(std::memory_order_acquire) == key)
+            condition.wait(lock);
+#endif
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Wake one waiting thread, if any.
+     * @return True if a thread was waiting, false otherwise.
+     */
+    inline auto notify() -> bool
+    {
+        if (!has_waiters())
+            return false;
+
+        advance(false);
+        return true;
+    }
+
+    /**
+     * @brief Wake every waiting thread.
+     */
+    inline auto notify_all() -> void
+    {
+        if (has_waiters())
+            advance(true);
+    }
+
+private:
+    std::atomic<u32> epoch;
+    std::atomic<u32> waiters;
+#if !defined(CF_FUTEX)
+    std::mutex mutex;
+    std::condition_variable condition;
+#endif
+
+    inline auto has_waiters() const -> bool
+    {
+        // Pairs with prepare_wait(): either the waiter sees the change to
+        // its condition, or this sees the waiter
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return waiters.load(std::memory_order_relaxed) != 0;
+    }
+
+    auto advance(bool all) -> void
+    {
+#if defined(CF_FUTEX)
+        epoch.fetch_add(1, std::memory_order_release);
+        if (all)
+            detail::futex_wake_all(epoch);
+        else
+            detail::futex_wake(epoch, 1);
+#else
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            epoch.fetch_add(1, std::memory_order_release);
+        }
+        if (all)
+            condition.notify_all();
+        else
+            condition.notify_one();
+#endif
+    }
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,674 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "../Types.hpp"
+#include "../Allocator.hpp"
+#include "../List.hpp"
+#include "SpinLock.hpp"
+#include "EventCount.hpp"
+#include "ObjectPool.hpp"
+#include "Task.hpp"
+#include "Topology.hpp"
+#include "WorkStealingDeque.hpp"
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define CF_FIBER_ASM 1
+#elif !defined(_WIN32) && defined(__has_include)
+#if __has_include(<ucontext.h>)
+#define CF_FIBER_UCONTEXT 1
+#include <ucontext.h>
+#endif
+#endif
+
+#if defined(CF_FIBER_ASM) || defined(CF_FIBER_UCONTEXT)
+#define CF_FIBERS 1
+#endif
+
+namespace CrossFire
+{
+
+namespace detail
+{
+
+/**
+ * @brief The saved registers of a suspended fiber or scheduler.
+ */
+struct FiberContext {
+#if defined(CF_FIBER_ASM)
+    void *sp = nullptr;
+#elif defined(CF_FIBER_UCONTEXT)
+    ucontext_t context;
+    void (*entry)(void *) = nullptr;
+    void *arg = nullptr;
+#endif
+};
+
+/**
+ * @brief Prepare a context that calls entry(arg) on the given stack when it
+ * is first switched to. The entry function must never return.
+ */
+auto fiber_make(FiberContext &context, Slice<u8> stack, void (*entry)(void *),
+                void *arg) -> void;
+
+/**
+ * @brief Save the running context into from and resume to.
+ */
+auto fiber_switch(FiberContext &from, FiberContext &to) -> void;
+
+/**
+ * @brief The job system worker running on this thread, if any.
+ */
+auto fiber_worker_slot() -> void *&;
+
+struct Fiber;
+
+/**
+ * @brief A fiber or thread waiting for a JobCounter to drop to a target.
+ */
+struct JobWaiter {
+    u64 target;
+    Fiber *fiber;
+    std::atomic<bool> *flag;
+    JobWaiter *next;
+};
+
+}
+
+#if defined(CF_FIBERS)
+
+class JobSystem;
+
+/**
+ * @brief Counts unfinished jobs; JobSystem::wait() suspends until it drops
+ * to a target. Waiters register only while the count is too high, so
+ * finishing a job costs one atomic decrement when nobody waits.
+ */
+class JobCounter {
+    // Set while the waiter list is not empty
+    static constexpr u64 WAITERS = 1ULL << 63;
+
+    // Completers still using the counter, counted from bit 48 up; the
+    // count of unfinished jobs takes the bits below
+    static constexpr u64 COMPLETER = 1ULL << 48;
+    static constexpr u64 COMPLETERS = WAITERS - COMPLETER;
+    static constexpr u64 COUNT = COMPLETER - 1;
+
+    std::atomic<u64> state;
+    SpinLock lock;
+    detail::JobWaiter *waiters;
+
+    friend class JobSystem;
+
+public:
+    JobCounter()
+        : state(0)
+        , waiters(nullptr)
+    {
+    }
+
+    JobCounter(const JobCounter &other) = delete;
+    JobCounter &operator=(const JobCounter &other) = delete;
+
+    /**
+     * @brief Get the number of unfinished jobs.
+     * @return The count.
+     */
+    inline auto get() const -> u64
+    {
+        return state.load(std::memory_order_acquire) & COUNT;
+    }
+};
+
+namespace detail
+{
+
+struct Fiber {
+    FiberContext context;
+    Slice<u8> stack;
+    Task *task;
+    JobWaiter *waiter;
+    JobCounter *counter;
+    void *worker;
+    JobSystem *system;
+    Fiber *next;
+};
+
+/**
+ * @brief Allocate a fiber stack with a guard page below it, so that a fiber
+ * overflowing its stack faults instead of overwriting the memory below.
+ * Where the allocator's memory cannot be protected the stack has no guard.
+ * @param allocator The allocator to use.
+ * @param size The usable size in bytes, rounded up to whole pages.
+ * @return The usable stack, above the guard page -- or an error.
+ */
+auto fiber_stack_alloc(Allocator &allocator, usize size)
+    -> Result<Slice<u8>, AllocationError>;
+
+/**
+ * @brief Free a stack from fiber_stack_alloc().
+ * @param allocator The allocator it came from.
+ * @param stack The usable stack.
+ */
+auto fiber_stack_free(Allocator &allocator, Slice<u8> stack) -> void;
+
+}
+
+/**
+ * @brief A job system that runs jobs on fibers, so that a job waiting on a
+ * JobCounter suspends its fiber and the worker thread moves on to other
+ * jobs instead of blocking.
+ * Jobs are pooled tasks with inline closure storage, queued on per-worker
+ * work-stealing deques. Fibers and their stacks come from the allocator
+ * given at construction, and are reused once their job is done; the pool
+ * grows when every fiber is busy or waiting. If the allocator fails, the job
+ * goes back on the queue until a fiber is free. Jobs must not throw and must
+ * fit in the fiber stack size; each stack has a guard page below it, so an
+ * overflow faults rather than corrupting memory.
+ */
+class JobSystem {
+    enum class After {
+        None,
+        Done,
+        Wait,
+    };
+
+    struct Worker {
+        WorkStealingDeque<detail::Task *> deque;
+        detail::FiberContext context;
+        detail::Fiber *current;
+        JobSystem *system;
+        After after;
+        u32 seed;
+
+        Worker(JobSystem *system, u32 seed)
+            : deque(c_allocator)
+            , current(nullptr)
+            , system(system)
+            , after(After::None)
+            , seed(seed)
+        {
+        }
+    };
+
+    Allocator &allocator;
+    usize stack_size;
+    ObjectPool<detail::Task> task_pool;
+
+    SpinLock fiber_lock;
+    detail::Fiber *free_fibers;
+    List<detail::Fiber *> fibers;
+
+    SpinLock ready_lock;
+    detail::Fiber *ready_head;
+    detail::Fiber *ready_tail;
+    std::atomic<usize> ready_count;
+
+    SpinLock inject_lock;
+    detail::Task *inject_head;
+    detail::Task *inject_tail;
+    std::atomic<usize> injected_count;
+
+    std::vector<std::unique_ptr<Worker> > workers;
+    std::vector<std::thread> threads;
+    EventCount idle;
+    std::atomic<bool> stop;
+    bool spin;
+
+    static auto fiber_main(void *arg) -> void
+    {
+        auto fiber = static_cast<detail::Fiber *>(arg);
+        for (;;) {
+            auto task = fiber->task;
+            task->run();
+
+            // The job may have waited and moved to another worker
+            auto worker = static_cast<Worker *>(fiber->worker);
+            fiber->system->task_pool.release(task);
+            worker->after = After::Done;
+            detail::fiber_switch(fiber->context, worker->context);
+        }
+    }
+
+    auto acquire_fiber() -> Result<detail::Fiber *, AllocationError>
+    {
+        LockGuard<SpinLock> guard(fiber_lock);
+        if (free_fibers != nullptr) {
+            auto fiber = free_fibers;
+            free_fibers = fiber->next;
+            return fiber;
+        }
+
+        auto memory = allocator.alloc<detail::Fiber>(1);
+        if (memory.is_err())
+            return memory.unwrap_err();
+
+        auto stack = detail::fiber_stack_alloc(allocator, stack_size);
+        if (stack.is_err()) {
+            allocator.dealloc(memory.unwrap());
+            return stack.unwrap_err();
+        }
+
+        auto fiber = new (memory.unwrap().ptr) detail::Fiber();
+        fiber->stack = stack.unwrap();
+        fiber->system = this;
+        auto res = fibers.push(fiber);
+        if (res.is_err()) {
+            detail::fiber_stack_free(allocator, fiber->stack);
+            allocator.dealloc(memory.unwrap());
+            return res.unwrap_err();
+        }
+
+        detail::fiber_make(fiber->context, fiber->stack, fiber_main, fiber);
+        return fiber;
+    }
+
+    auto release_fiber(detail::Fiber *fiber) -> void
+    {
+        LockGuard<SpinLock> guard(fiber_lock);
+        fiber->next = free_fibers;
+        free_fibers = fiber;
+    }
+
+    auto make_ready(detail::Fiber *fiber) -> void
+    {
+        {
+            LockGuard<SpinLock> guard(ready_lock);
+            fiber->next = nullptr;
+            if (ready_tail != nullptr)
+                ready_tail->next = fiber;
+            else
+                ready_head = fiber;
+            ready_tail = fiber;
+            ready_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        notify();
+    }
+
+    auto pop_ready() -> detail::Fiber *
+    {
+        if (ready_count.load(std::memory_order_relaxed) == 0)
+            return nullptr;
+
+        LockGuard<SpinLock> guard(ready_lock);
+        auto fiber = ready_head;
+        if (fiber != nullptr) {
+            ready_head = fiber->next;
+            if (ready_head == nullptr)
+                ready_tail = nullptr;
+            ready_count.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return fiber;
+    }
+
+    auto pop_injected() -> detail::Task *
+    {
+        if (injected_count.load(std::memory_order_relaxed) == 0)
+            return nullptr;
+
+        LockGuard<SpinLock> guard(inject_lock);
+        auto task = inject_head;
+        if (task != nullptr) {
+            inject_head = task->next;
+            if (inject_head == nullptr)
+                inject_tail = nullptr;
+            injected_count.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return task;
+    }
+
+    auto find_task(Worker &self) -> detail::Task *
+    {
+        if (auto task = self.deque.pop())
+            return *task;
+
+        if (auto task = pop_injected())
+            return task;
+
+        self.seed ^= self.seed << 13;
+        self.seed ^= self.seed >> 17;
+        self.seed ^= self.seed << 5;
+
+        auto count = workers.size();
+        auto start = self.seed % count;
+        for (usize i = 0; i < count; i++) {
+            auto &victim = *workers[(start + i) % count];
+            if (&victim == &self)
+                continue;
+
+            if (auto task = victim.deque.steal())
+                return *task;
+        }
+        return nullptr;
+    }
+
+    auto push_task(detail::Task *task) -> void
+    {
+        auto worker = static_cast<Worker *>(detail::fiber_worker_slot());
+        if (worker == nullptr || worker->system != this ||
+            worker->deque.push(task).is_err()) {
+            LockGuard<SpinLock> guard(inject_lock);
+            task->next = nullptr;
+            if (inject_tail != nullptr)
+                inject_tail->next = task;
+            else
+                inject_head = task;
+            inject_tail = task;
+            injected_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        notify();
+    }
+
+    auto notify() -> void
+    {
+        idle.notify();
+    }
+
+    auto has_work() const -> bool
+    {
+        if (ready_count.load(std::memory_order_relaxed) > 0 ||
+            injected_count.load(std::memory_order_relaxed) > 0)
+            return true;
+
+        for (auto &worker : workers) {
+            if (!worker->deque.empty())
+                return true;
+        }
+        return false;
+    }
+
+    auto park() -> bool
+    {
+        detail::Backoff backoff;
+        while (spin && backoff.spinning()) {
+            if (has_work())
+                return true;
+            backoff.pause();
+        }
+
+        auto key = idle.prepare_wait();
+        if (has_work()) {
+            idle.cancel_wait();
+            return true;
+        }
+        if (stop) {
+            idle.cancel_wait();
+            return false;
+        }
+
+        idle.commit_wait(key);
+        return true;
+    }
+
+    /**
+     * @brief Add a waiter to a counter, unless the counter is already low
+     * enough.
+     * @return True if the waiter was added, false otherwise.
+     */
+    static auto add_waiter(JobCounter &counter, detail::JobWaiter *waiter)
+        -> bool
+    {
+        LockGuard<SpinLock> guard(counter.lock);
+        auto state = counter.state.fetch_or(JobCounter::WAITERS,
+                                            std::memory_order_seq_cst);
+        if ((state & JobCounter::COUNT) <= waiter->target) {
+            if (counter.waiters == nullptr)
+                counter.state.fetch_and(~JobCounter::WAITERS,
+                                        std::memory_order_relaxed);
+            return false;
+        }
+
+        waiter->next = counter.waiters;
+        counter.waiters = waiter;
+        return true;
+    }
+
+    /**
+     * @brief Count a job of a counter as done, and resume the waiters it
+     * satisfies. A completer that finds waiters counts itself in the state
+     * until it is done with the counter, and wait() does not return before
+     * that count is zero, so the counter outlives every use here.
+     */
+    static auto complete(JobCounter &counter) -> void
+    {
+        auto state = counter.state.load(std::memory_order_relaxed);
+        for (;;) {
+            auto next = state - 1;
+            if ((state & JobCounter::WAITERS) != 0)
+                next += JobCounter::COMPLETER;
+            if (counter.state.compare_exchange_weak(state, next,
+                                                    std::memory_order_seq_cst,
+                                                    std::memory_order_relaxed))
+                break;
+        }
+        if ((state & JobCounter::WAITERS) == 0)
+            return;
+
+        detail::JobWaiter *woken = nullptr;
+        {
+            LockGuard<SpinLock> guard(counter.lock);
+            auto value = counter.state.load(std::memory_order_relaxed) &
+                         JobCounter::COUNT;
+
+            auto link = &counter.waiters;
+            while (*link != nullptr) {
+                auto waiter = *link;
+                if (value <= waiter->target) {
+                    *link = waiter->next;
+                    waiter->next = woken;
+                    woken = waiter;
+                } else {
+                    link = &waiter->next;
+                }
+            }
+
+            if (counter.waiters == nullptr)
+                counter.state.fetch_and(~JobCounter::WAITERS,
+                                        std::memory_order_relaxed);
+        }
+
+        // The last use of the counter; the waiters are not resumed yet, so
+        // none can have returned
+        counter.state.fetch_sub(JobCounter::COMPLETER,
+                                std::memory_order_release);
+
+        while (woken != nullptr) {
+            auto waiter = woken;
+            woken = waiter->next;
+            if (waiter->fiber != nullptr)
+                waiter->fiber->system->make_ready(waiter->fiber);
+            else
+                waiter->flag->store(true, std::memory_order_release);
+        }
+    }
+
+    /**
+     * @brief Wait for completers still using a counter to be done with it.
+     * They only hold it for a few instructions, without blocking.
+     */
+    static auto settle(JobCounter &counter) -> void
+    {
+        while ((counter.state.load(std::memory_order_acquire) &
+                JobCounter::COMPLETERS) != 0)
+            std::this_thread::yield();
+    }
+
+    auto run_worker(usize index) -> void
+    {
+        auto &self = *workers[index];
+        detail::fiber_worker_slot() = &self;
+
+        for (;;) {
+            auto fiber = pop_ready();
+            if (fiber == nullptr) {
+                auto task = find_task(self);
+                if (task != nullptr) {
+                    auto res = acquire_fiber();
+                    if (res.is_err()) {
+                        // Queue the job again; ready fibers run first, and
+                        // free theirs once done
+                        push_task(task);
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    fiber = res.unwrap();
+                    fiber->task = task;
+                }
+            }
+
+            if (fiber == nullptr) {
+                if (!park())
+                    break;
+                continue;
+            }
+
+            fiber->worker = &self;
+            self.current = fiber;
+            self.after = After::None;
+            detail::fiber_switch(self.context, fiber->context);
+            self.current = nullptr;
+
+            // Only now is the fiber off its stack, so it can be handed on
+            if (self.after == After::Done) {
+                release_fiber(fiber);
+            } else if (self.after == After::Wait) {
+                if (!add_waiter(*fiber->counter, fiber->waiter))
+                    make_ready(fiber);
+            }
+        }
+
+        detail::fiber_worker_slot() = nullptr;
+    }
+
+public:
+    /**
+     * @brief Creates a new job system and starts its workers.
+     * @param allocator The allocator for fibers and their stacks, used from
+     * the worker threads under a lock.
+     * @param num_threads The number of worker threads.
+     * @param stack_size The stack size of each fiber in bytes.
+     */
+    JobSystem(Allocator &allocator, usize num_threads,
+              usize stack_size = 64 * 1024)
+        : allocator(allocator)
+        , stack_size(stack_size)
+        , task_pool(c_allocator)
+        , free_fibers(nullptr)
+        , fibers(allocator)
+        , ready_head(nullptr)
+        , ready_tail(nullptr)
+        , ready_count(0)
+        , inject_head(nullptr)
+        , inject_tail(nullptr)
+        , injected_count(0)
+        , stop(false)
+        , spin(num_threads < CpuTopology::get().cpu_count())
+    {
+        for (usize i = 0; i < num_threads; i++) {
+            auto seed = static_cast<u32>(i) * 2654435761U + 1;
+            workers.emplace_back(std::make_unique<Worker>(this, seed));
+        }
+
+        for (usize i = 0; i < num_threads; i++)
+            threads.emplace_back([this, i] { run_worker(i); });
+    }
+
+    /**
+     * @brief Finishes every queued job and stops the workers. No job may
+     * still be waiting.
+     */
+    ~JobSystem()
+    {
+        stop = true;
+        idle.notify_all();
+        for (auto &thread : threads)
+            thread.join();
+
+        for (usize i = 0; i < fibers.data.len; i++) {
+            auto fiber = fibers.data.ptr[i];
+            detail::fiber_stack_free(allocator, fiber->stack);
+            allocator.dealloc(Slice<detail::Fiber>(fiber, 1));
+        }
+    }
+
+    JobSystem(const JobSystem &other) = delete;
+    JobSystem &operator=(const JobSystem &other) = delete;
+
+    /**
+     * @brief Get the number of worker threads.
+     * @return The number of workers.
+     */
+    inline auto size() const -> usize
+    {
+        return threads.size();
+    }
+
+    /**
+     * @brief Run a job.
+     * Closures of up to 32 bytes are stored inline, so this does not
+     * allocate.
+     * @tparam F The type of the job.
+     * @param f The job.
+     * @param counter The counter to count the job on -- or nullptr.
+     */
+    template <typename F>
+    auto run(F &&f, JobCounter *counter = nullptr) -> void
+    {
+        auto task = task_pool.acquire().unwrap();
+        if (counter != nullptr) {
+            counter->state.fetch_add(1, std::memory_order_relaxed);
+            task->bind([job = std::forward<F>(f), counter]() mutable {
+                job();
+                complete(*counter);
+            });
+        } else {
+            task->bind(std::forward<F>(f));
+        }
+        task->completion = nullptr;
+        push_task(task);
+    }
+
+    /**
+     * @brief Wait until a counter drops to a target.
+     * Inside a job this suspends the job's fiber, and the worker runs other
+     * jobs until the counter is low enough; the job may resume on another
+     * worker. Elsewhere the calling thread yields until then.
+     * Once this returns, no finished job still uses the counter, so it may
+     * be destroyed if no more jobs count on it.
+     * @param counter The counter.
+     * @param target The count to wait for.
+     */
+    auto wait(JobCounter &counter, u64 target = 0) -> void
+    {
+        if (counter.get() <= target) {
+            settle(counter);
+            return;
+        }
+
+        auto worker = static_cast<Worker *>(detail::fiber_worker_slot());
+        if (worker != nullptr && worker->system == this &&
+            worker->current != nullptr) {
+            auto fiber = worker->current;
+            detail::JobWaiter waiter{ target, fiber, nullptr, nullptr };
+            fiber->waiter = &waiter;
+            fiber->counter = &counter;
+            worker->after = After::Wait;
+            detail::fiber_switch(fiber->context, worker->context);
+            settle(counter);
+            return;
+        }
+
+        std::atomic<bool> flag(false);
+        detail::JobWaiter waiter{ target, nullptr, &flag, nullptr };
+        if (add_waiter(counter, &waiter)) {
+            while (!flag.load(std::memory_order_acquire))
+                std::this_thread::yield();
+        }
+        settle(counter);
+    }
+};
+
+#endif
+
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#pragma once
+#include <atomic>
+#include "../Types.hpp"
+
+#if defined(__linux__)
+#define CF_FUTEX 1
+#endif
+
+namespace CrossFire
+{
+
+namespace detail
+{
+
+/**
+ * @brief Sleep while a word holds an expected value.
+ * May return early or spuriously, so callers recheck the word in a loop.
+ * Where there is no futex this only yields the thread.
+ * @param word The word to wait on.
+ * @param expected The value to sleep on.
+ */
+auto futex_wait(std::atomic<u32> &word, u32 expected) -> void;
+
+/**
+ * @brief Wake threads sleeping in futex_wait() on a word.
+ * @param word The word.
+ * @param count The most threads to wake.
+ */
+auto futex_wake(std::atomic<u32> &word, u32 count) -> void;
+
+/**
+ * @brief Wake every thread sleeping in futex_wait() on a word.
+ * @param word The word.
+ */
+auto futex_wake_all(std::atomic<u32> &word) -> void;
+
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,218 @@
+#pragma once
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include "../Types.hpp"
+#include "../Allocator.hpp"
+
+namespace CrossFire
+{
+
+/**
+ * @brief A bounded lock-free queue for any number of producers and
+ * consumers, after Dmitry Vyukov's design.
+ * Every cell carries a sequence number saying whose turn it is: the
+ * producer of position p waits for p, and the consumer for p + 1. A push
+ * or pop is one compare-and-swap on the tail or head plus a store to the
+ * cell, and producers and consumers only meet on a cell when the queue is
+ * nearly full or empty. Head and tail sit on their own cache lines.
+ * Pushing to a full queue and popping from an empty one fail rather than
+ * wait.
+ * @tparam T The type of the elements, which must be trivially copyable.
+ */
+template <typename T> class MPMCQueue {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "MPMCQueue elements must be trivially copyable");
+
+    struct Cell {
+        std::atomic<usize> sequence;
+        T value;
+    };
+
+    Allocator &allocator;
+    Slice<Cell> cells;
+    usize mask;
+    alignas(64) std::atomic<usize> tail;
+    alignas(64) std::atomic<usize> head;
+
+    /**
+     * @brief Claim up to `count` consecutive cells whose turn has come.
+     * @param position The head or tail to claim from.
+     * @param lag 0 to claim cells to fill, 1 to claim cells to empty.
+     * @param first Set to the first claimed position.
+     * @return The number of cells claimed.
+     */
+    auto claim(std::atomic<usize> &position, usize lag, usize count,
+               usize &first) -> usize
+    {
+        auto pos = position.load(std::memory_order_relaxed);
+        for (;;) {
+            usize ready = 0;
+            while (ready < count) {
+                auto &cell = cells.ptr[(pos + ready) & mask];
+                auto seq = cell.sequence.load(std::memory_order_acquire);
+                if (seq != pos + ready + lag)
+                    break;
+                ready++;
+            }
+
+            if (ready == 0) {
+                // Either the queue is full or empty, or another thread
+                // moved on and this one has a stale position
+                auto &cell = cells.ptr[pos & mask];
+                auto seq = cell.sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<isize>(seq - (pos + lag));
+                if (diff < 0)
+                    return 0;
+                pos = position.load(std::memory_order_relaxed);
+                continue;
+            }
+
+            if (position.compare_exchange_weak(pos, pos + ready,
+                                               std::memory_order_relaxed,
+                                               std::memory_order_relaxed)) {
+                first = pos;
+                return ready;
+            }
+        }
+    }
+
+public:
+    /**
+     * @brief Creates a new, empty queue.
+     * @param allocator The allocator to use.
+     * @param capacity The capacity, a power of two.
+     */
+    MPMCQueue(Allocator &allocator, usize capacity)
+        : allocator(allocator)
+        , mask(capacity - 1)
+        , tail(0)
+        , head(0)
+    {
+        cf_assert(capacity > 1 && (capacity & (capacity - 1)) == 0,
+                  "Capacity must be a power of two");
+        cells = allocator.alloc<Cell>(capacity).unwrap();
+        for (usize i = 0; i < capacity; i++)
+            new (&cells.ptr[i].sequence) std::atomic<usize>(i);
+    }
+
+    ~MPMCQueue()
+    {
+        allocator.dealloc(cells);
+    }
+
+    MPMCQueue(const MPMCQueue &other) = delete;
+    MPMCQueue &operator=(const MPMCQueue &other) = delete;
+
+    /**
+     * @brief Get the capacity.
+     * @return The capacity.
+     */
+    inline auto capacity() const -> usize
+    {
+        return cells.len;
+    }
+
+    /**
+     * @brief Get the number of elements. Only exact when no other thread is
+     * using the queue.
+     * @return The number of elements.
+     */
+    inline auto size() const -> usize
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        auto h = head.load(std::memory_order_relaxed);
+        auto n = static_cast<isize>(t - h);
+        if (n < 0)
+            return 0;
+        return static_cast<usize>(n) < cells.len ? static_cast<usize>(n)
+                                                 : cells.len;
+    }
+
+    /**
+     * @brief Check if the queue looks empty.
+     * @return True if the queue is empty, false otherwise.
+     */
+    inline auto empty() const -> bool
+    {
+        return size() == 0;
+    }
+
+    /**
+     * @brief Push an element, if there is room.
+     * @param value The element.
+     * @return True if the element was pushed, false if the queue is full.
+     */
+    auto try_push(const T &value) -> bool
+    {
+        usize pos;
+        if (claim(tail, 0, 1, pos) == 0)
+            return false;
+
+        auto &cell = cells.ptr[pos & mask];
+        cell.value = value;
+        cell.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Pop the oldest element, if there is one.
+     * @return The element -- or None if the queue is empty.
+     */
+    auto try_pop() -> Option<T>
+    {
+        usize pos;
+        if (claim(head, 1, 1, pos) == 0)
+            return std::nullopt;
+
+        auto &cell = cells.ptr[pos & mask];
+        T value = cell.value;
+        cell.sequence.store(pos + cells.len, std::memory_order_release);
+        return value;
+    }
+
+    /**
+     * @brief Push as many elements as fit, in order, with one
+     * compare-and-swap for the lot.
+     * @param values The elements.
+     * @return The number of elements pushed, from the front of values.
+     */
+    auto try_push_batch(Slice<T> values) -> usize
+    {
+        if (values.len == 0)
+            return 0;
+
+        usize pos;
+        auto count = claim(tail, 0, values.len, pos);
+        for (usize i = 0; i < count; i++) {
+            auto &cell = cells.ptr[(pos + i) & mask];
+            cell.value = values.ptr[i];
+            cell.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        return count;
+    }
+
+    /**
+     * @brief Pop as many elements as are ready, oldest first, with one
+     * compare-and-swap for the lot.
+     * @param out Filled with the elements, up to its length.
+     * @return The number of elements popped.
+     */
+    auto try_pop_batch(Slice<T> out) -> usize
+    {
+        if (out.len == 0)
+            return 0;
+
+        usize pos;
+        auto count = claim(head, 1, out.len, pos);
+        for (usize i = 0; i < count; i++) {
+            auto &cell = cells.ptr[(pos + i) & mask];
+            out.ptr[i] = cell.value;
+            cell.sequence.store(pos + i + cells.len,
+                                std::memory_order_release);
+        }
+        return count;
+    }
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,110 @@
+#pragma once
+#include <new>
+#include "../Types.hpp"
+#include "../Allocator.hpp"
+#include "../List.hpp"
+#include "SpinLock.hpp"
+
+namespace CrossFire
+{
+
+/**
+ * @brief A thread-safe pool of reusable objects, carved out of slabs.
+ * Free objects are chained through their `next` member, so T must have a
+ * `T *next` field. Objects are default constructed once, when their slab is
+ * allocated, and are never destructed; acquire() hands out the object as it
+ * was released.
+ * @tparam T The type of the objects.
+ */
+template <typename T> class ObjectPool {
+    Allocator &allocator;
+    SpinLock lock;
+    T *free_list;
+    List<Slice<T> > slabs;
+    usize slab_size;
+
+    auto grow() -> ResultVoid<AllocationError>
+    {
+        auto res = allocator.alloc<T>(slab_size);
+        if (res.is_err())
+            return res.unwrap_err();
+
+        auto slab = res.unwrap();
+        auto pushed = slabs.push(slab);
+        if (pushed.is_err()) {
+            allocator.dealloc(slab);
+            return pushed.unwrap_err();
+        }
+
+        for (usize i = 0; i < slab.len; i++) {
+            auto object = new (&slab.ptr[i]) T();
+            object->next = free_list;
+            free_list = object;
+        }
+        return Ok();
+    }
+
+public:
+    /**
+     * @brief Creates a new object pool.
+     * @param allocator The allocator to use.
+     * @param slab_size The number of objects allocated at a time.
+     */
+    explicit ObjectPool(Allocator &allocator, usize slab_size = 64)
+        : allocator(allocator)
+        , free_list(nullptr)
+        , slabs(allocator)
+        , slab_size(slab_size)
+    {
+    }
+
+    ~ObjectPool()
+    {
+        for (usize i = 0; i < slabs.data.len; i++)
+            allocator.dealloc(slabs.data.ptr[i]);
+    }
+
+    ObjectPool(const ObjectPool &other) = delete;
+    ObjectPool &operator=(const ObjectPool &other) = delete;
+
+    /**
+     * @brief Take an object from the pool.
+     * @return The object -- or an error if allocation failed.
+     */
+    auto acquire() -> Result<T *, AllocationError>
+    {
+        LockGuard<SpinLock> guard(lock);
+        if (free_list == nullptr) {
+            auto res = grow();
+            if (res.is_err())
+                return res.unwrap_err();
+        }
+
+        auto object = free_list;
+        free_list = object->next;
+        return object;
+    }
+
+    /**
+     * @brief Return an object to the pool.
+     * @param object The object.
+     */
+    auto release(T *object) -> void
+    {
+        release_chain(object, object);
+    }
+
+    /**
+     * @brief Return a chain of objects, linked through `next`, in one go.
+     * @param head The first object.
+     * @param tail The last object.
+     */
+    auto release_chain(T *head, T *tail) -> void
+    {
+        LockGuard<SpinLock> guard(lock);
+        tail->next = free_list;
+        free_list = head;
+    }
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,296 @@
+#pragma once
+#include <atomic>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include "../Types.hpp"
+#include "../Allocator.hpp"
+#include "Thread.hpp"
+
+namespace CrossFire
+{
+
+namespace detail
+{
+
+// Default number of pieces per worker when no grain is given
+constexpr usize PARALLEL_PIECES_PER_WORKER = 64;
+
+// Default elements per block for the deterministic reductions and scans
+constexpr usize PARALLEL_BLOCK = 2048;
+
+template <typename Body> struct ParallelContext {
+    ThreadPool *pool;
+    Body *body;
+    usize grain;
+    std::atomic<usize> remaining;
+};
+
+/**
+ * @brief Run a range with lazy binary splitting.
+ * The range is worked through a grain at a time, and whenever the worker's
+ * deque is empty -- so idle workers would have nothing to steal -- the
+ * upper half is split off as a new task. Splitting thus only happens when
+ * it can help, and the pieces stay large when every worker is busy.
+ */
+template <typename Body>
+auto parallel_range(ParallelContext<Body> *context, usize begin, usize end)
+    -> void
+{
+    auto pool = context->pool;
+    auto grain = context->grain;
+    usize done = 0;
+
+    while (end - begin > grain) {
+        if (pool->local_pending() == 0) {
+            auto mid = begin + (end - begin) / 2;
+            pool->spawn(
+                [context, mid, end] { parallel_range(context, mid, end); });
+            end = mid;
+        } else {
+            (*context->body)(begin, begin + grain);
+            done += grain;
+            begin += grain;
+        }
+    }
+
+    (*context->body)(begin, end);
+    done += end - begin;
+
+    // Once this reaches zero the caller may return, so the context must not
+    // be touched afterwards
+    context->remaining.fetch_sub(done, std::memory_order_acq_rel);
+}
+
+/**
+ * @brief Run body(begin, end) over pieces of a range and wait for all of
+ * them, running pool tasks on the calling thread in the meantime.
+ */
+template <typename Body>
+auto parallel_chunks(ThreadPool &pool, usize begin, usize end, usize grain,
+                     Body &&body) -> void
+{
+    if (begin >= end)
+        return;
+
+    auto n = end - begin;
+    if (grain == 0)
+        grain = n / (PARALLEL_PIECES_PER_WORKER * (pool.size() + 1));
+    if (grain == 0)
+        grain = 1;
+
+    if (pool.size() == 0 || n <= grain) {
+        body(begin, end);
+        return;
+    }
+
+    using BodyType = std::remove_reference_t<Body>;
+    ParallelContext<BodyType> context{ &pool, &body, grain, { n } };
+    parallel_range(&context, begin, end);
+
+    while (context.remaining.load(std::memory_order_acquire) != 0) {
+        if (!pool.run_pending())
+            std::this_thread::yield();
+    }
+}
+
+}
+
+/**
+ * @brief Call a function for every index of a range, in parallel.
+ * The calling thread takes part, and runs other pool tasks while it waits,
+ * so parallel loops may be nested inside pool tasks.
+ * @tparam F The type of the function, taking (usize). It must not throw.
+ * @param pool The pool to run on.
+ * @param begin The first index.
+ * @param end One past the last index.
+ * @param func The function.
+ * @param grain The smallest number of indices run as one piece -- or 0 to
+ * pick one from the range and pool size.
+ */
+template <typename F>
+auto parallel_for(ThreadPool &pool, usize begin, usize end, F &&func,
+                  usize grain = 0) -> void
+{
+    detail::parallel_chunks(pool, begin, end, grain,
+                            [&func](usize first, usize last) {
+                                for (usize i = first; i < last; i++)
+                                    func(i);
+                            });
+}
+
+/**
+ * @brief Call a function for every element of a slice, in parallel.
+ * @tparam T The type of the elements.
+ * @tparam F The type of the function, taking (T &). It must not throw.
+ * @param pool The pool to run on.
+ * @param values The elements.
+ * @param func The function.
+ * @param grain The smallest number of elements run as one piece -- or 0 to
+ * pick one from the slice and pool size.
+ */
+template <typename T, typename F>
+auto parallel_for(ThreadPool &pool, Slice<T> values, F &&func, usize grain = 0)
+    -> void
+{
+    detail::parallel_chunks(pool, 0, values.len, grain,
+                            [&func, values](usize first, usize last) {
+                                for (usize i = first; i < last; i++)
+                                    func(values.ptr[i]);
+                            });
+}
+
+/**
+ * @brief Reduce a range in parallel.
+ * The range is cut into fixed blocks whose results are combined left to
+ * right, so the result does not depend on scheduling -- floating point
+ * sums come out the same on every run.
+ * @tparam T The type of the result.
+ * @tparam F The type of the block function, taking (usize first, usize
+ * last) and returning the T for that block. It must not throw.
+ * @tparam C The type of the combine function, taking (T, T).
+ * @param pool The pool to run on.
+ * @param allocator The allocator for the block results.
+ * @param begin The first index.
+ * @param end One past the last index.
+ * @param identity The result of an empty range.
+ * @param func The block function.
+ * @param combine The combine function, which must be associative.
+ * @param block The number of indices per block.
+ * @return The result -- or an error if allocation failed.
+ */
+template <typename T, typename F, typename C>
+auto parallel_reduce(ThreadPool &pool, Allocator &allocator, usize begin,
+                     usize end, const T &identity, F &&func, C &&combine,
+                     usize block = detail::PARALLEL_BLOCK)
+    -> Result<T, AllocationError>
+{
+    if (begin >= end)
+        return identity;
+
+    auto n = end - begin;
+    auto blocks = (n + block - 1) / block;
+    auto res = allocator.alloc<T>(blocks);
+    if (res.is_err())
+        return res.unwrap_err();
+    auto partials = res.unwrap();
+
+    detail::parallel_chunks(pool, 0, blocks, 1, [&](usize first, usize last) {
+        for (usize b = first; b < last; b++) {
+            auto lo = begin + b * block;
+            auto hi = lo + block < end ? lo + block : end;
+            new (&partials.ptr[b]) T(func(lo, hi));
+        }
+    });
+
+    T result = identity;
+    for (usize b = 0; b < blocks; b++) {
+        result = combine(result, partials.ptr[b]);
+        partials.ptr[b].~T();
+    }
+
+    allocator.dealloc(partials);
+    return result;
+}
+
+/**
+ * @brief Reduce the elements of a slice in parallel, deterministically.
+ * @tparam T The type of the elements.
+ * @tparam C The type of the combine function, taking (T, T).
+ * @param pool The pool to run on.
+ * @param allocator The allocator for the block results.
+ * @param values The elements.
+ * @param identity The identity of combine.
+ * @param combine The combine function, which must be associative.
+ * @param block The number of elements per block.
+ * @return The result -- or an error if allocation failed.
+ */
+template <typename T, typename C>
+auto parallel_reduce(ThreadPool &pool, Allocator &allocator, Slice<T> values,
+                     const T &identity, C &&combine,
+                     usize block = detail::PARALLEL_BLOCK)
+    -> Result<T, AllocationError>
+{
+    return parallel_reduce(
+        pool, allocator, 0, values.len, identity,
+        [&](usize first, usize last) {
+            T acc = identity;
+            for (usize i = first; i < last; i++)
+                acc = combine(acc, values.ptr[i]);
+            return acc;
+        },
+        combine, block);
+}
+
+/**
+ * @brief Compute the inclusive prefix combine of a slice in parallel.
+ * Each block is reduced, the block totals are scanned in order, and each
+ * block is then scanned from its offset -- two passes over the data, and
+ * the same result on every run.
+ * @tparam T The type of the elements.
+ * @tparam C The type of the combine function, taking (T, T).
+ * @param pool The pool to run on.
+ * @param allocator The allocator for the block totals.
+ * @param input The elements.
+ * @param output The prefixes, as long as input; may be input itself.
+ * @param identity The identity of combine.
+ * @param combine The combine function, which must be associative.
+ * @param block The number of elements per block.
+ * @return Nothing -- or an error if allocation failed.
+ */
+template <typename T, typename C>
+auto parallel_scan(ThreadPool &pool, Allocator &allocator, Slice<T> input,
+                   Slice<T> output, const T &identity, C &&combine,
+                   usize block = detail::PARALLEL_BLOCK)
+    -> ResultVoid<AllocationError>
+{
+    cf_assert(input.len == output.len, "Input and output differ in length");
+    auto n = input.len;
+    if (n == 0)
+        return Ok();
+
+    auto blocks = (n + block - 1) / block;
+    auto res = allocator.alloc<T>(blocks);
+    if (res.is_err())
+        return res.unwrap_err();
+    auto totals = res.unwrap();
+
+    detail::parallel_chunks(pool, 0, blocks, 1, [&](usize first, usize last) {
+        for (usize b = first; b < last; b++) {
+            auto lo = b * block;
+            auto hi = lo + block < n ? lo + block : n;
+            T acc = identity;
+            for (usize i = lo; i < hi; i++)
+                acc = combine(acc, input.ptr[i]);
+            new (&totals.ptr[b]) T(acc);
+        }
+    });
+
+    // Turn the totals into the offset each block starts from
+    T running = identity;
+    for (usize b = 0; b < blocks; b++) {
+        T total = totals.ptr[b];
+        totals.ptr[b] = running;
+        running = combine(running, total);
+    }
+
+    detail::parallel_chunks(pool, 0, blocks, 1, [&](usize first, usize last) {
+        for (usize b = first; b < last; b++) {
+            auto lo = b * block;
+            auto hi = lo + block < n ? lo + block : n;
+            T acc = totals.ptr[b];
+            for (usize i = lo; i < hi; i++) {
+                acc = combine(acc, input.ptr[i]);
+                output.ptr[i] = acc;
+            }
+        }
+    });
+
+    for (usize b = 0; b < blocks; b++)
+        totals.ptr[b].~T();
+    allocator.dealloc(totals);
+    return Ok();
+}
+
+}
\ No newline at end of file
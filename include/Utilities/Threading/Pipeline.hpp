@@ -0,0 +1,413 @@
+#pragma once
+#include <functional>
+#include <thread>
+#include <type_traits>
+#include "../Types.hpp"
+#include "../Allocator.hpp"
+#include "../SegmentedList.hpp"
+#include "../Time.hpp"
+#include "SpinLock.hpp"
+#include "Thread.hpp"
+
+namespace CrossFire
+{
+
+/**
+ * @brief How a Pipeline runs one of its stages.
+ */
+struct PipelineStageConfig {
+    // The name used in reports -- or nullptr
+    const char *name = nullptr;
+
+    // The most items the stage works on at once
+    usize parallelism = 1;
+
+    // The most items waiting for the stage; upstream stages stop taking
+    // new items while it is full. 0 means the pipeline capacity
+    usize capacity = 0;
+
+    // Take items in the order they were pushed, one at a time. The stage
+    // buffers whatever overtakes the next item, so it always has room for
+    // the whole pipeline
+    bool ordered = false;
+};
+
+/**
+ * @brief What a Pipeline stage has done since the stats were last reset.
+ */
+struct PipelineStageStats {
+    // Items the stage has finished
+    u64 processed;
+
+    // Total time spent in the stage function, in microseconds
+    u64 busy;
+
+    // Times the stage had items but no room downstream to start them
+    u64 stalls;
+
+    // Items waiting for the stage now, and the most there have been
+    usize depth;
+    usize peak_depth;
+
+    // Items the stage is working on now
+    usize active;
+};
+
+/**
+ * @brief A chain of stages that items flow through on a ThreadPool, such
+ * as read, decompress, generate, light and mesh for a chunk.
+ * Every stage has a bounded input queue and a degree of parallelism. A
+ * stage only starts an item once there is room for the result downstream,
+ * so a slow stage fills the queues behind it and then stalls push(), and
+ * memory stays bounded however fast the producer is. No worker ever blocks
+ * on a full queue; a stalled stage simply runs no tasks until its
+ * consumer frees a slot.
+ * The pipeline holds at most `capacity` items at once, which also bounds
+ * the reorder buffers of ordered stages.
+ * Items are small trivially copyable handles, such as a pointer to the
+ * chunk, and are passed by reference to each stage in turn. Stages share
+ * one lock for their bookkeeping, so they should do real work per item.
+ * @tparam T The type of the items.
+ */
+template <typename T> class Pipeline final {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "Pipeline items must be trivially copyable");
+
+    struct Entry {
+        T item;
+        u64 seq;
+        bool full;
+    };
+
+    struct Stage {
+        std::function<void(T &)> func;
+        const char *name;
+        usize parallelism;
+        bool ordered;
+
+        // A ring of waiting items -- or, for ordered stages, a reorder
+        // buffer indexed by sequence number
+        Slice<Entry> queue;
+        usize head;
+        usize count;
+
+        // Slots promised to items the stage upstream is working on
+        usize reserved;
+
+        // Tasks running the stage, and those not yet started
+        usize active;
+        usize starting;
+
+        // The next sequence number an ordered stage takes
+        u64 expected;
+
+        PipelineStageStats stats;
+    };
+
+    Allocator &allocator;
+    ThreadPool &pool;
+    SegmentedList<Stage> stages;
+    usize capacity;
+
+    SpinLock lock;
+    u64 next_seq;
+    usize in_flight;
+    usize tasks;
+
+    auto available(Stage &stage) -> usize
+    {
+        if (!stage.ordered)
+            return stage.count;
+
+        auto &entry = stage.queue.ptr[stage.expected % stage.queue.len];
+        return entry.full && entry.seq == stage.expected ? 1 : 0;
+    }
+
+    auto room(usize index) -> usize
+    {
+        if (index + 1 == stages.size())
+            return static_cast<usize>(-1);
+
+        auto &next = stages[index + 1];
+        return next.queue.len - next.count - next.reserved;
+    }
+
+    auto put(Stage &stage, const Entry &entry) -> void
+    {
+        auto slot = stage.ordered
+                        ? entry.seq % stage.queue.len
+                        : (stage.head + stage.count) % stage.queue.len;
+        stage.queue.ptr[slot] = entry;
+        stage.queue.ptr[slot].full = true;
+        stage.count++;
+
+        if (stage.count > stage.stats.peak_depth)
+            stage.stats.peak_depth = stage.count;
+    }
+
+    auto take(Stage &stage) -> Entry
+    {
+        usize slot;
+        if (stage.ordered) {
+            slot = stage.expected % stage.queue.len;
+            stage.expected++;
+        } else {
+            slot = stage.head;
+            stage.head = (stage.head + 1) % stage.queue.len;
+        }
+
+        auto entry = stage.queue.ptr[slot];
+        stage.queue.ptr[slot].full = false;
+        stage.count--;
+        return entry;
+    }
+
+    /**
+     * @brief Spawn tasks for a stage until every item it could start has
+     * one. Called with the lock held.
+     */
+    auto schedule(usize index) -> void
+    {
+        auto &stage = stages[index];
+        auto ready = available(stage);
+        auto space = room(index);
+        auto startable = ready < space ? ready : space;
+        if (startable < ready && stage.starting == 0)
+            stage.stats.stalls++;
+
+        while (stage.active < stage.parallelism &&
+               stage.starting < startable) {
+            stage.active++;
+            stage.starting++;
+            tasks++;
+            pool.spawn([this, index] { run_stage(index); });
+        }
+    }
+
+    auto run_stage(usize index) -> void
+    {
+        auto &stage = stages[index];
+        auto last = index + 1 == stages.size();
+
+        lock.lock();
+        stage.starting--;
+        while (available(stage) > 0 && room(index) > 0) {
+            auto entry = take(stage);
+            if (!last)
+                stages[index + 1].reserved++;
+
+            // A slot came free, so the stage upstream may go on
+            if (index > 0)
+                schedule(index - 1);
+            lock.unlock();
+
+            auto start = get_time_microseconds();
+            stage.func(entry.item);
+            auto busy = get_time_microseconds() - start;
+
+            lock.lock();
+            stage.stats.processed++;
+            stage.stats.busy += busy;
+            if (!last) {
+                auto &next = stages[index + 1];
+                next.reserved--;
+                put(next, entry);
+                schedule(index + 1);
+            } else {
+                in_flight--;
+            }
+        }
+
+        // The last access to the pipeline, which wait() may then destroy
+        stage.active--;
+        tasks--;
+        lock.unlock();
+    }
+
+public:
+    /**
+     * @brief Creates a new pipeline without stages.
+     * @param allocator The allocator to use.
+     * @param pool The pool to run the stages on.
+     * @param capacity The most items the pipeline holds at once.
+     */
+    Pipeline(Allocator &allocator, ThreadPool &pool, usize capacity)
+        : allocator(allocator)
+        , pool(pool)
+        , stages(allocator)
+        , capacity(capacity)
+        , next_seq(0)
+        , in_flight(0)
+        , tasks(0)
+    {
+        cf_assert(capacity > 0, "Pipeline capacity must be positive");
+    }
+
+    ~Pipeline()
+    {
+        wait();
+        stages.for_each([this](Stage &stage) {
+            allocator.dealloc(stage.queue);
+        });
+    }
+
+    Pipeline(const Pipeline &other) = delete;
+    Pipeline &operator=(const Pipeline &other) = delete;
+
+    /**
+     * @brief Adds a stage after the current last one. Stages must all be
+     * added before the first item is pushed.
+     * @tparam F The type of the function, taking a T& and not throwing.
+     * @param f The function run on each item.
+     * @param config How to run the stage.
+     * @return The index of the stage -- or an error if allocation failed.
+     */
+    template <typename F>
+    auto add_stage(F &&f,
+                   const PipelineStageConfig &config = PipelineStageConfig())
+        -> Result<usize, AllocationError>
+    {
+        cf_assert(next_seq == 0, "Pipeline stages added after first push");
+
+        auto size = config.capacity > 0 ? config.capacity : capacity;
+        if (config.ordered || size > capacity)
+            size = capacity;
+
+        auto queue = allocator.alloc<Entry>(size);
+        if (queue.is_err())
+            return queue.unwrap_err();
+        for (usize i = 0; i < size; i++)
+            queue.unwrap().ptr[i].full = false;
+
+        auto parallelism = config.parallelism > 0 ? config.parallelism : 1;
+        auto res = stages.push(Stage{ std::forward<F>(f),
+                                      config.name,
+                                      config.ordered ? 1 : parallelism,
+                                      config.ordered,
+                                      queue.unwrap(),
+                                      0,
+                                      0,
+                                      0,
+                                      0,
+                                      0,
+                                      0,
+                                      {} });
+        if (res.is_err()) {
+            allocator.dealloc(queue.unwrap());
+            return res.unwrap_err();
+        }
+        return stages.size() - 1;
+    }
+
+    /**
+     * @brief Feed an item to the first stage, if there is room.
+     * @param item The item.
+     * @return True if the item was accepted, false if the pipeline is full.
+     */
+    auto try_push(const T &item) -> bool
+    {
+        cf_assert(stages.size() > 0, "Pipeline has no stages");
+
+        LockGuard<SpinLock> guard(lock);
+        auto &first = stages[0];
+        if (in_flight == capacity ||
+            first.count + first.reserved == first.queue.len)
+            return false;
+
+        put(first, Entry{ item, next_seq++, true });
+        in_flight++;
+        schedule(0);
+        return true;
+    }
+
+    /**
+     * @brief Feed an item to the first stage, waiting for room. The caller
+     * runs tasks from the pool while it waits, so it may be a worker.
+     * @param item The item.
+     */
+    auto push(const T &item) -> void
+    {
+        while (!try_push(item)) {
+            if (!pool.run_pending())
+                std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief Wait until every pushed item has left the last stage, running
+     * tasks from the pool meanwhile.
+     */
+    auto wait() -> void
+    {
+        for (;;) {
+            lock.lock();
+            auto done = in_flight == 0 && tasks == 0;
+            lock.unlock();
+            if (done)
+                return;
+
+            if (!pool.run_pending())
+                std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief Get the number of stages.
+     * @return The number of stages.
+     */
+    inline auto size() const -> usize
+    {
+        return stages.size();
+    }
+
+    /**
+     * @brief Get the number of items in the pipeline.
+     * @return The number of items.
+     */
+    inline auto pending() -> usize
+    {
+        LockGuard<SpinLock> guard(lock);
+        return in_flight;
+    }
+
+    /**
+     * @brief Get the name of a stage.
+     * @param index The index of the stage.
+     * @return The name -- or nullptr.
+     */
+    inline auto get_name(usize index) -> const char *
+    {
+        return stages[index].name;
+    }
+
+    /**
+     * @brief Get what a stage has done. Throughput is processed over the
+     * time since the last reset, and busy over that time shows how much of
+     * the stage's parallelism is used.
+     * @param index The index of the stage.
+     * @return The stats.
+     */
+    auto get_stats(usize index) -> PipelineStageStats
+    {
+        LockGuard<SpinLock> guard(lock);
+        auto &stage = stages[index];
+        auto stats = stage.stats;
+        stats.depth = stage.count;
+        stats.active = stage.active - stage.starting;
+        return stats;
+    }
+
+    /**
+     * @brief Reset the stats of every stage.
+     */
+    auto reset_stats() -> void
+    {
+        LockGuard<SpinLock> guard(lock);
+        stages.for_each([](Stage &stage) {
+            stage.stats = PipelineStageStats{};
+            stage.stats.peak_depth = stage.count;
+        });
+    }
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,277 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include "../Types.hpp"
+#include "../ByteOps.hpp"
+
+namespace CrossFire
+{
+
+/**
+ * @brief A histogram of durations in power-of-two buckets: bucket i counts
+ * durations in [2^i, 2^(i+1)) nanoseconds, with bucket 0 also taking 0.
+ */
+struct LatencyHistogram {
+    static constexpr usize BUCKETS = 40;
+
+    u64 counts[BUCKETS];
+    u64 count;
+    u64 total;
+    u64 max;
+
+    /**
+     * @brief Get the mean duration.
+     * @return The mean in nanoseconds -- or 0 if empty.
+     */
+    inline auto mean() const -> u64
+    {
+        return count > 0 ? total / count : 0;
+    }
+
+    /**
+     * @brief Get an upper bound on a percentile, to within a factor of two.
+     * @param fraction The percentile as a fraction, e.g. 0.99.
+     * @return The upper end of the bucket holding it, in nanoseconds.
+     */
+    inline auto percentile(f64 fraction) const -> u64
+    {
+        auto rank = static_cast<u64>(fraction * static_cast<f64>(count));
+        u64 seen = 0;
+        for (usize i = 0; i < BUCKETS; i++) {
+            seen += counts[i];
+            if (seen > rank)
+                return (static_cast<u64>(1) << (i + 1)) - 1;
+        }
+        return max;
+    }
+
+    /**
+     * @brief Add another histogram into this one.
+     * @param other The histogram.
+     */
+    inline auto merge(const LatencyHistogram &other) -> void
+    {
+        for (usize i = 0; i < BUCKETS; i++)
+            counts[i] += other.counts[i];
+        count += other.count;
+        total += other.total;
+        max = other.max > max ? other.max : max;
+    }
+};
+
+/**
+ * @brief What the tasks run by one thread have done. Times are in
+ * nanoseconds.
+ */
+struct WorkerStats {
+    // From enqueue to start, and from start to finish
+    LatencyHistogram wait;
+    LatencyHistogram run;
+
+    // Time spent running tasks, and asleep waiting for them
+    u64 busy;
+    u64 idle;
+
+    // Tasks taken from another worker, and times the thread went to sleep
+    u64 steals;
+    u64 sleeps;
+
+    // Tasks on the worker's own deque now, on average when a task
+    // started, and at most
+    usize depth;
+    f64 mean_depth;
+    usize peak_depth;
+
+    // The share of the elapsed time spent running tasks
+    f64 utilization;
+
+    /**
+     * @brief Add another thread's stats into these. Utilization is left
+     * alone, since it does not add up.
+     * @param other The stats.
+     */
+    inline auto merge(const WorkerStats &other) -> void
+    {
+        auto mine = static_cast<f64>(run.count);
+        auto theirs = static_cast<f64>(other.run.count);
+        if (mine + theirs > 0)
+            mean_depth = (mean_depth * mine + other.mean_depth * theirs) /
+                         (mine + theirs);
+
+        wait.merge(other.wait);
+        run.merge(other.run);
+        busy += other.busy;
+        idle += other.idle;
+        steals += other.steals;
+        sleeps += other.sleeps;
+        depth += other.depth;
+        peak_depth = other.peak_depth > peak_depth ? other.peak_depth
+                                                   : peak_depth;
+    }
+};
+
+/**
+ * @brief A snapshot of a ThreadPool's activity since its stats were last
+ * reset. Maximums and peaks cover the whole life of the pool.
+ */
+struct ThreadPoolStats {
+    // One entry per worker
+    std::vector<WorkerStats> workers;
+
+    // Tasks run by threads outside the pool while they wait on it
+    WorkerStats external;
+
+    // Every worker and the external threads together
+    WorkerStats total;
+
+    // Nanoseconds since the reset
+    u64 elapsed;
+
+    // Sleeping workers woken to take new tasks
+    u64 wakeups;
+
+    // Tasks pushed from outside the pool waiting now, and at most
+    usize injected_depth;
+    usize peak_injected_depth;
+};
+
+namespace detail
+{
+
+/**
+ * @brief Counters with one writer, or with several when shared. A single
+ * writer updates with a plain load and store rather than an atomic
+ * read-modify-write, and readers may see a slightly stale value.
+ */
+struct StatCounters {
+    std::atomic<u64> wait[LatencyHistogram::BUCKETS];
+    std::atomic<u64> run[LatencyHistogram::BUCKETS];
+    std::atomic<u64> wait_total;
+    std::atomic<u64> run_total;
+    std::atomic<u64> wait_max;
+    std::atomic<u64> run_max;
+    std::atomic<u64> idle;
+    std::atomic<u64> steals;
+    std::atomic<u64> sleeps;
+    std::atomic<u64> depth_total;
+    std::atomic<u64> peak_depth;
+    bool shared;
+
+    explicit StatCounters(bool shared)
+        : wait_total(0)
+        , run_total(0)
+        , wait_max(0)
+        , run_max(0)
+        , idle(0)
+        , steals(0)
+        , sleeps(0)
+        , depth_total(0)
+        , peak_depth(0)
+        , shared(shared)
+    {
+        for (usize i = 0; i < LatencyHistogram::BUCKETS; i++) {
+            wait[i].store(0, std::memory_order_relaxed);
+            run[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    inline auto add(std::atomic<u64> &counter, u64 value) -> void
+    {
+        if (shared)
+            counter.fetch_add(value, std::memory_order_relaxed);
+        else
+            counter.store(counter.load(std::memory_order_relaxed) + value,
+                          std::memory_order_relaxed);
+    }
+
+    static inline auto raise(std::atomic<u64> &counter, u64 value) -> void
+    {
+        auto current = counter.load(std::memory_order_relaxed);
+        while (value > current &&
+               !counter.compare_exchange_weak(current, value,
+                                              std::memory_order_relaxed))
+            ;
+    }
+
+    static inline auto bucket(u64 ns) -> usize
+    {
+        if (ns == 0)
+            return 0;
+        auto index = static_cast<usize>(highest_bit(ns));
+        return index < LatencyHistogram::BUCKETS
+                   ? index
+                   : LatencyHistogram::BUCKETS - 1;
+    }
+
+    /**
+     * @brief Record a task that waited, then ran, with the worker's deque
+     * holding depth tasks as it started.
+     */
+    inline auto record(u64 waited, u64 ran, usize depth) -> void
+    {
+        add(wait[bucket(waited)], 1);
+        add(run[bucket(ran)], 1);
+        add(wait_total, waited);
+        add(run_total, ran);
+        add(depth_total, depth);
+        raise(wait_max, waited);
+        raise(run_max, ran);
+        raise(peak_depth, depth);
+    }
+
+    /**
+     * @brief Read the counters, less a baseline taken earlier.
+     */
+    auto read(const WorkerStats &baseline, u64 elapsed, usize depth) const
+        -> WorkerStats
+    {
+        WorkerStats stats{};
+        for (usize i = 0; i < LatencyHistogram::BUCKETS; i++) {
+            stats.wait.counts[i] = wait[i].load(std::memory_order_relaxed) -
+                                   baseline.wait.counts[i];
+            stats.run.counts[i] = run[i].load(std::memory_order_relaxed) -
+                                  baseline.run.counts[i];
+            stats.wait.count += stats.wait.counts[i];
+            stats.run.count += stats.run.counts[i];
+        }
+        stats.wait.total =
+            wait_total.load(std::memory_order_relaxed) - baseline.wait.total;
+        stats.run.total =
+            run_total.load(std::memory_order_relaxed) - baseline.run.total;
+        stats.wait.max = wait_max.load(std::memory_order_relaxed);
+        stats.run.max = run_max.load(std::memory_order_relaxed);
+        stats.busy = stats.run.total;
+        stats.idle = idle.load(std::memory_order_relaxed) - baseline.idle;
+        stats.steals = steals.load(std::memory_order_relaxed) - baseline.steals;
+        stats.sleeps = sleeps.load(std::memory_order_relaxed) - baseline.sleeps;
+
+        // The baseline keeps the raw depth total in mean_depth
+        auto depth_sum = static_cast<f64>(
+            depth_total.load(std::memory_order_relaxed));
+        stats.depth = depth;
+        stats.mean_depth = stats.run.count > 0
+                               ? (depth_sum - baseline.mean_depth) /
+                                     static_cast<f64>(stats.run.count)
+                               : 0.0;
+        stats.peak_depth = static_cast<usize>(
+            peak_depth.load(std::memory_order_relaxed));
+        stats.utilization =
+            elapsed > 0 ? static_cast<f64>(stats.busy) / elapsed : 0.0;
+        return stats;
+    }
+
+    /**
+     * @brief Read the raw counters, to subtract from later reads.
+     */
+    auto baseline() const -> WorkerStats
+    {
+        WorkerStats stats = read(WorkerStats{}, 0, 0);
+        stats.mean_depth =
+            static_cast<f64>(depth_total.load(std::memory_order_relaxed));
+        return stats;
+    }
+};
+
+}
+
+}
\ No newline at end of file
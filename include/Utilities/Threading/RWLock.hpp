@@ -0,0 +1,143 @@
+#pragma once
+#include <atomic>
+#include "../Types.hpp"
+#include "Futex.hpp"
+#include "SpinLock.hpp"
+#include "ThreadSlot.hpp"
+
+namespace CrossFire
+{
+
+/**
+ * @brief A lock guard using RAII that holds a lock shared, for readers.
+ * @tparam T The type of the lock.
+ */
+template <typename T> class SharedLockGuard {
+public:
+    explicit SharedLockGuard(T &lock)
+        : lock(lock)
+    {
+        lock.lock_shared();
+    }
+    ~SharedLockGuard()
+    {
+        lock.unlock_shared();
+    }
+
+private:
+    T &lock;
+};
+
+/**
+ * @brief A reader-writer lock for state that is read far more often than
+ * it is written.
+ * Readers count themselves on one of several cache lines, picked per
+ * thread, so concurrent readers do not write the same line and do not
+ * serialize. A writer blocks new readers, then waits for every counter to
+ * drain -- writing costs a scan of all counters, which is the trade for
+ * cheap reads. Waiting writers take priority over new readers.
+ * The shared side is not reentrant once a writer may be waiting.
+ */
+class RWLock {
+public:
+    RWLock()
+        : writer(0)
+    {
+        for (u32 i = 0; i < detail::THREAD_SLOTS; i++)
+            slots[i].value.store(0, std::memory_order_relaxed);
+    }
+    ~RWLock() = default;
+
+    RWLock(const RWLock &other) = delete;
+    RWLock &operator=(const RWLock &other) = delete;
+
+    auto lock_shared() -> void
+    {
+        auto &slot = slots[detail::thread_slot()];
+        for (;;) {
+            // Pairs with the stores in lock(): either the writer sees this
+            // count, or this sees the writer
+            slot.value.fetch_add(1, std::memory_order_seq_cst);
+            if (writer.load(std::memory_order_seq_cst) == 0)
+                return;
+
+            slot.value.fetch_sub(1, std::memory_order_release);
+            wait_for_writer();
+        }
+    }
+    auto try_lock_shared() -> bool
+    {
+        auto &slot = slots[detail::thread_slot()];
+        slot.value.fetch_add(1, std::memory_order_seq_cst);
+        if (writer.load(std::memory_order_seq_cst) == 0)
+            return true;
+
+        slot.value.fetch_sub(1, std::memory_order_release);
+        return false;
+    }
+    auto unlock_shared() -> void
+    {
+        slots[detail::thread_slot()].value.fetch_sub(
+            1, std::memory_order_release);
+    }
+
+    auto lock() -> void
+    {
+        writers.lock();
+        writer.store(1, std::memory_order_seq_cst);
+        for (u32 i = 0; i < detail::THREAD_SLOTS; i++) {
+            detail::Backoff backoff;
+            while (slots[i].value.load(std::memory_order_seq_cst) != 0)
+                backoff.pause();
+        }
+    }
+    auto try_lock() -> bool
+    {
+        if (!writers.try_lock())
+            return false;
+
+        writer.store(1, std::memory_order_seq_cst);
+        for (u32 i = 0; i < detail::THREAD_SLOTS; i++) {
+            if (slots[i].value.load(std::memory_order_seq_cst) != 0) {
+                unlock();
+                return false;
+            }
+        }
+        return true;
+    }
+    auto unlock() -> void
+    {
+        if (writer.exchange(0, std::memory_order_release) == 2)
+            detail::futex_wake_all(writer);
+        writers.unlock();
+    }
+
+private:
+    // Reader counts, one per thread slot
+    detail::PaddedSlot<std::atomic<u32> > slots[detail::THREAD_SLOTS];
+
+    // 0 is no writer, 1 a writer, and 2 a writer with readers asleep on it
+    std::atomic<u32> writer;
+    SpinLock writers;
+
+    auto wait_for_writer() -> void
+    {
+        detail::Backoff backoff;
+        for (;;) {
+            auto state = writer.load(std::memory_order_acquire);
+            if (state == 0)
+                return;
+
+            if (backoff.spinning()) {
+                backoff.pause();
+            } else {
+                if (state == 1 && !writer.compare_exchange_weak(
+                                      state, 2, std::memory_order_relaxed))
+                    continue;
+                detail::futex_wait(writer, 2);
+            }
+        }
+    }
+};
+
+}
\ No newline at end of file
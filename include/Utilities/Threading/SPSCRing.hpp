@@ -0,0 +1,291 @@
+#pragma once
+#include <atomic>
+#include <type_traits>
+#include "../Types.hpp"
+#include "../Allocator.hpp"
+#include "Futex.hpp"
+#include "SpinLock.hpp"
+
+namespace CrossFire
+{
+
+/**
+ * @brief A bounded ring buffer from exactly one producer thread to exactly
+ * one consumer thread.
+ * Each side owns one index and keeps a cached copy of the other's, only
+ * re-reading the shared one when the cache cannot cover the run asked
+ * for, so in steady streaming the two cores rarely touch each other's
+ * cache lines. Every operation is wait-free.
+ * Besides single elements, the producer can reserve() a run of slots,
+ * fill it in place and commit() it, and the consumer can peek() at a run
+ * and release() it, without copying.
+ * A blocking ring also lets either side sleep on a futex until the other
+ * makes progress; this costs a fence per commit or release, so it is
+ * opt-in. Where there is no futex the waits yield instead.
+ * @tparam T The type of the elements, which must be trivially copyable.
+ */
+template <typename T> class SPSCRing {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "SPSCRing elements must be trivially copyable");
+
+    Allocator &allocator;
+    Slice<T> buffer;
+    usize mask;
+    bool blocking;
+    std::atomic<bool> closed;
+
+    // The producer's line, with the flag the consumer sleeps on
+    alignas(64) std::atomic<usize> tail;
+    usize head_cache;
+    std::atomic<u32> data;
+
+    // The consumer's line, with the flag the producer sleeps on
+    alignas(64) std::atomic<usize> head;
+    usize tail_cache;
+    std::atomic<u32> space;
+
+    inline auto readable(usize needed) -> usize
+    {
+        auto h = head.load(std::memory_order_relaxed);
+        if (tail_cache - h < needed)
+            tail_cache = tail.load(std::memory_order_acquire);
+        return tail_cache - h;
+    }
+
+    inline auto writable(usize needed) -> usize
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (buffer.len - (t - head_cache) < needed)
+            head_cache = head.load(std::memory_order_acquire);
+        return buffer.len - (t - head_cache);
+    }
+
+    /**
+     * @brief Wake the other side if it is asleep on a flag. Only one thread
+     * ever sleeps on each flag, so the first notify clears it and the rest
+     * cost a fence and a load.
+     */
+    static inline auto notify(std::atomic<u32> &sleeping) -> void
+    {
+        // Pairs with the fence in wait(): either the sleeper sees the new
+        // index, or this sees the flag
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_relaxed) != 0 &&
+            sleeping.exchange(0, std::memory_order_relaxed) != 0)
+            detail::futex_wake(sleeping, 1);
+    }
+
+    template <typename F>
+    auto wait(std::atomic<u32> &sleeping, usize count, F &&ready) -> bool
+    {
+        cf_assert(blocking, "SPSCRing was not created blocking");
+        cf_assert(count <= buffer.len, "Waiting for more than the capacity");
+
+        // The other side is usually just behind, so spin briefly first
+        detail::Backoff backoff;
+        while (backoff.spinning()) {
+            if (ready(count) >= count)
+                return true;
+            backoff.pause();
+        }
+
+        for (;;) {
+            if (ready(count) >= count)
+                return true;
+            if (closed.load(std::memory_order_acquire))
+                return false;
+
+            sleeping.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (ready(count) >= count ||
+                closed.load(std::memory_order_relaxed)) {
+                sleeping.store(0, std::memory_order_relaxed);
+                continue;
+            }
+            detail::futex_wait(sleeping, 1);
+        }
+    }
+
+public:
+    /**
+     * @brief Creates a new, empty ring.
+     * @param allocator The allocator to use.
+     * @param capacity The capacity, a power of two.
+     * @param blocking Whether either side may wait for the other.
+     */
+    SPSCRing(Allocator &allocator, usize capacity, bool blocking = false)
+        : allocator(allocator)
+        , mask(capacity - 1)
+        , blocking(blocking)
+        , closed(false)
+        , tail(0)
+        , head_cache(0)
+        , data(0)
+        , head(0)
+        , tail_cache(0)
+        , space(0)
+    {
+        cf_assert(capacity > 0 && (capacity & (capacity - 1)) == 0,
+                  "Capacity must be a power of two");
+        buffer = allocator.alloc<T>(capacity).unwrap();
+    }
+
+    ~SPSCRing()
+    {
+        allocator.dealloc(buffer);
+    }
+
+    SPSCRing(const SPSCRing &other) = delete;
+    SPSCRing &operator=(const SPSCRing &other) = delete;
+
+    /**
+     * @brief Get the capacity.
+     * @return The capacity.
+     */
+    inline auto capacity() const -> usize
+    {
+        return buffer.len;
+    }
+
+    /**
+     * @brief Get the number of elements. Exact for the consumer, a lower
+     * bound for the producer.
+     * @return The number of elements.
+     */
+    inline auto size() const -> usize
+    {
+        auto h = head.load(std::memory_order_acquire);
+        return tail.load(std::memory_order_acquire) - h;
+    }
+
+    /**
+     * @brief Push an element, if there is room. Producer only.
+     * @param value The element.
+     * @return True if the element was pushed, false if the ring is full.
+     */
+    inline auto try_push(const T &value) -> bool
+    {
+        auto slots = reserve(1);
+        if (slots.len == 0)
+            return false;
+
+        slots.ptr[0] = value;
+        commit(1);
+        return true;
+    }
+
+    /**
+     * @brief Pop the oldest element, if there is one. Consumer only.
+     * @return The element -- or None if the ring is empty.
+     */
+    inline auto try_pop() -> Option<T>
+    {
+        auto slots = peek(1);
+        if (slots.len == 0)
+            return std::nullopt;
+
+        T value = slots.ptr[0];
+        release(1);
+        return value;
+    }
+
+    /**
+     * @brief Get free slots to write in place. The run stops at the end of
+     * the buffer, so it may be shorter than the free space; commit and
+     * reserve again for the rest. Producer only.
+     * @param max The most slots wanted.
+     * @return The slots, possibly none.
+     */
+    auto reserve(usize max) -> Slice<T>
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        auto index = t & mask;
+
+        // Re-read the shared index unless the cache covers the whole run
+        auto wanted = buffer.len - index < max ? buffer.len - index : max;
+        auto count = writable(wanted);
+        return Slice<T>(buffer.ptr + index, count < wanted ? count : wanted);
+    }
+
+    /**
+     * @brief Publish slots written since reserve(). Producer only.
+     * @param count The number of slots, from the front of the reserved run.
+     */
+    auto commit(usize count) -> void
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        tail.store(t + count, std::memory_order_release);
+        if (blocking)
+            notify(data);
+    }
+
+    /**
+     * @brief Get the oldest elements to read in place. The run stops at the
+     * end of the buffer, so it may be shorter than what is queued; release
+     * and peek again for the rest. Consumer only.
+     * @param max The most elements wanted.
+     * @return The elements, possibly none.
+     */
+    auto peek(usize max) -> Slice<T>
+    {
+        auto h = head.load(std::memory_order_relaxed);
+        auto index = h & mask;
+
+        // Re-read the shared index unless the cache covers the whole run
+        auto wanted = buffer.len - index < max ? buffer.len - index : max;
+        auto count = readable(wanted);
+        return Slice<T>(buffer.ptr + index, count < wanted ? count : wanted);
+    }
+
+    /**
+     * @brief Hand back elements read since peek(). Consumer only.
+     * @param count The number of elements, from the front of the run.
+     */
+    auto release(usize count) -> void
+    {
+        auto h = head.load(std::memory_order_relaxed);
+        head.store(h + count, std::memory_order_release);
+        if (blocking)
+            notify(space);
+    }
+
+    /**
+     * @brief Sleep until enough elements are queued. Consumer only, and
+     * only on a blocking ring.
+     * @param count The number of elements, at most the capacity.
+     * @return True once they are queued -- or false if the ring was closed
+     * with fewer left.
+     */
+    auto wait_for_data(usize count = 1) -> bool
+    {
+        return wait(data, count,
+                    [this](usize needed) { return readable(needed); });
+    }
+
+    /**
+     * @brief Sleep until enough slots are free. Producer only, and only on
+     * a blocking ring.
+     * @param count The number of slots, at most the capacity.
+     * @return True once they are free -- or false if the ring was closed.
+     */
+    auto wait_for_space(usize count = 1) -> bool
+    {
+        return wait(space, count,
+                    [this](usize needed) { return writable(needed); });
+    }
+
+    /**
+     * @brief Wake both sides and make further waits return false once they
+     * cannot be satisfied, e.g. to stop a consumer thread. Either side.
+     */
+    auto close() -> void
+    {
+        closed.store(true, std::memory_order_release);
+        if (blocking) {
+            notify(data);
+            notify(space);
+        }
+    }
+};
+
+}
\ No newline at end of file
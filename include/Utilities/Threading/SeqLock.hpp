@@ -0,0 +1,157 @@
+#pragma once
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+#include "../Types.hpp"
+#include "SpinLock.hpp"
+
+namespace CrossFire
+{
+
+/**
+ * @brief A sequence lock around a small, trivially copyable value.
+ * Readers never write shared memory: they copy the value and retry if a
+ * write overlapped the copy, so any number of readers proceed in parallel
+ * and never hold up a writer. Writers take a lock among themselves and
+ * bump the sequence around each publish.
+ * Suited to snapshots read every tick and written rarely, such as settings
+ * or a camera; large values make retries expensive.
+ * @tparam T The type of the value.
+ */
+template <typename T> class SeqLock {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "SeqLock values must be trivially copyable");
+
+    static constexpr usize WORDS = (sizeof(T) + sizeof(u64) - 1) / sizeof(u64);
+
+    // Odd while a write is in progress
+    std::atomic<u32> sequence;
+    SpinLock writers;
+
+    // The value lives in atomic words, so a read racing a write is defined
+    // and simply retried
+    std::atomic<u64> words[WORDS];
+
+    auto publish(const T &value) -> void
+    {
+        u64 buffer[WORDS] = {};
+        std::memcpy(buffer, &value, sizeof(T));
+
+        auto seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (usize i = 0; i < WORDS; i++)
+            words[i].store(buffer[i], std::memory_order_relaxed);
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+public:
+    /**
+     * @brief A guard using RAII that holds the write lock and publishes the
+     * value when it goes out of scope. Readers keep seeing the old value
+     * until then.
+     */
+    class WriteGuard {
+        SeqLock &seqlock;
+        T value;
+
+    public:
+        explicit WriteGuard(SeqLock &seqlock)
+            : seqlock(seqlock)
+        {
+            seqlock.writers.lock();
+            value = seqlock.load();
+        }
+        ~WriteGuard()
+        {
+            seqlock.publish(value);
+            seqlock.writers.unlock();
+        }
+
+        WriteGuard(const WriteGuard &other) = delete;
+        WriteGuard &operator=(const WriteGuard &other) = delete;
+
+        inline auto operator*() -> T &
+        {
+            return value;
+        }
+        inline auto operator->() -> T *
+        {
+            return &value;
+        }
+    };
+
+    /**
+     * @brief Creates a new sequence lock holding a value.
+     * @param value The initial value.
+     */
+    explicit SeqLock(const T &value = T())
+        : sequence(0)
+    {
+        u64 buffer[WORDS] = {};
+        std::memcpy(buffer, &value, sizeof(T));
+        for (usize i = 0; i < WORDS; i++)
+            words[i].store(buffer[i], std::memory_order_relaxed);
+    }
+
+    SeqLock(const SeqLock &other) = delete;
+    SeqLock &operator=(const SeqLock &other) = delete;
+
+    /**
+     * @brief Try to read the value once, without retrying.
+     * @param value Set to the value on success.
+     * @return True if no write overlapped the read, false otherwise.
+     */
+    auto try_load(T &value) const -> bool
+    {
+        auto before = sequence.load(std::memory_order_acquire);
+        if ((before & 1) != 0)
+            return false;
+
+        u64 buffer[WORDS];
+        for (usize i = 0; i < WORDS; i++)
+            buffer[i] = words[i].load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence.load(std::memory_order_relaxed) != before)
+            return false;
+
+        std::memcpy(&value, buffer, sizeof(T));
+        return true;
+    }
+
+    /**
+     * @brief Read a consistent copy of the value.
+     * @return The value.
+     */
+    auto load() const -> T
+    {
+        T value;
+        detail::Backoff backoff;
+        while (!try_load(value))
+            backoff.pause();
+        return value;
+    }
+
+    /**
+     * @brief Replace the value.
+     * @param value The new value.
+     */
+    auto store(const T &value) -> void
+    {
+        LockGuard<SpinLock> guard(writers);
+        publish(value);
+    }
+
+    /**
+     * @brief Get the number of writes so far, e.g. to skip work when the
+     * value has not changed since it was last read.
+     * @return The write count.
+     */
+    inline auto version() const -> u32
+    {
+        return sequence.load(std::memory_order_acquire) / 2;
+    }
+};
+
+}
\ No newline at end of file
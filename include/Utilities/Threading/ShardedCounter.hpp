@@ -0,0 +1,68 @@
+#pragma once
+#include <atomic>
+#include "../Types.hpp"
+#include "ThreadSlot.hpp"
+
+namespace CrossFire
+{
+
+/**
+ * @brief A counter for many threads to add to and few to read, such as
+ * statistics.
+ * Each thread adds to one of several slots on their own cache lines, so
+ * threads counting at once do not fight over a line; reading sums the
+ * slots. Adding is a relaxed atomic add to a line that usually stays in
+ * the thread's cache, and reading costs a load per slot, so it suits
+ * counters that are read rarely. A read taken while others add is not a
+ * snapshot of one instant, but every add lands in it or a later one.
+ */
+class ShardedCounter {
+    detail::PaddedSlot<std::atomic<u64> > shards[detail::THREAD_SLOTS];
+
+public:
+    ShardedCounter()
+    {
+        reset();
+    }
+    ~ShardedCounter() = default;
+
+    ShardedCounter(const ShardedCounter &other) = delete;
+    ShardedCounter &operator=(const ShardedCounter &other) = delete;
+
+    /**
+     * @brief Add to the counter. Sums wrap, so adding the two's complement
+     * of a value subtracts it.
+     * @param value The amount.
+     * @return The calling thread's slot after adding, e.g. to do something
+     * every so many counts without reading the whole counter.
+     */
+    inline auto add(u64 value = 1) -> u64
+    {
+        auto &shard = shards[detail::thread_slot()];
+        return shard.value.fetch_add(value, std::memory_order_relaxed) + value;
+    }
+
+    /**
+     * @brief Get the value, summed over the slots.
+     * @return The value.
+     */
+    inline auto load() const -> u64
+    {
+        u64 sum = 0;
+        for (u32 i = 0; i < detail::THREAD_SLOTS; i++)
+            sum += shards[i].value.load(std::memory_order_relaxed);
+        return sum;
+    }
+
+    /**
+     * @brief Set the counter back to zero. Adds made at the same time may
+     * be lost.
+     */
+    auto reset() -> void
+    {
+        for (u32 i = 0; i < detail::THREAD_SLOTS; i++)
+            shards[i].value.store(0, std::memory_order_relaxed);
+    }
+};
+
+}
\ No newline at end of file
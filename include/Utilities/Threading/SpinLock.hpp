@@ -1,5 +1,15 @@
 #pragma once
 #include <atomic>
+#include <functional>
+#include <thread>
+#include "../Types.hpp"
+#include "Futex.hpp"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && defined(_M_ARM64)
+#include <intrin.h>
+#endif
 
 namespace CrossFire
 {
@@ -25,29 +35,430 @@ private:
 };
 
 /**
- * @brief A simple spinlock.
+ * @brief How often a lock was found taken, for spotting hot locks.
+ */
+struct LockStats {
+    u32 contended;
+    u32 sleeps;
+};
+
+namespace detail
+{
+
+/**
+ * @brief Hint to the CPU that this is a spin-wait loop, which saves power
+ * and lets the other hyperthread run.
+ */
+inline auto cpu_relax() -> void
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_pause();
+#elif defined(_MSC_VER) && defined(_M_ARM64)
+    __yield();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#endif
+}
+
+// Most pause instructions in one round of backoff before yielding instead
+constexpr u32 SPIN_LIMIT = 64;
+
+/**
+ * @brief Exponential backoff for spin-waits: each round pauses twice as
+ * long as the last, and once past the spin budget the thread yields.
+ */
+class Backoff {
+    u32 count = 1;
+
+public:
+    /**
+     * @brief Check if the spin budget is left.
+     * @return True while rounds still spin, false once they yield.
+     */
+    inline auto spinning() const -> bool
+    {
+        return count <= SPIN_LIMIT;
+    }
+
+    /**
+     * @brief Wait for one round.
+     */
+    inline auto pause() -> void
+    {
+        if (count <= SPIN_LIMIT) {
+            for (u32 i = 0; i < count; i++)
+                cpu_relax();
+            count <<= 1;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+};
+
+}
+
+/**
+ * @brief A spinlock for short critical sections.
+ * Waiters spin on a plain load with exponential backoff rather than on the
+ * atomic exchange, so the cache line is only written when the lock looks
+ * free. Past the spin budget they sleep on a futex, unless
+ * CF_SPINLOCK_SPIN_ONLY is defined, in which case they keep yielding.
  */
 class SpinLock {
 public:
-    SpinLock() = default;
+    SpinLock()
+        : state(0)
+        , contended(0)
+        , sleeps(0)
+    {
+    }
     ~SpinLock() = default;
 
+    SpinLock(const SpinLock &other) = delete;
+    SpinLock &operator=(const SpinLock &other) = delete;
+
     auto lock() -> void
     {
-        while (flag.test_and_set(std::memory_order_acquire))
-            ;
+        u32 expected = 0;
+        if (!state.compare_exchange_strong(expected, 1,
+                                           std::memory_order_acquire,
+                                           std::memory_order_relaxed))
+            lock_slow();
     }
     auto try_lock() -> bool
     {
-        return !flag.test_and_set(std::memory_order_acquire);
+        u32 expected = 0;
+        return state.load(std::memory_order_relaxed) == 0 &&
+               state.compare_exchange_strong(expected, 1,
+                                             std::memory_order_acquire,
+                                             std::memory_order_relaxed);
     }
     auto unlock() -> void
     {
-        flag.clear(std::memory_order_release);
+#if defined(CF_SPINLOCK_SPIN_ONLY)
+        state.store(0, std::memory_order_release);
+#else
+        if (state.exchange(0, std::memory_order_release) == 2)
+            detail::futex_wake(state, 1);
+#endif
+    }
+
+    /**
+     * @brief Get how often the lock was found taken.
+     * @return The counts since construction or the last reset.
+     */
+    inline auto stats() const -> LockStats
+    {
+        return LockStats{ contended.load(std::memory_order_relaxed),
+                          sleeps.load(std::memory_order_relaxed) };
+    }
+
+    /**
+     * @brief Reset the contention counts.
+     */
+    inline auto reset_stats() -> void
+    {
+        contended.store(0, std::memory_order_relaxed);
+        sleeps.store(0, std::memory_order_relaxed);
     }
 
 private:
-    std::atomic_flag flag;
+    // 0 is unlocked, 1 locked, and 2 locked with threads asleep on it
+    std::atomic<u32> state;
+    std::atomic<u32> contended;
+    std::atomic<u32> sleeps;
+
+    auto lock_slow() -> void
+    {
+        contended.fetch_add(1, std::memory_order_relaxed);
+
+        detail::Backoff backoff;
+        while (backoff.spinning()) {
+            backoff.pause();
+            if (try_lock())
+                return;
+        }
+
+#if defined(CF_SPINLOCK_SPIN_ONLY)
+        for (;;) {
+            backoff.pause();
+            if (try_lock())
+                return;
+        }
+#else
+        // Whoever takes the lock from here on marks it 2, since other
+        // threads may still be asleep on it
+        while (state.exchange(2, std::memory_order_acquire) != 0) {
+            sleeps.fetch_add(1, std::memory_order_relaxed);
+            detail::futex_wait(state, 2);
+        }
+#endif
+    }
+};
+
+/**
+ * @brief A fair spinlock: threads take the lock in the order they asked
+ * for it, so none can starve under contention.
+ * Waiters back off in proportion to their place in line. A thread that is
+ * preempted while in line holds up everyone behind it, so prefer SpinLock
+ * when there are more threads than cores.
+ */
+class TicketLock {
+public:
+    TicketLock()
+        : next(0)
+        , serving(0)
+        , contended(0)
+    {
+    }
+    ~TicketLock() = default;
+
+    TicketLock(const TicketLock &other) = delete;
+    TicketLock &operator=(const TicketLock &other) = delete;
+
+    auto lock() -> void
+    {
+        auto ticket = next.fetch_add(1, std::memory_order_relaxed);
+        auto current = serving.load(std::memory_order_acquire);
+        if (current == ticket)
+            return;
+
+        contended.fetch_add(1, std::memory_order_relaxed);
+        u32 rounds = 0;
+        while (current != ticket) {
+            auto ahead = ticket - current;
+            if (++rounds > detail::SPIN_LIMIT) {
+                std::this_thread::yield();
+            } else {
+                for (u32 i = 0; i < ahead * 8; i++)
+                    detail::cpu_relax();
+            }
+            current = serving.load(std::memory_order_acquire);
+        }
+    }
+    auto try_lock() -> bool
+    {
+        auto current = serving.load(std::memory_order_relaxed);
+        auto expected = current;
+        return next.compare_exchange_strong(expected, current + 1,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed);
+    }
+    auto unlock() -> void
+    {
+        // Only the holder writes serving, so this needs no atomic add
+        auto current = serving.load(std::memory_order_relaxed);
+        serving.store(current + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Get how often the lock was found taken.
+     * @return The counts since construction or the last reset.
+     */
+    inline auto stats() const -> LockStats
+    {
+        return LockStats{ contended.load(std::memory_order_relaxed), 0 };
+    }
+
+    /**
+     * @brief Reset the contention counts.
+     */
+    inline auto reset_stats() -> void
+    {
+        contended.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<u32> next;
+    std::atomic<u32> serving;
+    std::atomic<u32> contended;
+};
+
+namespace detail
+{
+
+/**
+ * @brief A thread's place in the queue of an McsLock, on its own cache
+ * line so that each waiter spins on memory no other waiter touches.
+ */
+struct alignas(64) McsNode {
+    std::atomic<McsNode *> next;
+    std::atomic<bool> locked;
+};
+
+// McsLocks one thread can hold at once through lock() before further
+// nodes come from the heap
+constexpr u32 MCS_NODES = 16;
+
+struct McsNodes {
+    McsNode nodes[MCS_NODES];
+    u32 used = 0;
+};
+
+inline auto mcs_nodes() -> McsNodes &
+{
+    static thread_local McsNodes nodes;
+    return nodes;
+}
+
+}
+
+/**
+ * @brief A fair queue lock: each waiter spins on its own node and the
+ * holder hands the lock straight to the next one, so contention costs one
+ * cache line transfer per handover however many threads wait.
+ * lock() and unlock() take nodes from a per-thread set of 16, so a lock
+ * must be released on the thread that took it. A thread holding more than
+ * 16 McsLocks at once gets its further nodes from the heap, which is
+ * slower but still correct.
+ */
+class McsLock {
+public:
+    using Node = detail::McsNode;
+
+    McsLock()
+        : tail(nullptr)
+        , holder(nullptr)
+        , contended(0)
+    {
+    }
+    ~McsLock() = default;
+
+    McsLock(const McsLock &other) = delete;
+    McsLock &operator=(const McsLock &other) = delete;
+
+    /**
+     * @brief Take the lock, queueing on a caller-provided node that must
+     * stay alive until the matching unlock.
+     * @param node The node.
+     */
+    auto lock(Node &node) -> void
+    {
+        node.next.store(nullptr, std::memory_order_relaxed);
+        node.locked.store(true, std::memory_order_relaxed);
+
+        auto prev = tail.exchange(&node, std::memory_order_acq_rel);
+        if (prev == nullptr)
+            return;
+
+        contended.fetch_add(1, std::memory_order_relaxed);
+        prev->next.store(&node, std::memory_order_release);
+
+        detail::Backoff backoff;
+        while (node.locked.load(std::memory_order_acquire))
+            backoff.pause();
+    }
+
+    /**
+     * @brief Try to take the lock with a caller-provided node.
+     * @param node The node.
+     * @return True if the lock was taken, false otherwise.
+     */
+    auto try_lock(Node &node) -> bool
+    {
+        node.next.store(nullptr, std::memory_order_relaxed);
+        node.locked.store(false, std::memory_order_relaxed);
+
+        Node *expected = nullptr;
+        return tail.compare_exchange_strong(expected, &node,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Release the lock taken with a caller-provided node.
+     * @param node The node.
+     */
+    auto unlock(Node &node) -> void
+    {
+        auto next = node.next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            auto expected = &node;
+            if (tail.compare_exchange_strong(expected, nullptr,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed))
+                return;
+
+            // A waiter swapped itself in but has not linked up yet
+            while ((next = node.next.load(std::memory_order_acquire)) ==
+                   nullptr)
+                detail::cpu_relax();
+        }
+        next->locked.store(false, std::memory_order_release);
+    }
+
+    auto lock() -> void
+    {
+        auto node = acquire_node();
+        lock(*node);
+        holder = node;
+    }
+    auto try_lock() -> bool
+    {
+        auto node = acquire_node();
+        if (!try_lock(*node)) {
+            release_node(node);
+            return false;
+        }
+        holder = node;
+        return true;
+    }
+    auto unlock() -> void
+    {
+        auto node = holder;
+        unlock(*node);
+        release_node(node);
+    }
+
+    /**
+     * @brief Get how often the lock was found taken.
+     * @return The counts since construction or the last reset.
+     */
+    inline auto stats() const -> LockStats
+    {
+        return LockStats{ contended.load(std::memory_order_relaxed), 0 };
+    }
+
+    /**
+     * @brief Reset the contention counts.
+     */
+    inline auto reset_stats() -> void
+    {
+        contended.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<Node *> tail;
+    Node *holder;
+    std::atomic<u32> contended;
+
+    static auto acquire_node() -> Node *
+    {
+        auto &set = detail::mcs_nodes();
+        for (u32 i = 0; i < detail::MCS_NODES; i++) {
+            if ((set.used & (1U << i)) == 0) {
+                set.used |= 1U << i;
+                return &set.nodes[i];
+            }
+        }
+        return new Node();
+    }
+
+    static auto release_node(Node *node) -> void
+    {
+        auto &set = detail::mcs_nodes();
+        std::less<const Node *> before;
+        if (before(node, set.nodes) ||
+            !before(node, set.nodes + detail::MCS_NODES)) {
+            delete node;
+            return;
+        }
+
+        auto index = static_cast<u32>(node - set.nodes);
+        set.used &= ~(1U << index);
+    }
 };
 
 }
\ No newline at end of file
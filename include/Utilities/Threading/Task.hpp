@@ -0,0 +1,186 @@
+#pragma once
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "../Types.hpp"
+#include "ObjectPool.hpp"
+
+namespace CrossFire
+{
+
+namespace detail
+{
+
+// A task is one cache line; closures up to this size are stored inline
+#if defined(CF_THREADPOOL_STATS)
+constexpr usize TASK_STORAGE = 32;
+#else
+constexpr usize TASK_STORAGE = 40;
+#endif
+
+/**
+ * @brief The shared state of a submitted task and its TaskHandle.
+ */
+struct Completion {
+    std::atomic<u32> refs;
+    std::atomic<bool> done;
+    Completion *next;
+};
+
+inline auto release_completion(Completion *completion,
+                               ObjectPool<Completion> &pool) -> void
+{
+    if (completion->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        pool.release(completion);
+}
+
+/**
+ * @brief A type-erased closure with inline storage, recycled through an
+ * ObjectPool so that submitting it does not allocate.
+ */
+struct alignas(16) Task {
+    u8 storage[TASK_STORAGE];
+    // Runs the closure if asked to, then destroys it
+    void (*invoke)(Task *task, bool run);
+    Task *next;
+    Completion *completion;
+#if defined(CF_THREADPOOL_STATS)
+    // When the task was enqueued, in nanoseconds
+    u64 queued;
+#endif
+
+    /**
+     * @brief Store a closure in the task.
+     * Closures that do not fit inline are moved to the heap.
+     * @tparam F The type of the closure.
+     * @param f The closure.
+     */
+    template <typename F> auto bind(F &&f) -> void
+    {
+        using Closure = std::decay_t<F>;
+
+        if constexpr (sizeof(Closure) <= TASK_STORAGE &&
+                      alignof(Closure) <= alignof(Task)) {
+            new (storage) Closure(std::forward<F>(f));
+            invoke = [](Task *task, bool run) {
+                auto closure =
+                    std::launder(reinterpret_cast<Closure *>(task->storage));
+                if (run)
+                    (*closure)();
+                closure->~Closure();
+            };
+        } else {
+            new (storage) Closure *(new Closure(std::forward<F>(f)));
+            invoke = [](Task *task, bool run) {
+                auto closure = *std::launder(
+                    reinterpret_cast<Closure **>(task->storage));
+                if (run)
+                    (*closure)();
+                delete closure;
+            };
+        }
+    }
+
+    /**
+     * @brief Run the bound closure, then destroy it.
+     */
+    inline auto run() -> void
+    {
+        invoke(this, true);
+    }
+
+    /**
+     * @brief Destroy the bound closure without running it, e.g. when the
+     * task cannot be queued.
+     */
+    inline auto discard() -> void
+    {
+        invoke(this, false);
+    }
+};
+
+static_assert(sizeof(Task) == 64, "Task should fill one cache line");
+
+}
+
+/**
+ * @brief A handle to a task submitted with ThreadPool::submit().
+ * The completion state is pooled; the handle must not outlive its pool.
+ */
+class TaskHandle {
+    detail::Completion *completion;
+    ObjectPool<detail::Completion> *pool;
+
+public:
+    TaskHandle()
+        : completion(nullptr)
+        , pool(nullptr)
+    {
+    }
+
+    TaskHandle(detail::Completion *completion,
+               ObjectPool<detail::Completion> *pool)
+        : completion(completion)
+        , pool(pool)
+    {
+    }
+
+    TaskHandle(TaskHandle &&other) noexcept
+        : completion(other.completion)
+        , pool(other.pool)
+    {
+        other.completion = nullptr;
+    }
+
+    TaskHandle &operator=(TaskHandle &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            completion = other.completion;
+            pool = other.pool;
+            other.completion = nullptr;
+        }
+        return *this;
+    }
+
+    TaskHandle(const TaskHandle &other) = delete;
+    TaskHandle &operator=(const TaskHandle &other) = delete;
+
+    ~TaskHandle()
+    {
+        reset();
+    }
+
+    /**
+     * @brief Check if the handle refers to a task.
+     * @return True if the handle is valid, false otherwise.
+     */
+    inline auto valid() const -> bool
+    {
+        return completion != nullptr;
+    }
+
+    /**
+     * @brief Check if the task has finished. Its side effects are visible
+     * to the caller once this returns true.
+     * @return True if the task has finished, false otherwise.
+     */
+    inline auto is_done() const -> bool
+    {
+        return completion == nullptr ||
+               completion->done.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Let go of the task without waiting for it.
+     */
+    auto reset() -> void
+    {
+        if (completion != nullptr)
+            detail::release_completion(completion, *pool);
+        completion = nullptr;
+    }
+};
+
+}
\ No newline at end of file
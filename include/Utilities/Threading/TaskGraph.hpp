@@ -0,0 +1,444 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <limits>
+#include "../Types.hpp"
+#include "../Allocator.hpp"
+#include "../List.hpp"
+#include "../SegmentedList.hpp"
+#include "../Time.hpp"
+#include "Thread.hpp"
+
+namespace CrossFire
+{
+
+enum class TaskGraphError {
+    OutOfMemory,
+    Cycle,
+};
+
+/**
+ * @brief A graph of tasks with dependencies, built once and run any number
+ * of times on a ThreadPool.
+ * Each node counts its unfinished predecessors; the predecessor that
+ * brings the count to zero runs the node straight away as a continuation,
+ * and spawns any other node it released, so nothing blocks a worker.
+ * With profiling on, every node is timed and critical_path() reports the
+ * chain of nodes that bounds the run time.
+ */
+class TaskGraph final {
+public:
+    using Node = u32;
+
+private:
+    static constexpr Node NONE = std::numeric_limits<Node>::max();
+
+    struct NodeData {
+        std::function<void()> func;
+        const char *name;
+        u64 start;
+        u64 end;
+    };
+
+    struct Edge {
+        Node before;
+        Node after;
+    };
+
+    Allocator &allocator;
+    SegmentedList<NodeData> nodes;
+    List<Edge> edges;
+
+    // Compiled form: successors of node i are successors[offsets[i]..]
+    List<u32> offsets;
+    List<Node> successors;
+    List<u32> indegree;
+    List<Node> order;
+    Slice<std::atomic<u32> > pending;
+    bool dirty;
+
+    ThreadPool *pool;
+    std::atomic<u32> remaining;
+    bool profiling;
+    u64 run_start;
+    u64 run_end;
+
+    /**
+     * @brief Build the successor lists and a dependency order.
+     * @return Nothing -- or an error if allocation failed or the
+     * dependencies form a cycle.
+     */
+    auto compile() -> ResultVoid<TaskGraphError>
+    {
+        auto n = nodes.size();
+        offsets.clear();
+        successors.clear();
+        indegree.clear();
+        order.clear();
+
+        auto res = offsets.reserve(n + 1);
+        if (res.is_ok())
+            res = successors.reserve(edges.data.len);
+        if (res.is_ok())
+            res = indegree.reserve(n);
+        if (res.is_ok())
+            res = order.reserve(n);
+        if (res.is_err())
+            return TaskGraphError::OutOfMemory;
+
+        offsets.data.len = n + 1;
+        indegree.data.len = n;
+        successors.data.len = edges.data.len;
+        for (usize i = 0; i <= n; i++)
+            offsets.data.ptr[i] = 0;
+        for (usize i = 0; i < n; i++)
+            indegree.data.ptr[i] = 0;
+
+        for (usize e = 0; e < edges.data.len; e++) {
+            auto edge = edges.data.ptr[e];
+            offsets.data.ptr[edge.before + 1]++;
+            indegree.data.ptr[edge.after]++;
+        }
+        for (usize i = 0; i < n; i++)
+            offsets.data.ptr[i + 1] += offsets.data.ptr[i];
+
+        // Fill with a running cursor per node, then shift the offsets back
+        for (usize e = 0; e < edges.data.len; e++) {
+            auto edge = edges.data.ptr[e];
+            successors.data.ptr[offsets.data.ptr[edge.before]++] = edge.after;
+        }
+        for (usize i = n; i > 0; i--)
+            offsets.data.ptr[i] = offsets.data.ptr[i - 1];
+        offsets.data.ptr[0] = 0;
+
+        // Kahn's algorithm, which doubles as the cycle check
+        order.data.len = 0;
+        for (usize i = 0; i < n; i++) {
+            if (indegree.data.ptr[i] == 0)
+                order.data.ptr[order.data.len++] = static_cast<Node>(i);
+        }
+
+        auto counts = allocator.alloc<u32>(n);
+        if (counts.is_err())
+            return TaskGraphError::OutOfMemory;
+        auto left = counts.unwrap();
+        for (usize i = 0; i < n; i++)
+            left.ptr[i] = indegree.data.ptr[i];
+
+        for (usize i = 0; i < order.data.len; i++) {
+            auto node = order.data.ptr[i];
+            auto end = offsets.data.ptr[node + 1];
+            for (auto s = offsets.data.ptr[node]; s < end; s++) {
+                auto next = successors.data.ptr[s];
+                if (--left.ptr[next] == 0)
+                    order.data.ptr[order.data.len++] = next;
+            }
+        }
+        allocator.dealloc(left);
+
+        // Nodes on a cycle never reach zero, so they were never ordered
+        if (order.data.len != n)
+            return TaskGraphError::Cycle;
+
+        if (pending.len != n) {
+            if (pending.ptr != nullptr)
+                allocator.dealloc(pending);
+            pending = Slice<std::atomic<u32> >();
+
+            auto res = allocator.alloc<std::atomic<u32> >(n);
+            if (res.is_err())
+                return TaskGraphError::OutOfMemory;
+            pending = res.unwrap();
+            for (usize i = 0; i < n; i++)
+                new (&pending.ptr[i]) std::atomic<u32>(0);
+        }
+
+        dirty = false;
+        return Ok();
+    }
+
+    auto spawn_node(Node node) -> void
+    {
+        pool->spawn([this, node] { execute(node); });
+    }
+
+    auto execute(Node node) -> void
+    {
+        for (;;) {
+            auto &data = nodes[node];
+            if (profiling)
+                data.start = get_time_microseconds();
+            data.func();
+            if (profiling)
+                data.end = get_time_microseconds();
+
+            // Keep one released successor to run here, spawn the rest
+            Node next = NONE;
+            auto end = offsets.data.ptr[node + 1];
+            for (auto s = offsets.data.ptr[node]; s < end; s++) {
+                auto succ = successors.data.ptr[s];
+                auto left =
+                    pending.ptr[succ].fetch_sub(1, std::memory_order_acq_rel);
+                if (left == 1) {
+                    if (next != NONE)
+                        spawn_node(next);
+                    next = succ;
+                }
+            }
+
+            // Once this reaches zero run() may return, so the graph must not
+            // be touched afterwards
+            remaining.fetch_sub(1, std::memory_order_acq_rel);
+            if (next == NONE)
+                return;
+            node = next;
+        }
+    }
+
+public:
+    /**
+     * @brief Creates a new, empty task graph.
+     * @param allocator The allocator to use.
+     */
+    explicit TaskGraph(Allocator &allocator)
+        : allocator(allocator)
+        , nodes(allocator)
+        , edges(allocator)
+        , offsets(allocator)
+        , successors(allocator)
+        , indegree(allocator)
+        , order(allocator)
+        , pending()
+        , dirty(false)
+        , pool(nullptr)
+        , remaining(0)
+        , profiling(false)
+        , run_start(0)
+        , run_end(0)
+    {
+    }
+
+    ~TaskGraph()
+    {
+        if (pending.ptr != nullptr)
+            allocator.dealloc(pending);
+    }
+
+    TaskGraph(const TaskGraph &other) = delete;
+    TaskGraph &operator=(const TaskGraph &other) = delete;
+
+    /**
+     * @brief Get the number of nodes.
+     * @return The number of nodes.
+     */
+    inline auto size() const -> usize
+    {
+        return nodes.size();
+    }
+
+    /**
+     * @brief Adds a node to the graph.
+     * @tparam F The type of the function, which must not throw.
+     * @param f The function run each time the graph runs.
+     * @param name The name used in reports -- or nullptr.
+     * @return The node -- or an error if allocation failed.
+     */
+    template <typename F>
+    auto add(F &&f, const char *name = nullptr) -> Result<Node, AllocationError>
+    {
+        auto node = static_cast<Node>(nodes.size());
+        auto res = nodes.push(NodeData{ std::forward<F>(f), name, 0, 0 });
+        if (res.is_err())
+            return res.unwrap_err();
+
+        dirty = true;
+        return node;
+    }
+
+    /**
+     * @brief Make a node wait for another one. Cycles are reported by the
+     * next run() or critical_path().
+     * @param node The node.
+     * @param dependency The node that must finish first.
+     * @return Nothing -- or an error if allocation failed.
+     */
+    auto depends_on(Node node, Node dependency) -> ResultVoid<AllocationError>
+    {
+        cf_assert(node < nodes.size() && dependency < nodes.size(),
+                  "Node is not in the graph");
+        cf_assert(node != dependency, "Node cannot depend on itself");
+
+        auto res = edges.push(Edge{ dependency, node });
+        if (res.is_err())
+            return res.unwrap_err();
+
+        dirty = true;
+        return Ok();
+    }
+
+    /**
+     * @brief Removes every node and dependency.
+     */
+    auto clear() -> void
+    {
+        nodes.clear();
+        edges.clear();
+        dirty = true;
+    }
+
+    /**
+     * @brief Time every node on the following runs.
+     * @param enabled Whether to time the nodes.
+     */
+    inline auto set_profiling(bool enabled) -> void
+    {
+        profiling = enabled;
+    }
+
+    /**
+     * @brief Run every node once, in dependency order, and wait for them.
+     * The calling thread runs tasks from the pool while it waits, so it may
+     * be one of the pool's workers.
+     * @param thread_pool The pool to run on.
+     * @return Nothing -- or an error if allocation failed or the
+     * dependencies form a cycle, in which case no node runs.
+     */
+    auto run(ThreadPool &thread_pool) -> ResultVoid<TaskGraphError>
+    {
+        if (dirty) {
+            auto res = compile();
+            if (res.is_err())
+                return res.unwrap_err();
+        }
+
+        auto n = nodes.size();
+        if (n == 0)
+            return Ok();
+
+        pool = &thread_pool;
+        for (usize i = 0; i < n; i++)
+            pending.ptr[i].store(indegree.data.ptr[i],
+                                 std::memory_order_relaxed);
+        remaining.store(static_cast<u32>(n), std::memory_order_relaxed);
+
+        run_start = get_time_microseconds();
+        for (usize i = 0; i < n; i++) {
+            if (indegree.data.ptr[i] == 0)
+                spawn_node(static_cast<Node>(i));
+        }
+
+        while (remaining.load(std::memory_order_acquire) != 0) {
+            if (!thread_pool.run_pending())
+                std::this_thread::yield();
+        }
+        run_end = get_time_microseconds();
+
+        return Ok();
+    }
+
+    /**
+     * @brief Get the name of a node.
+     * @param node The node.
+     * @return The name -- or nullptr.
+     */
+    inline auto get_name(Node node) -> const char *
+    {
+        return nodes[node].name;
+    }
+
+    /**
+     * @brief Get how long a node took on the last profiled run.
+     * @param node The node.
+     * @return The duration in microseconds.
+     */
+    inline auto get_duration(Node node) -> u64
+    {
+        auto &data = nodes[node];
+        return data.end - data.start;
+    }
+
+    /**
+     * @brief Get how long the last run took, from start to the last node.
+     * @return The duration in microseconds.
+     */
+    inline auto get_run_duration() const -> u64
+    {
+        return run_end - run_start;
+    }
+
+    /**
+     * @brief Find the chain of dependent nodes with the longest total
+     * duration on the last profiled run. The run can never be shorter than
+     * this chain, so it is where optimizing pays off.
+     * @param path Filled with the nodes of the chain, first to last.
+     * @return The total duration of the chain in microseconds -- or an
+     * error if allocation failed or the dependencies form a cycle.
+     */
+    auto critical_path(List<Node> &path) -> Result<u64, TaskGraphError>
+    {
+        path.clear();
+        auto n = nodes.size();
+        if (n == 0)
+            return static_cast<u64>(0);
+
+        if (dirty) {
+            auto res = compile();
+            if (res.is_err())
+                return res.unwrap_err();
+        }
+
+        auto best_res = allocator.alloc<u64>(n);
+        if (best_res.is_err())
+            return TaskGraphError::OutOfMemory;
+        auto best = best_res.unwrap();
+
+        auto prev_res = allocator.alloc<Node>(n);
+        if (prev_res.is_err()) {
+            allocator.dealloc(best);
+            return TaskGraphError::OutOfMemory;
+        }
+        auto prev = prev_res.unwrap();
+
+        for (usize i = 0; i < n; i++) {
+            best.ptr[i] = get_duration(static_cast<Node>(i));
+            prev.ptr[i] = NONE;
+        }
+
+        Node last = 0;
+        for (usize i = 0; i < n; i++) {
+            auto node = order.data.ptr[i];
+            auto end = offsets.data.ptr[node + 1];
+            for (auto s = offsets.data.ptr[node]; s < end; s++) {
+                auto succ = successors.data.ptr[s];
+                auto length = best.ptr[node] + get_duration(succ);
+                if (length > best.ptr[succ]) {
+                    best.ptr[succ] = length;
+                    prev.ptr[succ] = node;
+                }
+            }
+            if (best.ptr[node] > best.ptr[last])
+                last = node;
+        }
+
+        u64 total = best.ptr[last];
+        ResultVoid<AllocationError> res = Ok();
+        for (auto node = last; node != NONE && res.is_ok();
+             node = prev.ptr[node])
+            res = path.push(node);
+
+        allocator.dealloc(prev);
+        allocator.dealloc(best);
+        if (res.is_err())
+            return TaskGraphError::OutOfMemory;
+
+        // The chain was collected back to front
+        for (usize i = 0, j = path.data.len - 1; i < j; i++, j--) {
+            auto tmp = path.data.ptr[i];
+            path.data.ptr[i] = path.data.ptr[j];
+            path.data.ptr[j] = tmp;
+        }
+        return total;
+    }
+};
+
+}
\ No newline at end of file
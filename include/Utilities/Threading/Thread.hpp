@@ -1,14 +1,22 @@
 #pragma once
+#include <cstdio>
 #include <functional>
 #include <thread>
 #include "../Types.hpp"
 #include "../Allocator.hpp"
+#include "../Time.hpp"
 #include "Utilities/List.hpp"
 #include "Utilities/TailQueue.hpp"
+#include "EventCount.hpp"
+#include "PoolStats.hpp"
+#include "Task.hpp"
+#include "ThreadContext.hpp"
+#include "Topology.hpp"
+#include "WorkStealingDeque.hpp"
 #include <atomic>
-#include <condition_variable>
-#include <queue>
 #include <future>
+#include <memory>
+#include <mutex>
 #include <tuple>
 
 namespace CrossFire
@@ -20,6 +28,21 @@ namespace CrossFire
 class Thread {
     std::thread thread;
     std::function<void()> function;
+    char name[16];
+    Option<u32> cpu;
+    ThreadPriority priority;
+    ThreadContextConfig context;
+
+    auto setup() -> void
+    {
+        init_thread_context(context);
+        if (name[0] != '\0')
+            set_current_thread_name(name);
+        if (cpu.has_value())
+            set_current_thread_affinity(*cpu);
+        if (priority != ThreadPriority::Normal)
+            set_current_thread_priority(priority);
+    }
 
 public:
     /**
@@ -30,7 +53,47 @@ public:
     template <typename F>
     explicit Thread(F &&f)
         : function(std::forward<F>(f))
+        , name{}
+        , cpu(std::nullopt)
+        , priority(ThreadPriority::Normal)
+        , context()
+    {
+    }
+
+    /**
+     * @brief Set the name the thread takes when it starts.
+     * @param thread_name The name, cut to 15 characters.
+     */
+    auto set_name(const char *thread_name) -> void
+    {
+        snprintf(name, sizeof(name), "%s", thread_name);
+    }
+
+    /**
+     * @brief Pin the thread to a CPU when it starts.
+     * @param cpu_id The id of the CPU, e.g. from CpuTopology::worker_cpu().
+     */
+    auto set_affinity(u32 cpu_id) -> void
     {
+        cpu = cpu_id;
+    }
+
+    /**
+     * @brief Set the priority the thread takes when it starts.
+     * @param thread_priority The priority.
+     */
+    auto set_priority(ThreadPriority thread_priority) -> void
+    {
+        priority = thread_priority;
+    }
+
+    /**
+     * @brief Set what the thread's context starts with.
+     * @param config The context's allocators, logger and profiler stream.
+     */
+    auto set_context(const ThreadContextConfig &config) -> void
+    {
+        context = config;
     }
 
     /**
@@ -41,8 +104,10 @@ public:
     template <typename... Args> auto start(Args &&...args) -> void
     {
         std::tuple<> args_tuple = std::make_tuple(std::forward<Args>(args)...);
-        thread = std::thread(
-            [this, args_tuple]() { std::apply(function, args_tuple); });
+        thread = std::thread([this, args_tuple]() {
+            setup();
+            std::apply(function, args_tuple);
+        });
     }
 
     /**
@@ -54,29 +119,113 @@ public:
     }
 };
 
+/**
+ * @brief How a ThreadPool sizes and places its workers.
+ */
+struct ThreadPoolConfig {
+    // The number of workers -- or None for CpuTopology::default_workers()
+    Option<usize> workers = std::nullopt;
+
+    // Workers are named "<name> <index>", cut to 15 characters
+    const char *name = "Worker";
+
+    // Pin each worker to the CPU picked by CpuTopology::worker_cpu()
+    bool pin = false;
+
+    // When pinning, use one hardware thread per core, for workers that
+    // saturate the vector units of a core on their own
+    bool avoid_smt = false;
+
+    // When pinning, the CPUs to leave to other threads such as the main one
+    usize reserved = 1;
+
+    ThreadPriority priority = ThreadPriority::Normal;
+
+    // What each worker's thread context starts with
+    ThreadContextConfig context = {};
+};
+
+/**
+ * @brief A work-stealing thread pool.
+ * Every worker owns a Chase-Lev deque. Tasks enqueued from a worker go to
+ * its own deque and are popped LIFO, so they run while their data is still
+ * in cache; tasks enqueued from other threads go to a shared injection
+ * queue. An idle worker steals the oldest task of a random victim; when
+ * there is nothing to steal it spins briefly, then sleeps on an event
+ * count, so enqueueing only pays for a wakeup when a worker is asleep.
+ * Tasks are pooled objects with inline closure storage, so spawn() and
+ * submit() do not allocate once the pools are warm.
+ * Building with CF_THREADPOOL_STATS makes the pool record how long tasks
+ * wait and run, how deep the queues get and how busy each worker is, for
+ * get_stats(); without it the counters are compiled out entirely.
+ */
 class ThreadPool {
+    using Task = detail::Task;
+
+    // Tasks a worker keeps for reuse before handing them back to the pool
+    static constexpr usize TASK_CACHE_SIZE = 64;
+
+    struct Worker {
+        WorkStealingDeque<Task *> deque;
+        Task *cache;
+        usize cached;
+        u32 seed;
+        char name[32];
+        Option<u32> cpu;
+#if defined(CF_THREADPOOL_STATS)
+        detail::StatCounters stats{ false };
+        WorkerStats baseline{};
+#endif
+
+        explicit Worker(u32 seed)
+            : deque(c_allocator)
+            , cache(nullptr)
+            , cached(0)
+            , seed(seed)
+            , name{}
+            , cpu(std::nullopt)
+        {
+        }
+    };
+
 public:
-    explicit ThreadPool(size_t numThreads)
-        : stop(false)
-    {
-        for (size_t i = 0; i < numThreads; ++i) {
-            workers.emplace_back([this] {
-                for (;;) {
-                    std::function<void()> task;
-                    {
-                        std::unique_lock<std::mutex> lock(this->queueMutex);
-                        this->condition.wait(lock, [this] {
-                            return this->stop || !this->tasks.empty();
-                        });
-                        if (this->stop && this->tasks.empty())
-                            return;
-                        task = std::move(this->tasks.front());
-                        this->tasks.pop();
-                    }
-                    task();
-                }
-            });
+    /**
+     * @brief Creates a pool sized and placed for this machine.
+     * @param config How to size and place the workers.
+     */
+    explicit ThreadPool(const ThreadPoolConfig &config = ThreadPoolConfig())
+        : task_pool(c_allocator)
+        , completion_pool(c_allocator)
+        , injected_head(nullptr)
+        , injected_tail(nullptr)
+        , waking(false)
+        , stop(false)
+        , injected_count(0)
+        , priority(config.priority)
+        , context_config(config.context)
+    {
+        auto &topology = CpuTopology::get();
+        auto count = config.workers.value_or(topology.default_workers());
+        spin = count < topology.cpu_count();
+
+        for (size_t i = 0; i < count; ++i) {
+            auto seed = static_cast<u32>(i) * 2654435761U + 1;
+            auto worker = std::make_unique<Worker>(seed);
+            snprintf(worker->name, sizeof(worker->name), "%s %u", config.name,
+                     static_cast<u32>(i));
+            if (config.pin)
+                worker->cpu =
+                    topology.worker_cpu(i, config.avoid_smt, config.reserved);
+            queues.emplace_back(std::move(worker));
         }
+
+        for (size_t i = 0; i < count; ++i)
+            workers.emplace_back([this, i] { run_worker(i); });
+    }
+
+    explicit ThreadPool(size_t numThreads)
+        : ThreadPool(ThreadPoolConfig{ numThreads })
+    {
     }
 
     template <class F, class... Args>
@@ -87,34 +236,481 @@ public:
         auto task = std::make_shared<std::packaged_task<return_type()> >(
             std::bind(std::forward<F>(f), std::forward<Args>(args)...));
         std::future<return_type> res = task->get_future();
-        {
-            std::unique_lock<std::mutex> lock(queueMutex);
-            if (stop)
-                throw std::runtime_error("enqueue on stopped ThreadPool");
-            tasks.emplace([task] { (*task)(); });
-        }
-        condition.notify_one();
+        push_task(make_task([task] { (*task)(); }, nullptr));
         return res;
     }
 
-    ~ThreadPool()
+    /**
+     * @brief Run a function on the pool without a way to wait for it.
+     * Closures of up to 40 bytes (32 with CF_THREADPOOL_STATS) are stored
+     * inline, so this does not allocate. The function must not throw.
+     * @tparam F The type of the function.
+     * @param f The function.
+     */
+    template <class F> auto spawn(F &&f) -> void
     {
-        {
-            std::unique_lock<std::mutex> lock(queueMutex);
-            stop = true;
+        push_task(make_task(std::forward<F>(f), nullptr));
+    }
+
+    /**
+     * @brief Run a function on the pool and get a handle to wait on.
+     * Closures of up to 40 bytes (32 with CF_THREADPOOL_STATS) are stored
+     * inline and the handle state is pooled, so this does not allocate.
+     * The function must not throw.
+     * @tparam F The type of the function.
+     * @param f The function.
+     * @return The handle.
+     */
+    template <class F> auto submit(F &&f) -> TaskHandle
+    {
+        auto completion = completion_pool.acquire().unwrap();
+        completion->refs.store(2, std::memory_order_relaxed);
+        completion->done.store(false, std::memory_order_relaxed);
+
+        push_task(make_task(std::forward<F>(f), completion));
+        return TaskHandle(completion, &completion_pool);
+    }
+
+    /**
+     * @brief Wait for a submitted task to finish.
+     * The calling thread runs other pending tasks while it waits, so a
+     * worker may wait on tasks it submitted without deadlocking the pool.
+     * @param handle The handle.
+     */
+    auto wait(const TaskHandle &handle) -> void
+    {
+        while (!handle.is_done()) {
+            if (!run_pending())
+                std::this_thread::yield();
         }
-        condition.notify_all();
+    }
+
+    /**
+     * @brief Run one pending task on the calling thread, if there is one.
+     * @return True if a task was run, false otherwise.
+     */
+    auto run_pending() -> bool
+    {
+        auto worker = current_worker();
+        auto task = worker.has_value() ? find_task(*worker) : find_external();
+        if (task == nullptr)
+            return false;
+
+        execute(task);
+        return true;
+    }
+
+    /**
+     * @brief Get the number of tasks queued on the calling worker's own
+     * deque, which other workers could steal.
+     * @return The number of tasks -- or 0 if the caller is not a worker of
+     * this pool.
+     */
+    inline auto local_pending() const -> usize
+    {
+        auto worker = current_worker();
+        return worker.has_value() ? queues[*worker]->deque.size() : 0;
+    }
+
+    /**
+     * @brief Get the number of worker threads.
+     * @return The number of workers.
+     */
+    inline auto size() const -> usize
+    {
+        return workers.size();
+    }
+
+    /**
+     * @brief Get the index of the worker running the calling thread.
+     * @return The worker index -- or None if the caller is not a worker of
+     * this pool.
+     */
+    inline auto current_worker() const -> Option<usize>
+    {
+        // Read the slot directly, so asking does not set up a context
+        auto &context = detail::thread_context_slot();
+        if (context.pool != this)
+            return std::nullopt;
+        return context.worker;
+    }
+
+    /**
+     * @brief Get what the pool has done since its stats were last reset.
+     * Each worker only ever writes its own counters, so this may see a
+     * task half-recorded but never blocks the workers. Not safe to call
+     * concurrently with reset_stats().
+     * @return The stats -- or all zeros unless built with
+     * CF_THREADPOOL_STATS.
+     */
+    auto get_stats() const -> ThreadPoolStats
+    {
+        ThreadPoolStats stats{};
+#if defined(CF_THREADPOOL_STATS)
+        stats.elapsed = get_time_nanoseconds() - stats_start;
+        for (auto &queue : queues) {
+            stats.workers.push_back(queue->stats.read(
+                queue->baseline, stats.elapsed, queue->deque.size()));
+            stats.total.merge(stats.workers.back());
+        }
+
+        stats.external = external_stats.read(
+            external_baseline, stats.elapsed,
+            injected_count.load(std::memory_order_relaxed));
+        stats.total.merge(stats.external);
+
+        // Averaged over the workers; external threads only add busy time
+        f64 utilization = 0.0;
+        for (auto &worker : stats.workers)
+            utilization += worker.utilization;
+        stats.total.utilization =
+            stats.workers.empty() ? 0.0 : utilization / stats.workers.size();
+
+        stats.wakeups = wakeups.load(std::memory_order_relaxed) -
+                        wakeups_baseline;
+        stats.injected_depth = injected_count.load(std::memory_order_relaxed);
+        stats.peak_injected_depth = static_cast<usize>(
+            peak_injected.load(std::memory_order_relaxed));
+#endif
+        return stats;
+    }
+
+    /**
+     * @brief Start counting afresh, e.g. at the start of a frame.
+     * Maximums and peaks are kept. Not safe to call concurrently with
+     * get_stats().
+     */
+    auto reset_stats() -> void
+    {
+#if defined(CF_THREADPOOL_STATS)
+        for (auto &queue : queues)
+            queue->baseline = queue->stats.baseline();
+        external_baseline = external_stats.baseline();
+        wakeups_baseline = wakeups.load(std::memory_order_relaxed);
+        stats_start = get_time_nanoseconds();
+#endif
+    }
+
+    ~ThreadPool()
+    {
+        stop = true;
+        idle.notify_all();
         for (std::thread &worker : workers) {
             worker.join();
         }
     }
 
 private:
+    template <class F>
+    auto make_task(F &&f, detail::Completion *completion) -> Task *
+    {
+        auto worker = current_worker();
+        Task *task;
+        if (worker.has_value() && queues[*worker]->cache != nullptr) {
+            auto &self = *queues[*worker];
+            task = self.cache;
+            self.cache = task->next;
+            self.cached--;
+        } else {
+            task = task_pool.acquire().unwrap();
+        }
+
+        task->bind(std::forward<F>(f));
+        task->completion = completion;
+        return task;
+    }
+
+    auto recycle(Task *task) -> void
+    {
+        auto worker = current_worker();
+        if (!worker.has_value()) {
+            task_pool.release(task);
+            return;
+        }
+
+        auto &self = *queues[*worker];
+        if (self.cached == TASK_CACHE_SIZE) {
+            // Hand the whole cache back in one lock
+            auto tail = self.cache;
+            while (tail->next != nullptr)
+                tail = tail->next;
+            task_pool.release_chain(self.cache, tail);
+            self.cache = nullptr;
+            self.cached = 0;
+        }
+
+        task->next = self.cache;
+        self.cache = task;
+        self.cached++;
+    }
+
+    auto execute(Task *task) -> void
+    {
+#if defined(CF_THREADPOOL_STATS)
+        auto worker = current_worker();
+        auto &counters =
+            worker.has_value() ? queues[*worker]->stats : external_stats;
+        auto depth = worker.has_value()
+                         ? queues[*worker]->deque.size()
+                         : injected_count.load(std::memory_order_relaxed);
+        auto start = get_time_nanoseconds();
+        auto waited = start > task->queued ? start - task->queued : 0;
+        task->run();
+        counters.record(waited, get_time_nanoseconds() - start, depth);
+#else
+        task->run();
+#endif
+
+        auto completion = task->completion;
+        if (completion != nullptr) {
+            completion->done.store(true, std::memory_order_release);
+            detail::release_completion(completion, completion_pool);
+        }
+
+        recycle(task);
+    }
+
+    auto push_task(Task *task) -> void
+    {
+#if defined(CF_THREADPOOL_STATS)
+        task->queued = get_time_nanoseconds();
+#endif
+        auto worker = current_worker();
+        if (!worker.has_value() ||
+            queues[*worker]->deque.push(task).is_err()) {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            if (stop) {
+                lock.unlock();
+                task->discard();
+                if (task->completion != nullptr)
+                    completion_pool.release(task->completion);
+                task_pool.release(task);
+                throw std::runtime_error("enqueue on stopped ThreadPool");
+            }
+
+            task->next = nullptr;
+            if (injected_tail != nullptr)
+                injected_tail->next = task;
+            else
+                injected_head = task;
+            injected_tail = task;
+            injected_count.fetch_add(1, std::memory_order_relaxed);
+#if defined(CF_THREADPOOL_STATS)
+            detail::StatCounters::raise(
+                peak_injected, injected_count.load(std::memory_order_relaxed));
+#endif
+        }
+
+        wake_worker();
+    }
+
+    /**
+     * @brief Wake a sleeping worker, unless one was woken and has not yet
+     * looked for tasks -- it will find this one too.
+     */
+    auto wake_worker() -> void
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waking.load(std::memory_order_relaxed) ||
+            waking.exchange(true, std::memory_order_seq_cst))
+            return;
+
+        if (!idle.notify())
+            waking.store(false, std::memory_order_relaxed);
+#if defined(CF_THREADPOOL_STATS)
+        else
+            wakeups.fetch_add(1, std::memory_order_relaxed);
+#endif
+    }
+
+    auto has_work() const -> bool
+    {
+        if (injected_count.load(std::memory_order_relaxed) > 0)
+            return true;
+
+        for (auto &queue : queues) {
+            if (!queue->deque.empty())
+                return true;
+        }
+        return false;
+    }
+
+    auto pop_injected() -> Task *
+    {
+        if (injected_count.load(std::memory_order_relaxed) == 0)
+            return nullptr;
+
+        std::unique_lock<std::mutex> lock(queueMutex);
+        auto task = injected_head;
+        if (task != nullptr) {
+            injected_head = task->next;
+            if (injected_head == nullptr)
+                injected_tail = nullptr;
+            injected_count.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return task;
+    }
+
+    auto steal(usize start, usize skip) -> Task *
+    {
+        auto count = queues.size();
+        for (usize i = 0; i < count; i++) {
+            auto victim = (start + i) % count;
+            if (victim == skip)
+                continue;
+
+            if (auto task = queues[victim]->deque.steal())
+                return *task;
+        }
+        return nullptr;
+    }
+
+    auto find_task(usize index) -> Task *
+    {
+        auto &self = *queues[index];
+        if (auto task = self.deque.pop())
+            return *task;
+
+        if (auto task = pop_injected())
+            return task;
+
+        // Start at a random victim so thieves spread out
+        self.seed ^= self.seed << 13;
+        self.seed ^= self.seed >> 17;
+        self.seed ^= self.seed << 5;
+        auto task = steal(self.seed % queues.size(), index);
+#if defined(CF_THREADPOOL_STATS)
+        if (task != nullptr)
+            self.stats.add(self.stats.steals, 1);
+#endif
+        return task;
+    }
+
+    auto find_external() -> Task *
+    {
+        if (auto task = pop_injected())
+            return task;
+
+        if (queues.empty())
+            return nullptr;
+        auto task = steal(0, queues.size());
+#if defined(CF_THREADPOOL_STATS)
+        if (task != nullptr)
+            external_stats.add(external_stats.steals, 1);
+#endif
+        return task;
+    }
+
+    /**
+     * @brief Sleep until a task is submitted.
+     * @return False if the pool is stopping and has no work left.
+     */
+    auto park() -> bool
+    {
+        auto running = wait_for_work();
+
+        // Whichever worker leaves park() next looks for the pending tasks
+        waking.exchange(false, std::memory_order_seq_cst);
+        return running;
+    }
+
+    auto wait_for_work() -> bool
+    {
+        // Work often follows within microseconds, so spin before sleeping
+        // -- unless spinning would take the CPU from a thread with work
+        detail::Backoff backoff;
+        while (spin && backoff.spinning()) {
+            if (has_work())
+                return true;
+            backoff.pause();
+        }
+
+        auto key = idle.prepare_wait();
+        if (has_work()) {
+            idle.cancel_wait();
+            return true;
+        }
+        if (stop) {
+            idle.cancel_wait();
+            return false;
+        }
+
+#if defined(CF_THREADPOOL_STATS)
+        auto &stats = queues[detail::thread_context_slot().worker]->stats;
+        auto start = get_time_nanoseconds();
+        idle.commit_wait(key);
+        stats.add(stats.idle, get_time_nanoseconds() - start);
+        stats.add(stats.sleeps, 1);
+#else
+        idle.commit_wait(key);
+#endif
+        return true;
+    }
+
+    auto run_worker(usize index) -> void
+    {
+        auto &context = init_thread_context(context_config);
+        context.pool = this;
+        context.worker = index;
+
+        auto &worker = *queues[index];
+        set_current_thread_name(worker.name);
+        if (worker.cpu.has_value())
+            set_current_thread_affinity(*worker.cpu);
+        if (priority != ThreadPriority::Normal)
+            set_current_thread_priority(priority);
+
+        bool woken = false;
+        for (;;) {
+            auto task = find_task(index);
+            if (task != nullptr) {
+                // Wake workers one at a time while tasks are left over
+                if (woken && has_work())
+                    wake_worker();
+                woken = false;
+                execute(task);
+            } else if (park()) {
+                woken = true;
+            } else {
+                break;
+            }
+        }
+
+        // Return the cached tasks before the pool is torn down
+        auto &self = *queues[index];
+        while (self.cache != nullptr) {
+            auto task = self.cache;
+            self.cache = task->next;
+            task_pool.release(task);
+        }
+        self.cached = 0;
+
+        context.pool = nullptr;
+        context.worker = 0;
+    }
+
+    ObjectPool<Task> task_pool;
+    ObjectPool<detail::Completion> completion_pool;
     std::vector<std::thread> workers;
-    std::queue<std::function<void()> > tasks;
+    std::vector<std::unique_ptr<Worker> > queues;
+    Task *injected_head;
+    Task *injected_tail;
     std::mutex queueMutex;
-    std::condition_variable condition;
+    EventCount idle;
+    std::atomic_bool waking;
     std::atomic_bool stop;
+    std::atomic<usize> injected_count;
+    ThreadPriority priority;
+    ThreadContextConfig context_config;
+    bool spin;
+#if defined(CF_THREADPOOL_STATS)
+    detail::StatCounters external_stats{ true };
+    WorkerStats external_baseline{};
+    std::atomic<u64> wakeups{ 0 };
+    u64 wakeups_baseline = 0;
+    std::atomic<u64> peak_injected{ 0 };
+    u64 stats_start = get_time_nanoseconds();
+#endif
 };
 
 }
\ No newline at end of file
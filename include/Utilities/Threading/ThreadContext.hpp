@@ -0,0 +1,109 @@
+#pragma once
+#include "../Types.hpp"
+#include "../Allocator.hpp"
+#include "../IO.hpp"
+#include "../Logger.hpp"
+
+namespace CrossFire
+{
+
+/**
+ * @brief What a thread's context starts with. Fields left unset fall back
+ * to the process-wide defaults.
+ */
+struct ThreadContextConfig {
+    // The allocator for the thread's own allocations -- or nullptr for
+    // c_allocator
+    Allocator *allocator = nullptr;
+
+    // Bytes of scratch memory to take from the allocator up front -- or 0
+    // to use the allocator itself for scratch
+    usize scratch_size = 0;
+
+    // The thread's logger -- or nullptr for Logger::get_stdout(). A logger
+    // per thread, on its own writer, keeps logging free of contention
+    Logger *logger = nullptr;
+
+    // Where the thread writes profiling records -- or nullptr for nowhere
+    Writer *profiler = nullptr;
+};
+
+/**
+ * @brief Everything that belongs to one thread, in a single thread-local
+ * block, so hot code pays one thread-local lookup and then plain loads
+ * instead of going through globals or several thread_locals.
+ * Thread and ThreadPool set it up when their threads start; any other
+ * thread gets the defaults the first time it asks.
+ */
+struct ThreadContext {
+    // Small and dense: ids of exited threads are given out again, so they
+    // stay below the number of threads alive at once
+    u32 id;
+    bool initialized;
+
+    // The pool the thread works for and its index there, if it is a worker
+    const void *pool;
+    usize worker;
+
+    // For allocations that outlive the current piece of work
+    Allocator *allocator;
+
+    // For allocations only this thread uses and drops soon; when it is the
+    // thread's own arena, reset_thread_scratch() frees them all at once
+    Allocator *scratch;
+    LinearAllocator *arena;
+
+    Logger *logger;
+    Writer *profiler;
+};
+
+namespace detail
+{
+
+inline auto thread_context_slot() -> ThreadContext &
+{
+    static thread_local ThreadContext context{};
+    return context;
+}
+
+}
+
+/**
+ * @brief Set up the calling thread's context, replacing the one it had.
+ * @param config What the context starts with.
+ * @return The context.
+ */
+auto init_thread_context(const ThreadContextConfig &config) -> ThreadContext &;
+
+/**
+ * @brief Get the calling thread's context, setting up the defaults on
+ * first use.
+ * @return The context.
+ */
+inline auto thread_context() -> ThreadContext &
+{
+    auto &context = detail::thread_context_slot();
+    if (!context.initialized)
+        return init_thread_context(ThreadContextConfig());
+    return context;
+}
+
+/**
+ * @brief Get one more than the highest thread id given out so far, e.g. to
+ * size an array indexed by thread id.
+ * @return The bound.
+ */
+auto thread_id_limit() -> u32;
+
+/**
+ * @brief Free everything in the calling thread's scratch arena at once, if
+ * it has one. Nothing allocated from it may be used afterwards.
+ */
+inline auto reset_thread_scratch() -> void
+{
+    auto &context = thread_context();
+    if (context.arena != nullptr)
+        context.arena->reset();
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+#include <atomic>
+#include "../Types.hpp"
+
+namespace CrossFire
+{
+
+namespace detail
+{
+
+// Slots per structure that spreads threads over cache lines, such as the
+// reader counters of an RWLock; threads are handed slots round-robin
+constexpr u32 THREAD_SLOTS = 16;
+
+/**
+ * @brief A value on a cache line of its own.
+ * @tparam T The type of the value.
+ */
+template <typename T> struct alignas(64) PaddedSlot {
+    T value;
+};
+
+/**
+ * @brief Get the slot this thread uses in every structure with
+ * THREAD_SLOTS slots.
+ * @return The slot index.
+ */
+inline auto thread_slot() -> u32
+{
+    static std::atomic<u32> next{ 0 };
+    static thread_local u32 slot =
+        next.fetch_add(1, std::memory_order_relaxed) % THREAD_SLOTS;
+    return slot;
+}
+
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,426 @@
+#pragma once
+#include <functional>
+#include "../Types.hpp"
+#include "../Allocator.hpp"
+#include "../SegmentedList.hpp"
+#include "../Time.hpp"
+#include "../ByteOps.hpp"
+#include "SpinLock.hpp"
+#include "Thread.hpp"
+
+namespace CrossFire
+{
+
+/**
+ * @brief A hierarchical timing wheel for delayed and periodic callbacks.
+ * Time is counted in ticks of a fixed resolution. Four levels of 256 slots
+ * cover 2^32 ticks -- 49 days at a millisecond -- and a timer sits in the
+ * slot of the coarsest level its delay needs, moving down a level each
+ * time that slot comes round, so scheduling and cancelling are O(1) and a
+ * tick only touches the timers that are due. Longer delays are parked in
+ * the top level and re-placed when it comes round.
+ * Timers fire from advance(), on a ThreadPool or on the calling thread.
+ * Every operation takes a lock, and callbacks run outside it, so they may
+ * schedule and cancel timers themselves.
+ */
+class TimerWheel final {
+public:
+    using TimerId = u64;
+
+private:
+    static constexpr u32 LEVELS = 4;
+    static constexpr u32 SLOT_BITS = 8;
+    static constexpr u32 SLOTS = 1 << SLOT_BITS;
+    static constexpr u32 SLOT_MASK = SLOTS - 1;
+    static constexpr u32 NONE = 0xFFFFFFFF;
+
+    struct Node {
+        std::function<void()> func;
+        u64 deadline;
+        u64 period;
+        u32 next;
+        u32 prev;
+        u32 generation;
+        u32 slot;
+    };
+
+    SpinLock lock;
+    SegmentedList<Node> nodes;
+    u32 free_head;
+    usize active;
+
+    u64 resolution;
+    u64 current;
+    // expire() failed part way, leaving due timers in the current tick's
+    // level 0 slot, which the next advance() must empty before moving on
+    bool stalled;
+    u32 heads[LEVELS * SLOTS];
+    u64 occupied[LEVELS][SLOTS / 64];
+
+    // Callbacks due in the current advance(), run once the lock is dropped
+    SegmentedList<std::function<void()> > due;
+
+    static inline auto make_id(u32 index, u32 generation) -> TimerId
+    {
+        return (static_cast<u64>(generation) << 32) | index;
+    }
+
+    auto link(u32 index) -> void
+    {
+        auto &node = nodes[index];
+        auto delta = node.deadline - current;
+        auto tick = node.deadline;
+
+        u32 level = 0;
+        while (level < LEVELS - 1 &&
+               delta >= (static_cast<u64>(1) << (SLOT_BITS * (level + 1))))
+            level++;
+
+        // Too far off even for the top level: park it a full turn ahead
+        if (level == LEVELS - 1 &&
+            delta >= (static_cast<u64>(1) << (SLOT_BITS * LEVELS)))
+            tick = current + (static_cast<u64>(1) << (SLOT_BITS * LEVELS)) - 1;
+
+        auto slot = static_cast<u32>((tick >> (SLOT_BITS * level)) & SLOT_MASK);
+        auto bucket = level * SLOTS + slot;
+
+        node.slot = bucket;
+        node.prev = NONE;
+        node.next = heads[bucket];
+        if (node.next != NONE)
+            nodes[node.next].prev = index;
+        heads[bucket] = index;
+        occupied[level][slot / 64] |= static_cast<u64>(1) << (slot % 64);
+    }
+
+    auto unlink(u32 index) -> void
+    {
+        auto &node = nodes[index];
+        auto bucket = node.slot;
+        if (node.prev != NONE)
+            nodes[node.prev].next = node.next;
+        else
+            heads[bucket] = node.next;
+        if (node.next != NONE)
+            nodes[node.next].prev = node.prev;
+
+        if (heads[bucket] == NONE) {
+            auto level = bucket / SLOTS;
+            auto slot = bucket % SLOTS;
+            occupied[level][slot / 64] &= ~(static_cast<u64>(1) << (slot % 64));
+        }
+        node.slot = NONE;
+    }
+
+    auto release(u32 index) -> void
+    {
+        auto &node = nodes[index];
+        node.func = nullptr;
+        node.generation++;
+        node.next = free_head;
+        free_head = index;
+        active--;
+    }
+
+    /**
+     * @brief Take every timer out of a slot and place it again from the
+     * current tick, which moves it down a level.
+     */
+    auto cascade(u32 level) -> void
+    {
+        auto slot = static_cast<u32>((current >> (SLOT_BITS * level)) &
+                                     SLOT_MASK);
+        auto bucket = level * SLOTS + slot;
+        auto index = heads[bucket];
+        heads[bucket] = NONE;
+        occupied[level][slot / 64] &= ~(static_cast<u64>(1) << (slot % 64));
+
+        while (index != NONE) {
+            auto next = nodes[index].next;
+            link(index);
+            index = next;
+        }
+    }
+
+    /**
+     * @brief Move every timer of the current tick's level 0 slot to the
+     * due list, re-arming the periodic ones.
+     * @param target The tick advance() is going to, which periodic timers
+     * are re-armed past.
+     */
+    auto expire(u64 target) -> ResultVoid<AllocationError>
+    {
+        auto slot = static_cast<u32>(current & SLOT_MASK);
+        auto index = heads[slot];
+        heads[slot] = NONE;
+        occupied[0][slot / 64] &= ~(static_cast<u64>(1) << (slot % 64));
+
+        while (index != NONE) {
+            auto &node = nodes[index];
+            auto next = node.next;
+            node.slot = NONE;
+
+            auto res = due.push(nullptr);
+            if (res.is_err()) {
+                // Put the rest back in this slot for advance() to retry
+                for (; index != NONE; index = next) {
+                    next = nodes[index].next;
+                    link(index);
+                }
+                return res.unwrap_err();
+            }
+
+            if (node.period == 0) {
+                *res.unwrap() = std::move(node.func);
+                release(index);
+            } else {
+                *res.unwrap() = node.func;
+
+                // Skip the periods missed while advance() was not called
+                auto behind = target - node.deadline;
+                node.deadline += (behind / node.period + 1) * node.period;
+                link(index);
+            }
+            index = next;
+        }
+        return Ok();
+    }
+
+    /**
+     * @brief Find the first occupied slot of a level, going round the
+     * wheel from a slot.
+     * @return The number of slots from the start to it -- or SLOTS if the
+     * level is empty.
+     */
+    auto next_occupied(u32 level, u32 start) const -> u32
+    {
+        for (u32 distance = 0; distance < SLOTS + 64;) {
+            auto slot = (start + distance) & SLOT_MASK;
+            auto word = occupied[level][slot / 64] >> (slot % 64);
+            if (word != 0) {
+                distance += detail::lowest_bit(word);
+                return distance < SLOTS ? distance : SLOTS;
+            }
+            distance += 64 - slot % 64;
+        }
+        return SLOTS;
+    }
+
+    /**
+     * @brief Find the next tick with work on it: a level 0 slot to expire
+     * or a slot higher up to cascade. Ticks in between need nothing, so
+     * advance() jumps straight over them.
+     * @return The tick -- or the limit if nothing happens before it.
+     */
+    auto next_tick(u64 limit) const -> u64
+    {
+        auto next = limit;
+        for (u32 level = 0; level < LEVELS; level++) {
+            auto position = (current >> (SLOT_BITS * level)) + 1;
+            auto distance =
+                next_occupied(level, static_cast<u32>(position & SLOT_MASK));
+            if (distance == SLOTS)
+                continue;
+
+            auto tick = (position + distance) << (SLOT_BITS * level);
+            if (tick < next)
+                next = tick;
+        }
+        return next;
+    }
+
+    /**
+     * @brief Add a timer.
+     * @param ticks The deadline in ticks -- or the delay in ticks from the
+     * current tick if relative.
+     */
+    template <typename F>
+    auto add(u64 ticks, bool relative, u64 period, F &&f)
+        -> Result<TimerId, AllocationError>
+    {
+        LockGuard<SpinLock> guard(lock);
+        auto deadline = relative ? current + ticks : ticks;
+        if (deadline <= current)
+            deadline = current + 1;
+
+        u32 index = free_head;
+        if (index != NONE) {
+            free_head = nodes[index].next;
+        } else {
+            index = static_cast<u32>(nodes.size());
+            auto res =
+                nodes.push(Node{ nullptr, 0, 0, NONE, NONE, 0, NONE });
+            if (res.is_err())
+                return res.unwrap_err();
+        }
+
+        auto &node = nodes[index];
+        node.func = std::forward<F>(f);
+        node.deadline = deadline;
+        node.period = period;
+        link(index);
+        active++;
+        return make_id(index, node.generation);
+    }
+
+public:
+    /**
+     * @brief Creates a new, empty timer wheel.
+     * @param allocator The allocator to use.
+     * @param resolution The length of a tick in microseconds; deadlines are
+     * rounded up to whole ticks.
+     * @param now The current time in microseconds.
+     */
+    explicit TimerWheel(Allocator &allocator, u64 resolution = 1000,
+                        u64 now = get_time_microseconds())
+        : nodes(allocator)
+        , free_head(NONE)
+        , active(0)
+        , resolution(resolution)
+        , current(now / resolution)
+        , stalled(false)
+        , due(allocator)
+    {
+        cf_assert(resolution > 0, "TimerWheel resolution must be positive");
+        for (u32 i = 0; i < LEVELS * SLOTS; i++)
+            heads[i] = NONE;
+        for (u32 level = 0; level < LEVELS; level++) {
+            for (u32 i = 0; i < SLOTS / 64; i++)
+                occupied[level][i] = 0;
+        }
+    }
+
+    TimerWheel(const TimerWheel &other) = delete;
+    TimerWheel &operator=(const TimerWheel &other) = delete;
+
+    /**
+     * @brief Get the number of pending timers.
+     * @return The number of timers.
+     */
+    inline auto size() -> usize
+    {
+        LockGuard<SpinLock> guard(lock);
+        return active;
+    }
+
+    /**
+     * @brief Run a function once at a point in time.
+     * @tparam F The type of the function, which must not throw.
+     * @param time The time in microseconds, as from get_time_microseconds().
+     * @param f The function.
+     * @return The timer -- or an error if allocation failed.
+     */
+    template <typename F>
+    auto schedule_at(u64 time, F &&f) -> Result<TimerId, AllocationError>
+    {
+        auto deadline = (time + resolution - 1) / resolution;
+        return add(deadline, false, 0, std::forward<F>(f));
+    }
+
+    /**
+     * @brief Run a function once after a delay.
+     * @tparam F The type of the function, which must not throw.
+     * @param delay The delay in microseconds, from the last advance().
+     * @param f The function.
+     * @return The timer -- or an error if allocation failed.
+     */
+    template <typename F>
+    auto schedule_after(u64 delay, F &&f) -> Result<TimerId, AllocationError>
+    {
+        auto ticks = (delay + resolution - 1) / resolution;
+        return add(ticks, true, 0, std::forward<F>(f));
+    }
+
+    /**
+     * @brief Run a function repeatedly. Periods missed because advance()
+     * was not called in time are skipped rather than run back to back.
+     * @tparam F The type of the function, which must not throw.
+     * @param period The period in microseconds, at least one tick.
+     * @param f The function.
+     * @return The timer -- or an error if allocation failed.
+     */
+    template <typename F>
+    auto schedule_every(u64 period, F &&f) -> Result<TimerId, AllocationError>
+    {
+        auto ticks = (period + resolution - 1) / resolution;
+        if (ticks == 0)
+            ticks = 1;
+        return add(ticks, true, ticks, std::forward<F>(f));
+    }
+
+    /**
+     * @brief Cancel a timer. A callback already handed to the pool still
+     * runs.
+     * @param id The timer.
+     * @return True if the timer was pending, false otherwise.
+     */
+    auto cancel(TimerId id) -> bool
+    {
+        LockGuard<SpinLock> guard(lock);
+        auto index = static_cast<u32>(id);
+        auto generation = static_cast<u32>(id >> 32);
+        if (index >= nodes.size())
+            return false;
+
+        auto &node = nodes[index];
+        if (node.generation != generation || node.slot == NONE)
+            return false;
+
+        unlink(index);
+        release(index);
+        return true;
+    }
+
+    /**
+     * @brief Fire every timer due up to a point in time. Call it from one
+     * thread at a time, such as once per frame from the main loop.
+     * Empty slots are skipped, so advancing over a long pause costs about
+     * as much as the timers that fire.
+     * @param pool The pool to run the callbacks on -- or nullptr to run them
+     * on the calling thread.
+     * @param now The current time in microseconds.
+     * @return The number of callbacks run or spawned -- or an error if
+     * allocation failed, in which case the remaining timers fire on the
+     * next call.
+     */
+    auto advance(ThreadPool *pool = nullptr, u64 now = get_time_microseconds())
+        -> Result<usize, AllocationError>
+    {
+        ResultVoid<AllocationError> res = Ok();
+        {
+            LockGuard<SpinLock> guard(lock);
+            auto target = now / resolution;
+
+            // Retry the tick a failed call stopped on; its timers are due
+            if (stalled)
+                res = expire(target > current ? target : current);
+
+            while (current < target && res.is_ok()) {
+                current = next_tick(target);
+                for (u32 level = 1; level < LEVELS; level++) {
+                    auto shift = SLOT_BITS * (level - 1);
+                    if (((current >> shift) & SLOT_MASK) != 0)
+                        break;
+                    cascade(level);
+                }
+                res = expire(target);
+            }
+            stalled = res.is_err();
+        }
+
+        auto count = due.size();
+        due.for_each([pool](std::function<void()> &func) {
+            if (pool != nullptr)
+                pool->spawn(std::move(func));
+            else
+                func();
+        });
+        due.clear();
+
+        if (res.is_err())
+            return res.unwrap_err();
+        return count;
+    }
+};
+
+}
\ No newline at end of file
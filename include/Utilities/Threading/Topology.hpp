@@ -0,0 +1,139 @@
+#pragma once
+#include "../Types.hpp"
+#include "../Allocator.hpp"
+#include "../List.hpp"
+
+namespace CrossFire
+{
+
+/**
+ * @brief Where a logical CPU sits in the machine.
+ * Cache groups are named by the lowest CPU sharing the cache, so two CPUs
+ * share an L2 or L3 exactly when their ids match.
+ */
+struct CpuInfo {
+    u32 id;
+    u32 core;
+    u32 package;
+    u32 l2;
+    u32 l3;
+    u32 smt;
+};
+
+/**
+ * @brief The scheduling priority of a thread, relative to the process.
+ */
+enum class ThreadPriority {
+    Low = 0,
+    Normal = 1,
+    High = 2,
+};
+
+/**
+ * @brief The CPUs this process may run on, and how they share cores and
+ * caches. Read once from sysfs on Linux, and otherwise approximated as one
+ * core per hardware thread.
+ */
+class CpuTopology final {
+    List<CpuInfo> cpus;
+    usize cores;
+    usize packages;
+
+    CpuTopology();
+
+public:
+    /**
+     * @brief Get the topology of this machine, detecting it on first use.
+     * @return The topology.
+     */
+    static auto get() -> const CpuTopology &;
+
+    CpuTopology(const CpuTopology &other) = delete;
+    CpuTopology &operator=(const CpuTopology &other) = delete;
+
+    /**
+     * @brief Get the logical CPUs, in OS order.
+     * @return The CPUs.
+     */
+    inline auto get_cpus() const -> Slice<CpuInfo>
+    {
+        return cpus.data;
+    }
+
+    /**
+     * @brief Get the number of logical CPUs, counting SMT siblings.
+     * @return The number of CPUs.
+     */
+    inline auto cpu_count() const -> usize
+    {
+        return cpus.data.len;
+    }
+
+    /**
+     * @brief Get the number of physical cores.
+     * @return The number of cores.
+     */
+    inline auto core_count() const -> usize
+    {
+        return cores;
+    }
+
+    /**
+     * @brief Get the number of CPU packages.
+     * @return The number of packages.
+     */
+    inline auto package_count() const -> usize
+    {
+        return packages;
+    }
+
+    /**
+     * @brief Get a worker count for a pool that shares the machine with a
+     * main thread: one per physical core, less the main thread's.
+     * @return The worker count, at least 1.
+     */
+    inline auto default_workers() const -> usize
+    {
+        return cores > 1 ? cores - 1 : 1;
+    }
+
+    /**
+     * @brief Pick the CPU for a worker. CPUs are handed out one per core
+     * first, then to the remaining SMT siblings, wrapping around.
+     * @param index The index of the worker.
+     * @param avoid_smt Whether to use only the first hardware thread of each
+     * core, for workers that saturate a core's vector units on their own.
+     * @param reserved The number of CPUs at the front of the order to leave
+     * to other threads, such as a main thread pinned with
+     * set_current_thread_affinity(worker_cpu(0, true, 0)). Workers past the
+     * remaining CPUs wrap around to share them, never the reserved ones --
+     * unless every CPU is reserved.
+     * @return The id of the CPU.
+     */
+    auto worker_cpu(usize index, bool avoid_smt, usize reserved) const -> u32;
+};
+
+/**
+ * @brief Name the calling thread, as shown by debuggers and profilers.
+ * Names are cut to 15 characters on Linux.
+ * @param name The name.
+ * @return True if the name was set, false otherwise.
+ */
+auto set_current_thread_name(const char *name) -> bool;
+
+/**
+ * @brief Pin the calling thread to one CPU.
+ * @param cpu The id of the CPU.
+ * @return True if the thread was pinned, false otherwise.
+ */
+auto set_current_thread_affinity(u32 cpu) -> bool;
+
+/**
+ * @brief Set the priority of the calling thread. Raising it above normal
+ * may need privileges the process lacks.
+ * @param priority The priority.
+ * @return True if the priority was set, false otherwise.
+ */
+auto set_current_thread_priority(ThreadPriority priority) -> bool;
+
+}
\ No newline at end of file
@@ -0,0 +1,218 @@
+#pragma once
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include "../Types.hpp"
+#include "../Allocator.hpp"
+#include "../List.hpp"
+
+namespace CrossFire
+{
+
+/**
+ * @brief A Chase-Lev work-stealing deque.
+ * One owner thread pushes and pops at the bottom, in LIFO order, while any
+ * number of thieves steal from the top, in FIFO order. Only the last
+ * element is contended, and the owner needs no atomic read-modify-write
+ * unless it is.
+ * The ring grows when full; outgrown rings are kept until destruction,
+ * because a thief may still be reading one.
+ * @tparam T The type of the elements, which must be trivially copyable.
+ */
+template <typename T> class WorkStealingDeque {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "WorkStealingDeque elements must be trivially copyable");
+
+    struct Ring {
+        i64 mask;
+        std::atomic<T> *cells;
+
+        inline auto get(i64 index) const -> T
+        {
+            return cells[index & mask].load(std::memory_order_relaxed);
+        }
+
+        inline auto put(i64 index, T value) -> void
+        {
+            cells[index & mask].store(value, std::memory_order_relaxed);
+        }
+    };
+
+    Allocator &allocator;
+    alignas(64) std::atomic<i64> top;
+    alignas(64) std::atomic<i64> bottom;
+    std::atomic<Ring *> ring;
+    List<Ring *> retired;
+
+    auto make_ring(i64 capacity) -> Result<Ring *, AllocationError>
+    {
+        auto header = allocator.alloc<Ring>(1);
+        if (header.is_err())
+            return header.unwrap_err();
+
+        auto cells = allocator.alloc<std::atomic<T> >(capacity);
+        if (cells.is_err()) {
+            allocator.dealloc(header.unwrap());
+            return cells.unwrap_err();
+        }
+
+        auto r = new (header.unwrap().ptr) Ring{ capacity - 1, nullptr };
+        r->cells = cells.unwrap().ptr;
+        for (i64 i = 0; i < capacity; i++)
+            new (&r->cells[i]) std::atomic<T>();
+        return r;
+    }
+
+    auto free_ring(Ring *r) -> void
+    {
+        allocator.dealloc(
+            Slice<std::atomic<T> >(r->cells, static_cast<usize>(r->mask + 1)));
+        allocator.dealloc(Slice<Ring>(r, 1));
+    }
+
+    auto grow(Ring *old, i64 t, i64 b) -> Result<Ring *, AllocationError>
+    {
+        auto res = make_ring((old->mask + 1) * 2);
+        if (res.is_err())
+            return res.unwrap_err();
+
+        auto r = res.unwrap();
+        for (i64 i = t; i < b; i++)
+            r->put(i, old->get(i));
+
+        auto pushed = retired.push(old);
+        if (pushed.is_err()) {
+            free_ring(r);
+            return pushed.unwrap_err();
+        }
+
+        ring.store(r, std::memory_order_release);
+        return r;
+    }
+
+public:
+    /**
+     * @brief Creates a new deque.
+     * @param allocator The allocator to use.
+     * @param capacity The initial capacity, a power of two.
+     */
+    explicit WorkStealingDeque(Allocator &allocator, usize capacity = 256)
+        : allocator(allocator)
+        , top(0)
+        , bottom(0)
+        , ring(nullptr)
+        , retired(allocator)
+    {
+        cf_assert(capacity > 0 && (capacity & (capacity - 1)) == 0,
+                  "Capacity must be a power of two");
+        ring.store(make_ring(static_cast<i64>(capacity)).unwrap(),
+                   std::memory_order_relaxed);
+    }
+
+    ~WorkStealingDeque()
+    {
+        free_ring(ring.load(std::memory_order_relaxed));
+        for (usize i = 0; i < retired.data.len; i++)
+            free_ring(retired.data.ptr[i]);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque &other) = delete;
+    WorkStealingDeque &operator=(const WorkStealingDeque &other) = delete;
+
+    /**
+     * @brief Get the number of elements. Only exact when no other thread is
+     * using the deque.
+     * @return The number of elements.
+     */
+    inline auto size() const -> usize
+    {
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_relaxed);
+        return b > t ? static_cast<usize>(b - t) : 0;
+    }
+
+    /**
+     * @brief Check if the deque looks empty.
+     * @return True if the deque is empty, false otherwise.
+     */
+    inline auto empty() const -> bool
+    {
+        return size() == 0;
+    }
+
+    /**
+     * @brief Push an element at the bottom. Owner only.
+     * @param value The element.
+     * @return Nothing -- or an error if growing failed.
+     */
+    auto push(T value) -> ResultVoid<AllocationError>
+    {
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_acquire);
+        auto r = ring.load(std::memory_order_relaxed);
+
+        if (b - t > r->mask) {
+            auto res = grow(r, t, b);
+            if (res.is_err())
+                return res.unwrap_err();
+            r = res.unwrap();
+        }
+
+        r->put(b, value);
+        bottom.store(b + 1, std::memory_order_release);
+        return Ok();
+    }
+
+    /**
+     * @brief Pop the most recently pushed element. Owner only.
+     * @return The element -- or None if the deque is empty.
+     */
+    auto pop() -> Option<T>
+    {
+        auto b = bottom.load(std::memory_order_relaxed) - 1;
+        auto r = ring.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+
+        Option<T> value = r->get(b);
+        if (t == b) {
+            // The last element, which a thief may be taking as well
+            if (!top.compare_exchange_strong(t, t + 1,
+                                             std::memory_order_seq_cst,
+                                             std::memory_order_relaxed))
+                value = std::nullopt;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return value;
+    }
+
+    /**
+     * @brief Steal the least recently pushed element. Any thread.
+     * @return The element -- or None if the deque is empty or another
+     * thread won the race for it.
+     */
+    auto steal() -> Option<T>
+    {
+        auto t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = bottom.load(std::memory_order_acquire);
+
+        if (t >= b)
+            return std::nullopt;
+
+        auto r = ring.load(std::memory_order_acquire);
+        T value = r->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed))
+            return std::nullopt;
+        return value;
+    }
+};
+
+}
\ No newline at end of file
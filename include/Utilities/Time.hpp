@@ -10,6 +10,12 @@ namespace CrossFire
  */
 auto get_time_microseconds() -> u64;
 
+/**
+ * @brief Get the current time in nanoseconds, from a monotonic clock.
+ * @return The current time in nanoseconds.
+ */
+auto get_time_nanoseconds() -> u64;
+
 /**
  * @brief The Timer class is a simple timer.
  */
@@ -106,6 +106,48 @@ template <typename T> struct Slice {
         cf_assert(index < len, "Slice index out of range");
         return ptr[index];
     }
+
+    /**
+     * @brief Get an element without a bounds check.
+     * Hot loops should check their range once up front and use this.
+     * @param index The index of the element.
+     * @return The element.
+     */
+    inline auto get_unchecked(usize index) -> T &
+    {
+        return ptr[index];
+    }
+
+    /**
+     * @brief Get a sub-slice, checking the range once.
+     * @param start The index of the first element.
+     * @param count The number of elements.
+     * @return The sub-slice.
+     */
+    inline auto subslice(usize start, usize count) -> Slice<T>
+    {
+        cf_assert(start <= len && count <= len - start,
+                  "Slice subrange out of range");
+        return Slice<T>(ptr + start, count);
+    }
+
+    /**
+     * @brief Get an unchecked iterator to the first element.
+     * @return The pointer to the first element.
+     */
+    inline auto begin() const -> T *
+    {
+        return ptr;
+    }
+
+    /**
+     * @brief Get an unchecked iterator past the last element.
+     * @return The pointer past the last element.
+     */
+    inline auto end() const -> T *
+    {
+        return ptr + len;
+    }
 };
 
 /**
@@ -1,4 +1,5 @@
 #include <Utilities/Allocator.hpp>
+#include <Utilities/ByteOps.hpp>
 #include <cstdlib>
 
 namespace CrossFire
@@ -40,18 +41,19 @@ auto CAllocator::reallocate(Slice<u8> ptr, usize size, usize alignment)
 #if defined(_MSC_VER)
     auto new_ptr = _aligned_realloc(ptr.ptr, size, alignment);
 #else // Aligned alloc is standard in C11
-    auto new_ptr = aligned_alloc(size, alignment);
+    auto new_ptr = aligned_alloc(alignment, size);
 #endif
 
     if (!new_ptr)
         return AllocationError::ReallocFailed;
 
 #if !defined(_MSC_VER)
+    // Only the bytes of the old block are valid to copy
+    if (ptr.ptr != nullptr)
+        memcpy(new_ptr, ptr.ptr, ptr.len < size ? ptr.len : size);
     free(ptr.ptr);
 #endif
 
-    memcpy(new_ptr, ptr.ptr, size);
-
     return Slice<u8>(static_cast<u8 *>(new_ptr), size);
 }
 
@@ -158,30 +160,25 @@ auto DebugAllocator::allocate(usize size, usize alignment)
     if (result.is_err())
         return result.unwrap_err();
 
-    alloc_count++;
-    alloc_size += size;
-
-    current_usage += size;
-    if (current_usage > peak_usage)
-        peak_usage = current_usage;
+    alloc_count.add();
+    alloc_size.add(size);
+    grow_usage(size);
 
-    for (usize i = 0; i < size; i++)
-        result.unwrap().ptr[i] =
-            0xAA; // SET TO 0xAA TO DETECT UNINITIALIZED MEMORY
+    // SET TO 0xAA TO DETECT UNINITIALIZED MEMORY
+    fill_bytes(result.unwrap(), 0xAA);
 
     return result.unwrap();
 }
 auto DebugAllocator::deallocate(Slice<u8> ptr) -> void
 {
-    for (usize i = 0; i < ptr.len; i++)
-        ptr[i] = 0xDD; // SET TO 0xDD TO DETECT USE AFTER FREE
+    // SET TO 0xDD TO DETECT USE AFTER FREE
+    fill_bytes(ptr, 0xDD);
 
     backing_allocator.deallocate(ptr);
 
-    dealloc_count++;
-    dealloc_size += ptr.len;
-
-    current_usage -= ptr.len;
+    dealloc_count.add();
+    dealloc_size.add(ptr.len);
+    current_usage.fetch_sub(ptr.len, std::memory_order_relaxed);
 }
 
 auto DebugAllocator::reallocate(Slice<u8> ptr, usize size, usize alignment)
@@ -191,15 +188,27 @@ auto DebugAllocator::reallocate(Slice<u8> ptr, usize size, usize alignment)
     if (result.is_err())
         return result.unwrap_err();
 
-    alloc_size += size - ptr.len;
-    current_usage += size - ptr.len;
-
-    if (current_usage > peak_usage)
-        peak_usage = current_usage;
+    // Shrinking wraps around, which the counters sum correctly
+    alloc_size.add(size - ptr.len);
+    if (size > ptr.len)
+        grow_usage(size - ptr.len);
+    else
+        current_usage.fetch_sub(ptr.len - size, std::memory_order_relaxed);
 
     return result.unwrap();
 }
 
+auto DebugAllocator::grow_usage(usize size) -> void
+{
+    auto usage =
+        current_usage.fetch_add(size, std::memory_order_relaxed) + size;
+    auto peak = peak_usage.load(std::memory_order_relaxed);
+    while (usage > peak &&
+           !peak_usage.compare_exchange_weak(peak, usage,
+                                             std::memory_order_relaxed))
+        ;
+}
+
 CAllocator c_allocator = CAllocator();
 u8 stack_buffer[64 * 1024];
 GPAllocator stack_allocator =
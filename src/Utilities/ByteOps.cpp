@@ -0,0 +1,324 @@
+#include <Utilities/ByteOps.hpp>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#define CF_BYTEOPS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC compiles any intrinsic without a target attribute
+#if defined(CF_BYTEOPS_X86) && !defined(_MSC_VER)
+#define CF_TARGET_SSE2 __attribute__((target("sse2")))
+#define CF_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CF_TARGET_SSE2
+#define CF_TARGET_AVX2
+#endif
+
+namespace CrossFire
+{
+
+namespace
+{
+
+/**
+ * Scalar kernels, used on every platform for the tails of the vector loops
+ */
+
+auto count_scalar(const u8 *ptr, usize len, u8 value) -> usize
+{
+    usize count = 0;
+    for (usize i = 0; i < len; i++)
+        count += ptr[i] == value;
+    return count;
+}
+
+auto reverse_scalar(u8 *ptr, usize len) -> void
+{
+    u8 *lo = ptr;
+    u8 *hi = ptr + len;
+    while (hi - lo > 1) {
+        u8 tmp = *lo;
+        *lo++ = *--hi;
+        *hi = tmp;
+    }
+}
+
+auto swap_scalar(u8 *ptr, usize count, usize size) -> void
+{
+    for (usize i = 0; i < count; i++)
+        reverse_scalar(ptr + i * size, size);
+}
+
+#if defined(CF_BYTEOPS_X86)
+
+/**
+ * SSE2 kernels
+ */
+
+CF_TARGET_SSE2 auto count_sse2(const u8 *ptr, usize len, u8 value) -> usize
+{
+    const __m128i needle = _mm_set1_epi8(static_cast<char>(value));
+    const __m128i zero = _mm_setzero_si128();
+    usize count = 0;
+    usize i = 0;
+
+    while (len - i >= 16) {
+        // Each byte lane counts up to 255 matches before it is flushed
+        usize blocks = (len - i) / 16;
+        if (blocks > 255)
+            blocks = 255;
+
+        __m128i acc = zero;
+        for (usize b = 0; b < blocks; b++, i += 16) {
+            __m128i v =
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, needle));
+        }
+
+        __m128i sums = _mm_sad_epu8(acc, zero);
+        auto high = _mm_srli_si128(sums, 8);
+        count += static_cast<usize>(_mm_cvtsi128_si32(sums)) +
+                 static_cast<usize>(_mm_cvtsi128_si32(high));
+    }
+
+    return count + count_scalar(ptr + i, len - i, value);
+}
+
+CF_TARGET_SSE2 inline auto reverse_vec_sse2(__m128i v) -> __m128i
+{
+    // Swap the bytes of each word, then reverse the words
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+}
+
+CF_TARGET_SSE2 auto reverse_sse2(u8 *ptr, usize len) -> void
+{
+    usize lo = 0;
+    usize hi = len;
+
+    while (hi - lo >= 32) {
+        auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + lo));
+        auto b =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + hi - 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(ptr + lo),
+                         reverse_vec_sse2(b));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(ptr + hi - 16),
+                         reverse_vec_sse2(a));
+        lo += 16;
+        hi -= 16;
+    }
+
+    reverse_scalar(ptr + lo, hi - lo);
+}
+
+CF_TARGET_SSE2 auto swap_sse2(u8 *ptr, usize count, usize size) -> void
+{
+    usize len = count * size;
+    usize i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + i));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        if (size == 4) {
+            v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+            v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        } else if (size == 8) {
+            v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+            v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(ptr + i), v);
+    }
+
+    swap_scalar(ptr + i, (len - i) / size, size);
+}
+
+/**
+ * AVX2 kernels
+ */
+
+CF_TARGET_AVX2 auto count_avx2(const u8 *ptr, usize len, u8 value) -> usize
+{
+    const __m256i needle = _mm256_set1_epi8(static_cast<char>(value));
+    const __m256i zero = _mm256_setzero_si256();
+    usize count = 0;
+    usize i = 0;
+
+    while (len - i >= 32) {
+        usize blocks = (len - i) / 32;
+        if (blocks > 255)
+            blocks = 255;
+
+        __m256i acc = zero;
+        for (usize b = 0; b < blocks; b++, i += 32) {
+            __m256i v =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr + i));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, needle));
+        }
+
+        alignas(32) u64 sums[4];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(sums),
+                           _mm256_sad_epu8(acc, zero));
+        count += sums[0] + sums[1] + sums[2] + sums[3];
+    }
+
+    return count + count_sse2(ptr + i, len - i, value);
+}
+
+CF_TARGET_AVX2 inline auto reverse_vec_avx2(__m256i v) -> __m256i
+{
+    const __m256i mask =
+        _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                         15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    v = _mm256_shuffle_epi8(v, mask);
+    return _mm256_permute4x64_epi64(v, _MM_SHUFFLE(1, 0, 3, 2));
+}
+
+CF_TARGET_AVX2 auto reverse_avx2(u8 *ptr, usize len) -> void
+{
+    usize lo = 0;
+    usize hi = len;
+
+    while (hi - lo >= 64) {
+        auto a =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr + lo));
+        auto b = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(ptr + hi - 32));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(ptr + lo),
+                            reverse_vec_avx2(b));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(ptr + hi - 32),
+                            reverse_vec_avx2(a));
+        lo += 32;
+        hi -= 32;
+    }
+
+    reverse_sse2(ptr + lo, hi - lo);
+}
+
+CF_TARGET_AVX2 auto swap_avx2(u8 *ptr, usize count, usize size) -> void
+{
+    __m256i mask;
+    if (size == 2)
+        mask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12,
+                                15, 14, 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10,
+                                13, 12, 15, 14);
+    else if (size == 4)
+        mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14,
+                                13, 12, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8,
+                                15, 14, 13, 12);
+    else
+        mask = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10,
+                                9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12,
+                                11, 10, 9, 8);
+
+    usize len = count * size;
+    usize i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(ptr + i),
+                            _mm256_shuffle_epi8(v, mask));
+    }
+
+    swap_sse2(ptr + i, (len - i) / size, size);
+}
+
+#endif
+
+/**
+ * @brief The kernels selected for this machine.
+ */
+struct Kernels {
+    SimdLevel level;
+    usize (*count)(const u8 *ptr, usize len, u8 value);
+    void (*reverse)(u8 *ptr, usize len);
+    void (*swap)(u8 *ptr, usize count, usize size);
+};
+
+auto detect_level() -> SimdLevel
+{
+#if defined(CF_BYTEOPS_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] >= 7) {
+        __cpuidex(info, 1, 0);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+
+        // The OS must save the YMM registers as well
+        if (osxsave && avx && (_xgetbv(0) & 6) == 6) {
+            __cpuidex(info, 7, 0);
+            if (info[1] & (1 << 5))
+                return SimdLevel::AVX2;
+        }
+    }
+#if defined(_M_X64)
+    return SimdLevel::SSE2;
+#else
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) ? SimdLevel::SSE2 : SimdLevel::Scalar;
+#endif
+#elif defined(CF_BYTEOPS_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SimdLevel::SSE2;
+    return SimdLevel::Scalar;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+auto get_kernels() -> const Kernels &
+{
+    static const Kernels kernels = []() -> Kernels {
+        auto level = detect_level();
+        switch (level) {
+#if defined(CF_BYTEOPS_X86)
+        case SimdLevel::AVX2:
+            return { level, count_avx2, reverse_avx2, swap_avx2 };
+        case SimdLevel::SSE2:
+            return { level, count_sse2, reverse_sse2, swap_sse2 };
+#endif
+        default:
+            return { SimdLevel::Scalar, count_scalar, reverse_scalar,
+                     swap_scalar };
+        }
+    }();
+    return kernels;
+}
+
+}
+
+auto get_simd_level() -> SimdLevel
+{
+    return get_kernels().level;
+}
+
+namespace detail
+{
+
+auto count_byte_wide(const u8 *ptr, usize len, u8 value) -> usize
+{
+    return get_kernels().count(ptr, len, value);
+}
+
+auto reverse_bytes_wide(u8 *ptr, usize len) -> void
+{
+    get_kernels().reverse(ptr, len);
+}
+
+auto byte_swap_wide(u8 *ptr, usize count, usize size) -> void
+{
+    get_kernels().swap(ptr, count, size);
+}
+
+}
+
+}
\ No newline at end of file
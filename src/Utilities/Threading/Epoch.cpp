@@ -0,0 +1,261 @@
+#include <Utilities/Threading/Epoch.hpp>
+#include <algorithm>
+#include <thread>
+
+namespace CrossFire
+{
+
+namespace detail
+{
+
+EpochRecord::EpochRecord()
+    : state(0)
+    , in_use(false)
+    , next(nullptr)
+    , nesting(0)
+    , since_collect(0)
+    , tags{ 0, 0, 0 }
+    , bags{ List<Retired>(c_allocator), List<Retired>(c_allocator),
+            List<Retired>(c_allocator) }
+{
+}
+
+}
+
+namespace
+{
+
+/**
+ * @brief Hands the thread's record back when the thread exits.
+ */
+struct RecordRelease {
+    ~RecordRelease()
+    {
+        auto &record = detail::epoch_record();
+        if (record != nullptr) {
+            // Free what can be freed now; the rest goes to the next owner
+            EpochDomain::get().collect();
+            record->in_use.store(false, std::memory_order_release);
+            record = nullptr;
+        }
+    }
+};
+
+}
+
+EpochDomain::EpochDomain()
+    : epoch(0)
+    , records(nullptr)
+    , hazards(nullptr)
+{
+}
+
+auto EpochDomain::get() -> EpochDomain &
+{
+    static EpochDomain instance;
+    return instance;
+}
+
+auto EpochDomain::claim() -> detail::EpochRecord *
+{
+    static thread_local RecordRelease release;
+    (void)release;
+
+    for (auto rec = records.load(std::memory_order_acquire); rec != nullptr;
+         rec = rec->next) {
+        auto expected = false;
+        if (!rec->in_use.load(std::memory_order_relaxed) &&
+            rec->in_use.compare_exchange_strong(expected, true,
+                                                std::memory_order_acquire))
+            return rec;
+    }
+
+    // Records are never freed, so the list only grows at the front
+    auto rec = c_allocator.create<detail::EpochRecord>().unwrap();
+    rec->in_use.store(true, std::memory_order_relaxed);
+    auto head = records.load(std::memory_order_relaxed);
+    do {
+        rec->next = head;
+    } while (!records.compare_exchange_weak(head, rec,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed));
+    return rec;
+}
+
+auto EpochDomain::try_advance() -> bool
+{
+    auto e = epoch.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    for (auto rec = records.load(std::memory_order_acquire); rec != nullptr;
+         rec = rec->next) {
+        auto state = rec->state.load(std::memory_order_acquire);
+        if ((state & 1) != 0 && (state >> 1) != e)
+            return false;
+    }
+
+    return epoch.compare_exchange_strong(e, e + 1, std::memory_order_acq_rel,
+                                         std::memory_order_relaxed);
+}
+
+auto EpochDomain::held(List<void *> &ptrs) -> ResultVoid<AllocationError>
+{
+    // Pairs with the fence in HazardPointer::protect(): either the
+    // protector sees the object unlinked and retries, or this sees its slot
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (auto slot = hazards.load(std::memory_order_acquire); slot != nullptr;
+         slot = slot->next) {
+        auto ptr = slot->ptr.load(std::memory_order_acquire);
+        if (ptr == nullptr)
+            continue;
+
+        auto res = ptrs.push(ptr);
+        if (res.is_err())
+            return res.unwrap_err();
+    }
+
+    std::sort(ptrs.data.ptr, ptrs.data.ptr + ptrs.data.len);
+    return Ok();
+}
+
+auto EpochDomain::reclaim(List<Retired> &bag, List<void *> &held_ptrs)
+    -> void
+{
+    // Keep what a hazard pointer holds, compacted at the front
+    usize kept = 0;
+    for (usize i = 0; i < bag.data.len; i++) {
+        auto retired = bag.data.ptr[i];
+        if (std::binary_search(held_ptrs.data.ptr,
+                               held_ptrs.data.ptr + held_ptrs.data.len,
+                               retired.ptr)) {
+            bag.data.ptr[kept++] = retired;
+            continue;
+        }
+
+        retired.destroy(retired.ptr, retired.size);
+        retired.allocator->deallocate(
+            Slice<u8>(static_cast<u8 *>(retired.ptr), retired.size));
+    }
+    bag.data.len = kept;
+}
+
+auto EpochDomain::defer(const Retired &retired) -> ResultVoid<AllocationError>
+{
+    auto &rec = record();
+    auto e = epoch.load(std::memory_order_acquire);
+    auto index = e % 3;
+
+    // The bag last held objects from three or more epochs ago
+    if (rec.tags[index] != e) {
+        if (rec.bags[index].data.len > 0) {
+            List<void *> held_ptrs(c_allocator);
+            auto res = held(held_ptrs);
+            if (res.is_err())
+                return res.unwrap_err();
+            reclaim(rec.bags[index], held_ptrs);
+        }
+        rec.tags[index] = e;
+    }
+
+    auto res = rec.bags[index].push(retired);
+    if (res.is_err())
+        return res.unwrap_err();
+
+    if (++rec.since_collect >= COLLECT_INTERVAL)
+        collect();
+    return Ok();
+}
+
+auto EpochDomain::collect() -> void
+{
+    auto &own = record();
+    own.since_collect = 0;
+    try_advance();
+    auto e = epoch.load(std::memory_order_acquire);
+
+    // Also take in what exited threads left behind in their records
+    auto due = [e](detail::EpochRecord &rec) {
+        for (usize i = 0; i < 3; i++) {
+            if (rec.bags[i].data.len > 0 && rec.tags[i] + 2 <= e)
+                return true;
+        }
+        return false;
+    };
+
+    List<void *> held_ptrs(c_allocator);
+    bool scanned = false;
+    for (auto rec = records.load(std::memory_order_acquire); rec != nullptr;
+         rec = rec->next) {
+        auto expected = false;
+        if (rec != &own &&
+            (rec->in_use.load(std::memory_order_relaxed) ||
+             !rec->in_use.compare_exchange_strong(expected, true,
+                                                  std::memory_order_acquire)))
+            continue;
+
+        if (due(*rec)) {
+            // Hazard pointers are read after the grace period, so any set
+            // while a reader was pinned is visible here
+            if (!scanned)
+                scanned = held(held_ptrs).is_ok();
+            for (usize i = 0; scanned && i < 3; i++) {
+                if (rec->tags[i] + 2 <= e)
+                    reclaim(rec->bags[i], held_ptrs);
+            }
+        }
+
+        if (rec != &own)
+            rec->in_use.store(false, std::memory_order_release);
+    }
+}
+
+auto EpochDomain::synchronize() -> void
+{
+    cf_assert(record().nesting == 0, "EpochDomain synchronize while pinned");
+
+    auto target = epoch.load(std::memory_order_acquire) + 2;
+    while (epoch.load(std::memory_order_acquire) < target) {
+        if (!try_advance())
+            std::this_thread::yield();
+    }
+    collect();
+}
+
+auto EpochDomain::pending() -> usize
+{
+    auto &rec = record();
+    return rec.bags[0].data.len + rec.bags[1].data.len + rec.bags[2].data.len;
+}
+
+HazardPointer::HazardPointer()
+    : slot(nullptr)
+{
+    auto &domain = EpochDomain::get();
+    for (auto s = domain.hazards.load(std::memory_order_acquire); s != nullptr;
+         s = s->next) {
+        auto expected = false;
+        if (!s->in_use.load(std::memory_order_relaxed) &&
+            s->in_use.compare_exchange_strong(expected, true,
+                                              std::memory_order_acquire)) {
+            slot = s;
+            return;
+        }
+    }
+
+    slot = c_allocator.create<detail::HazardSlot>().unwrap();
+    slot->ptr.store(nullptr, std::memory_order_relaxed);
+    slot->in_use.store(true, std::memory_order_relaxed);
+    auto head = domain.hazards.load(std::memory_order_relaxed);
+    do {
+        slot->next = head;
+    } while (!domain.hazards.compare_exchange_weak(
+        head, slot, std::memory_order_release, std::memory_order_relaxed));
+}
+
+HazardPointer::~HazardPointer()
+{
+    slot->ptr.store(nullptr, std::memory_order_release);
+    slot->in_use.store(false, std::memory_order_release);
+}
+
+}
\ No newline at end of file
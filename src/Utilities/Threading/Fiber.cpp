@@ -0,0 +1,272 @@
+#include <Utilities/Threading/Fiber.hpp>
+
+#if defined(CF_FIBERS)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(CF_FIBER_ASM)
+
+/**
+ * Context switches save the callee-saved registers on the current stack,
+ * store the stack pointer, and load the other one. A new context is a stack
+ * laid out as if it had been switched away from, returning into a
+ * trampoline that calls the entry function.
+ */
+
+#if defined(__x86_64__)
+
+// rdi = void **from, rsi = void *to
+asm(R"(
+.text
+.globl cf_fiber_switch
+.type cf_fiber_switch, @function
+.align 16
+cf_fiber_switch:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+.size cf_fiber_switch, .-cf_fiber_switch
+
+.globl cf_fiber_trampoline
+.type cf_fiber_trampoline, @function
+.align 16
+cf_fiber_trampoline:
+    movq %r13, %rdi
+    callq *%r12
+    ud2
+.size cf_fiber_trampoline, .-cf_fiber_trampoline
+.section .note.GNU-stack,"",@progbits
+.text
+)");
+
+#elif defined(__aarch64__)
+
+// x0 = void **from, x1 = void *to
+asm(R"(
+.text
+.globl cf_fiber_switch
+.type cf_fiber_switch, %function
+.align 4
+cf_fiber_switch:
+    sub sp, sp, #160
+    stp x19, x20, [sp, #0]
+    stp x21, x22, [sp, #16]
+    stp x23, x24, [sp, #32]
+    stp x25, x26, [sp, #48]
+    stp x27, x28, [sp, #64]
+    stp x29, x30, [sp, #80]
+    stp d8, d9, [sp, #96]
+    stp d10, d11, [sp, #112]
+    stp d12, d13, [sp, #128]
+    stp d14, d15, [sp, #144]
+    mov x2, sp
+    str x2, [x0]
+    mov sp, x1
+    ldp x19, x20, [sp, #0]
+    ldp x21, x22, [sp, #16]
+    ldp x23, x24, [sp, #32]
+    ldp x25, x26, [sp, #48]
+    ldp x27, x28, [sp, #64]
+    ldp x29, x30, [sp, #80]
+    ldp d8, d9, [sp, #96]
+    ldp d10, d11, [sp, #112]
+    ldp d12, d13, [sp, #128]
+    ldp d14, d15, [sp, #144]
+    add sp, sp, #160
+    ret
+.size cf_fiber_switch, .-cf_fiber_switch
+
+.globl cf_fiber_trampoline
+.type cf_fiber_trampoline, %function
+.align 4
+cf_fiber_trampoline:
+    mov x0, x20
+    blr x19
+    brk #0
+.size cf_fiber_trampoline, .-cf_fiber_trampoline
+.section .note.GNU-stack,"",%progbits
+.text
+)");
+
+#endif
+
+extern "C" void cf_fiber_switch(void **from, void *to);
+extern "C" void cf_fiber_trampoline();
+
+namespace CrossFire
+{
+
+namespace detail
+{
+
+auto fiber_make(FiberContext &context, Slice<u8> stack, void (*entry)(void *),
+                void *arg) -> void
+{
+    auto top = reinterpret_cast<uintptr_t>(stack.ptr + stack.len) &
+               ~static_cast<uintptr_t>(15);
+    auto words = reinterpret_cast<u64 *>(top);
+
+#if defined(__x86_64__)
+    // Popped in order: control words, r15, r14, r13, r12, rbx, rbp, and the
+    // return address; the trampoline is entered with rsp 16-byte aligned
+    words -= 10;
+    words[0] = 0x1F80 | (static_cast<u64>(0x037F) << 32);
+    words[1] = 0;
+    words[2] = 0;
+    words[3] = reinterpret_cast<u64>(arg);
+    words[4] = reinterpret_cast<u64>(entry);
+    words[5] = 0;
+    words[6] = 0;
+    words[7] = reinterpret_cast<u64>(&cf_fiber_trampoline);
+    words[8] = 0;
+    words[9] = 0;
+#elif defined(__aarch64__)
+    // x19 holds the entry, x20 the argument and x30 the trampoline
+    words -= 20;
+    for (usize i = 0; i < 20; i++)
+        words[i] = 0;
+    words[0] = reinterpret_cast<u64>(entry);
+    words[1] = reinterpret_cast<u64>(arg);
+    words[11] = reinterpret_cast<u64>(&cf_fiber_trampoline);
+#endif
+
+    context.sp = words;
+}
+
+auto fiber_switch(FiberContext &from, FiberContext &to) -> void
+{
+    cf_fiber_switch(&from.sp, to.sp);
+}
+
+}
+
+}
+
+#elif defined(CF_FIBER_UCONTEXT)
+
+namespace CrossFire
+{
+
+namespace detail
+{
+
+namespace
+{
+
+// makecontext only passes int arguments, so the entry is handed over here
+thread_local void (*pending_entry)(void *) = nullptr;
+thread_local void *pending_arg = nullptr;
+
+auto ucontext_entry() -> void
+{
+    auto entry = pending_entry;
+    auto arg = pending_arg;
+    entry(arg);
+}
+
+}
+
+auto fiber_make(FiberContext &context, Slice<u8> stack, void (*entry)(void *),
+                void *arg) -> void
+{
+    getcontext(&context.context);
+    context.context.uc_stack.ss_sp = stack.ptr;
+    context.context.uc_stack.ss_size = stack.len;
+    context.context.uc_link = nullptr;
+    context.entry = entry;
+    context.arg = arg;
+    makecontext(&context.context, reinterpret_cast<void (*)()>(ucontext_entry),
+                0);
+}
+
+auto fiber_switch(FiberContext &from, FiberContext &to) -> void
+{
+    // The first switch into a context starts it, so hand over its entry
+    if (to.entry != nullptr) {
+        pending_entry = to.entry;
+        pending_arg = to.arg;
+        to.entry = nullptr;
+    }
+    swapcontext(&from.context, &to.context);
+}
+
+}
+
+}
+
+#endif
+
+namespace CrossFire
+{
+
+namespace detail
+{
+
+auto fiber_worker_slot() -> void *&
+{
+    // Out of line, so that a fiber resumed on another thread never reuses
+    // the address of the previous thread's slot
+    static thread_local void *slot = nullptr;
+    return slot;
+}
+
+#if defined(CF_FIBERS)
+
+namespace
+{
+
+auto page_size() -> usize
+{
+    static const usize size = static_cast<usize>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+}
+
+auto fiber_stack_alloc(Allocator &allocator, usize size)
+    -> Result<Slice<u8>, AllocationError>
+{
+    auto page = page_size();
+    size = (size + page - 1) & ~(page - 1);
+    auto res = allocator.allocate(size + page, page);
+    if (res.is_err())
+        return res.unwrap_err();
+
+    // Fails harmlessly if the allocator ignored the alignment
+    auto memory = res.unwrap();
+    (void)mprotect(memory.ptr, page, PROT_NONE);
+    return Slice<u8>(memory.ptr + page, size);
+}
+
+auto fiber_stack_free(Allocator &allocator, Slice<u8> stack) -> void
+{
+    // The allocator may write to the page again once it has it back
+    auto page = page_size();
+    (void)mprotect(stack.ptr - page, page, PROT_READ | PROT_WRITE);
+    allocator.deallocate(Slice<u8>(stack.ptr - page, stack.len + page));
+}
+
+#endif
+
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+#include <Utilities/Threading/Futex.hpp>
+#include <climits>
+#include <thread>
+
+#if defined(CF_FUTEX)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace CrossFire
+{
+
+namespace detail
+{
+
+static_assert(sizeof(std::atomic<u32>) == sizeof(u32),
+              "Futex words must be plain 32-bit integers");
+
+#if defined(CF_FUTEX)
+
+auto futex_wait(std::atomic<u32> &word, u32 expected) -> void
+{
+    syscall(SYS_futex, reinterpret_cast<u32 *>(&word), FUTEX_WAIT_PRIVATE,
+            expected, nullptr, nullptr, 0);
+}
+
+auto futex_wake(std::atomic<u32> &word, u32 count) -> void
+{
+    syscall(SYS_futex, reinterpret_cast<u32 *>(&word), FUTEX_WAKE_PRIVATE,
+            static_cast<int>(count > INT_MAX ? INT_MAX : count), nullptr,
+            nullptr, 0);
+}
+
+#else
+
+auto futex_wait(std::atomic<u32> &word, u32 expected) -> void
+{
+    if (word.load(std::memory_order_relaxed) == expected)
+        std::this_thread::yield();
+}
+
+auto futex_wake(std::atomic<u32> &, u32) -> void
+{
+}
+
+#endif
+
+auto futex_wake_all(std::atomic<u32> &word) -> void
+{
+    futex_wake(word, UINT_MAX);
+}
+
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include <Utilities/Threading/ThreadContext.hpp>
+#include <Utilities/List.hpp>
+#include <Utilities/Threading/SpinLock.hpp>
+
+namespace CrossFire
+{
+
+namespace
+{
+
+/**
+ * @brief Hands out thread ids, lowest free first.
+ */
+struct IdRegistry {
+    SpinLock lock;
+    List<u32> free;
+    u32 next;
+
+    IdRegistry()
+        : free(c_allocator)
+        , next(0)
+    {
+    }
+
+    static auto get() -> IdRegistry &
+    {
+        static IdRegistry instance;
+        return instance;
+    }
+
+    auto acquire() -> u32
+    {
+        LockGuard<SpinLock> guard(lock);
+        if (free.data.len == 0)
+            return next++;
+
+        // Few threads exit, so a linear scan for the lowest is fine
+        usize lowest = 0;
+        for (usize i = 1; i < free.data.len; i++) {
+            if (free.data.ptr[i] < free.data.ptr[lowest])
+                lowest = i;
+        }
+        auto id = free.data.ptr[lowest];
+        free.data.ptr[lowest] = free.data.ptr[--free.data.len];
+        return id;
+    }
+
+    auto release(u32 id) -> void
+    {
+        LockGuard<SpinLock> guard(lock);
+        // If this fails the id is lost, which only costs a slot
+        (void)free.push(id);
+    }
+
+    auto limit() -> u32
+    {
+        LockGuard<SpinLock> guard(lock);
+        return next;
+    }
+};
+
+auto release_arena(ThreadContext &context) -> void
+{
+    if (context.arena != nullptr)
+        context.allocator->destroy(context.arena);
+    context.arena = nullptr;
+}
+
+/**
+ * @brief Hands the thread's id and arena back when the thread exits.
+ */
+struct ContextRelease {
+    ~ContextRelease()
+    {
+        auto &context = detail::thread_context_slot();
+        if (context.initialized) {
+            release_arena(context);
+            IdRegistry::get().release(context.id);
+            context.initialized = false;
+        }
+    }
+};
+
+}
+
+auto init_thread_context(const ThreadContextConfig &config) -> ThreadContext &
+{
+    static thread_local ContextRelease release;
+    (void)release;
+
+    auto &context = detail::thread_context_slot();
+    if (!context.initialized) {
+        context.id = IdRegistry::get().acquire();
+        context.pool = nullptr;
+        context.worker = 0;
+        context.initialized = true;
+    } else {
+        release_arena(context);
+    }
+
+    context.allocator =
+        config.allocator != nullptr ? config.allocator : &c_allocator;
+    context.scratch = context.allocator;
+    if (config.scratch_size > 0) {
+        auto arena = context.allocator->create<LinearAllocator>(
+            config.scratch_size, *context.allocator);
+        if (arena.is_ok()) {
+            context.arena = arena.unwrap();
+            context.scratch = context.arena;
+        }
+    }
+
+    context.logger =
+        config.logger != nullptr ? config.logger : &Logger::get_stdout();
+    context.profiler = config.profiler;
+    return context;
+}
+
+auto thread_id_limit() -> u32
+{
+    return IdRegistry::get().limit();
+}
+
+}
\ No newline at end of file
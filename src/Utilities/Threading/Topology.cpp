@@ -0,0 +1,275 @@
+#include <Utilities/Threading/Topology.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#include <sys/resource.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+namespace CrossFire
+{
+
+namespace
+{
+
+#if defined(__linux__)
+
+constexpr u32 NO_CPU = 0xFFFFFFFF;
+
+/**
+ * @brief Read the first line of a small file, such as a sysfs entry.
+ */
+auto read_line(const char *path, char *buffer, usize size) -> bool
+{
+    auto file = fopen(path, "r");
+    if (file == nullptr)
+        return false;
+
+    auto ok = fgets(buffer, static_cast<int>(size), file) != nullptr;
+    fclose(file);
+    return ok;
+}
+
+auto read_u32(const char *path, u32 fallback) -> u32
+{
+    char line[64];
+    if (!read_line(path, line, sizeof(line)))
+        return fallback;
+    return static_cast<u32>(strtoul(line, nullptr, 10));
+}
+
+/**
+ * @brief Call a function for every CPU in a list such as "0-3,8,10-11".
+ */
+template <typename F> auto for_each_in_list(const char *text, F &&func) -> void
+{
+    auto p = text;
+    while (*p >= '0' && *p <= '9') {
+        char *end;
+        auto first = static_cast<u32>(strtoul(p, &end, 10));
+        auto last = first;
+        if (*end == '-')
+            last = static_cast<u32>(strtoul(end + 1, &end, 10));
+
+        for (auto cpu = first; cpu <= last; cpu++)
+            func(cpu);
+
+        p = *end == ',' ? end + 1 : end;
+    }
+}
+
+auto lowest_in_list(const char *path, u32 fallback) -> u32
+{
+    char line[1024];
+    if (!read_line(path, line, sizeof(line)))
+        return fallback;
+
+    auto lowest = NO_CPU;
+    for_each_in_list(line, [&lowest](u32 cpu) {
+        if (cpu < lowest)
+            lowest = cpu;
+    });
+    return lowest != NO_CPU ? lowest : fallback;
+}
+
+auto detect_cpu(u32 id) -> CpuInfo
+{
+    char path[128];
+    CpuInfo info{ id, id, 0, id, id, 0 };
+
+    // A core is named by its lowest hardware thread, renumbered later
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%u/topology/thread_siblings_list",
+             id);
+    info.core = lowest_in_list(path, id);
+
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%u/topology/physical_package_id", id);
+    info.package = read_u32(path, 0);
+
+    for (u32 index = 0; index < 8; index++) {
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%u/cache/index%u/level", id,
+                 index);
+        auto level = read_u32(path, 0);
+        if (level == 0)
+            break;
+
+        char type[32];
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%u/cache/index%u/type", id,
+                 index);
+        if (read_line(path, type, sizeof(type)) &&
+            strncmp(type, "Instruction", 11) == 0)
+            continue;
+
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%u/cache/index%u/shared_cpu_list",
+                 id, index);
+        if (level == 2)
+            info.l2 = lowest_in_list(path, id);
+        else if (level == 3)
+            info.l3 = lowest_in_list(path, id);
+    }
+
+    return info;
+}
+
+#endif
+
+}
+
+CpuTopology::CpuTopology()
+    : cpus(c_allocator)
+    , cores(0)
+    , packages(0)
+{
+#if defined(__linux__)
+    // Only the CPUs this process may run on, which a container may limit
+    cpu_set_t allowed;
+    auto masked = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    char line[1024];
+    if (read_line("/sys/devices/system/cpu/online", line, sizeof(line))) {
+        for_each_in_list(line, [&](u32 cpu) {
+            if (masked && (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed)))
+                return;
+            cpus.push(detect_cpu(cpu)).unwrap();
+        });
+    }
+#endif
+
+    if (cpus.data.len == 0) {
+        auto count = std::thread::hardware_concurrency();
+        if (count == 0)
+            count = 1;
+        for (u32 i = 0; i < count; i++)
+            cpus.push(CpuInfo{ i, i, 0, i, i, 0 }).unwrap();
+    }
+
+    // Renumber cores densely, and number the threads within each core
+    List<u32> keys(c_allocator);
+    auto list = cpus.data;
+    for (usize i = 0; i < list.len; i++)
+        keys.push(list.ptr[i].core).unwrap();
+
+    for (usize i = 0; i < list.len; i++) {
+        auto &cpu = list.ptr[i];
+        auto core = static_cast<u32>(cores);
+        u32 smt = 0;
+        bool new_package = true;
+        for (usize j = 0; j < i; j++) {
+            auto &other = list.ptr[j];
+            if (other.package != cpu.package)
+                continue;
+
+            new_package = false;
+            if (keys.data.ptr[j] == keys.data.ptr[i]) {
+                core = other.core;
+                smt++;
+            }
+        }
+
+        cpu.core = core;
+        cpu.smt = smt;
+        if (core == cores)
+            cores++;
+        if (new_package)
+            packages++;
+    }
+}
+
+auto CpuTopology::get() -> const CpuTopology &
+{
+    static CpuTopology instance;
+    return instance;
+}
+
+auto CpuTopology::worker_cpu(usize index, bool avoid_smt, usize reserved) const
+    -> u32
+{
+    auto count = avoid_smt ? cores : cpus.data.len;
+    // Wrap around within the unreserved CPUs, so that extra workers never
+    // land on a reserved one
+    auto slot = reserved < count ? reserved + index % (count - reserved)
+                                 : index % count;
+
+    // First threads of each core come first, then the siblings
+    for (u32 smt = 0;; smt++) {
+        for (usize i = 0; i < cpus.data.len; i++) {
+            auto &cpu = cpus.data.ptr[i];
+            if (cpu.smt != smt)
+                continue;
+            if (slot == 0)
+                return cpu.id;
+            slot--;
+        }
+    }
+}
+
+auto set_current_thread_name(const char *name) -> bool
+{
+#if defined(__linux__)
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%s", name);
+    return pthread_setname_np(pthread_self(), buffer) == 0;
+#elif defined(__APPLE__)
+    return pthread_setname_np(name) == 0;
+#else
+    (void)name;
+    return false;
+#endif
+}
+
+auto set_current_thread_affinity(u32 cpu) -> bool
+{
+#if defined(__linux__)
+    if (cpu >= CPU_SETSIZE)
+        return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+    if (cpu >= 64)
+        return false;
+    return SetThreadAffinityMask(GetCurrentThread(), 1ULL << cpu) != 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+auto set_current_thread_priority(ThreadPriority priority) -> bool
+{
+#if defined(__linux__)
+    // Niceness is per thread on Linux
+    static const int nice[] = { 10, 0, -5 };
+    auto tid = static_cast<id_t>(syscall(SYS_gettid));
+    return setpriority(PRIO_PROCESS, tid,
+                       nice[static_cast<int>(priority)]) == 0;
+#elif defined(_WIN32)
+    static const int levels[] = { THREAD_PRIORITY_BELOW_NORMAL,
+                                  THREAD_PRIORITY_NORMAL,
+                                  THREAD_PRIORITY_ABOVE_NORMAL };
+    return SetThreadPriority(GetCurrentThread(),
+                             levels[static_cast<int>(priority)]) != 0;
+#else
+    (void)priority;
+    return false;
+#endif
+}
+
+}
\ No newline at end of file
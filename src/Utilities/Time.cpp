@@ -11,4 +11,11 @@ auto get_time_microseconds() -> u64
         .count();
 }
 
+auto get_time_nanoseconds() -> u64
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
 }
\ No newline at end of file